@@ -11,17 +11,47 @@
 #include <unistd.h>
 #include <signal.h>
 #include <sstream>
+#include <map>
+#include <poll.h>
+#include <errno.h>
+#include <set>
+#include <algorithm>
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <mist/config.h>
+#include <mist/timing.h>
 #include "buffer_stream.h"
+#include "buffer_fanout.h"
+#include "buffer_input.h"
 #include <mist/stream.h>
 
+/// Seconds an edge connection may take to send the name of the stream it wants.
+#define RELAY_NAME_TIMEOUT 5
+/// Maximum amount of seconds between attempts to reconnect to the upstream buffer.
+#define UPSTREAM_RETRY_MAX 10
+/// Amount of keyframe intervals before the last pulled packet a reconnection may start at without being a restart.
+#define UPSTREAM_RESTART_KEYS 2
+/// Minimum amount of milliseconds before the last pulled packet a reconnection may start at without being a restart.
+#define UPSTREAM_RESTART_MIN 1000
+
+/// Maximum amount of events handled per epoll_wait call by the push input thread.
+#define PUSHIN_EVENTS 64
+
 /// Holds all code unique to the Buffer.
 namespace Buffer {
 
   volatile bool buffer_running = true; ///< Set to false when shutting down.
-  Stream * thisStream = 0;
-  Socket::Server SS; ///< The server socket.
+  Stream * thisStream = 0; ///< The stream read from standard input, if any.
+  tthread::mutex streams_mutex; ///< Mutex for streams.
+  tthread::mutex report_mutex; ///< Held while reporting statistics, so streams are not deleted halfway.
+  std::map<std::string, Stream*> streams; ///< All streams held by this buffer, by name.
+  std::map<std::string, Socket::Server> listeners; ///< Server sockets for all streams, only used by the main thread.
+  Socket::Server relayListener; ///< TCP server socket edge buffers connect to, only used by the main thread.
+  std::vector<Socket::Connection> relayPending; ///< Edge connections that did not send a stream name yet.
+  std::vector<long long int> relayPendingSince; ///< Time each pending edge connection was accepted, in seconds.
+  std::string upstreamHost; ///< Host of the buffer to pull the stream from in edge mode.
+  int upstreamPort = 0; ///< TCP port of the buffer to pull the stream from in edge mode.
+  std::string upstreamName; ///< Name of the stream to pull in edge mode.
 
   /// Gets the current system time in milliseconds.
   long long int getNowMS(){
@@ -30,6 +60,8 @@ namespace Buffer {
     return t.tv_sec * 1000 + t.tv_usec / 1000;
   } //getNowMS
 
+  /// Sends the statistics of all streams to the controller once per second.
+  /// The controller asks for a full report with a "full" line when it lost track of the users or metadata.
   void handleStats(void * empty){
     if (empty != 0){
       return;
@@ -38,224 +70,679 @@ namespace Buffer {
     Socket::Connection StatsSocket = Socket::Connection("/tmp/mist/statistics", true);
     while (buffer_running){
       usleep(1000000); //sleep one second
-      Stream::get()->cleanUsers();
+      bool full = false; //whether to report everything
       if ( !StatsSocket.connected()){
         StatsSocket = Socket::Connection("/tmp/mist/statistics", true);
+        full = StatsSocket.connected();
+      }
+      if (StatsSocket.connected() && StatsSocket.spool()){
+        while (StatsSocket.Received().size()){
+          if (StatsSocket.Received().get().substr(0, 4) == "full"){
+            full = true;
+          }
+          StatsSocket.Received().get().clear();
+        }
+      }
+      //the reports are built without holding streams_mutex, so push input is never held up by them
+      std::vector<Stream*> reporting;
+      streams_mutex.lock();
+      for (std::map<std::string, Stream*>::iterator it = streams.begin(); it != streams.end(); it++){
+        reporting.push_back(it->second);
       }
+      report_mutex.lock();
+      streams_mutex.unlock();
+      for (std::vector<Stream*>::iterator it = reporting.begin(); it != reporting.end(); it++){
+        if (full){
+          ( *it)->resetStats(); //the controller missed or lost earlier reports
+        }
+        if (StatsSocket.connected()){
+          StatsSocket.Send(( *it)->getStats());
+          StatsSocket.Send(double_newline);
+        }
+      }
+      report_mutex.unlock();
       if (StatsSocket.connected()){
-        StatsSocket.Send(Stream::get()->getStats());
-        StatsSocket.Send(double_newline);
         StatsSocket.flush();
       }
     }
     StatsSocket.close();
   }
 
-  void handleUser(void * v_usr){
-    user * usr = (user*)v_usr;
-#if DEBUG >= 4
-    std::cerr << "Thread launched for user " << usr->MyStr << ", socket number " << usr->S.getSocket() << std::endl;
-#endif
+  /// Loop reading DTSC data from stdin and processing it at the correct speed.
+  void handleStdin(void * empty){
+    if (empty != 0){
+      return;
+    }
+    Pacer & pacer = thisStream->getPacer();
+    InputBuffer input;
+    std::string work; //reused for parsing, so parsing a packet never allocates
+    const char * packet;
+    unsigned int len;
+
+    while (buffer_running){
+      if (input.next(packet, len)){
+        work.assign(packet, len);
+        if (thisStream->getStream()->parsePacket(work)){
+          //slow down packet receiving to real-time
+          pacer.wait(thisStream->getStream()->getTime());
+          thisStream->publishPacket(packet, len, true);
+        }
+      }else{
+        int r = input.fill(0);
+        if (r == 0 || (r < 0 && errno != EINTR)){
+          break;
+        }
+      }
+    }
+    buffer_running = false;
+  }
+
+  /// Prints the results of a single benchmark run.
+  void benchmarkResult(const char * name, unsigned long long bytes, unsigned long long packets, long long int ms){
+    if (ms < 1){
+      ms = 1;
+    }
+    fprintf(stderr, "%s: %llu packets, %.1f MiB in %lld ms = %.1f MiB/s\n", name, packets, bytes / 1048576.0, ms, bytes / 1048576.0 * 1000.0 / ms);
+  }
 
-    usr->myRing = thisStream->getRing();
-    if (thisStream->getHeader().size() > 0){
-      usr->S.SendNow(thisStream->getHeader());
+  /// Measures how fast DTSC data from the given file is framed, parsed and turned into ring packets.
+  /// Runs both the old string based framing of handleStdin and the current InputBuffer based one.
+  int benchmarkIngest(std::string filename){
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0){
+      perror("Could not open benchmark file");
+      return 1;
     }
+    char charBuffer[1024 * 10];
+    while (read(fd, charBuffer, 1024 * 10) > 0){} //warm the page cache, so both runs read from memory
+    unsigned long long bytes = 0;
+    unsigned long long packets = 0;
+    long long int start;
 
-    while (usr->S.connected()){
-      usleep(5000); //sleep 5ms
-      usr->Send();
-      if (usr->S.spool() && usr->S.Received().size()){
-        //delete anything that doesn't end with a newline
-        if ( !usr->S.Received().get().empty() && *(usr->S.Received().get().rbegin()) != '\n'){
-          usr->S.Received().get().clear();
-          continue;
+    lseek(fd, 0, SEEK_SET);
+    start = getNowMS();
+    {
+      DTSC::Stream strm(1);
+      std::string inBuffer;
+      while (true){
+        if (strm.parsePacket(inBuffer)){
+          Packet * p = new Packet(strm.outPacket(0), strm.getTime(), strm.getPacket(0).isMember("keyframe"));
+          bytes += p->data.size();
+          packets++;
+          p->release();
+        }else{
+          int r = read(fd, charBuffer, 1024 * 10);
+          if (r <= 0){
+            break;
+          }
+          inBuffer.append(charBuffer, r);
         }
-        usr->S.Received().get().resize(usr->S.Received().get().size() - 1);
-        if ( !usr->S.Received().get().empty()){
-          switch (usr->S.Received().get()[0]){
-            case 'P': { //Push
-              std::cout << "Push attempt from IP " << usr->S.Received().get().substr(2) << std::endl;
-              if (thisStream->checkWaitingIP(usr->S.Received().get().substr(2))){
-                if (thisStream->setInput(usr->S)){
-                  std::cout << "Push accepted!" << std::endl;
-                  usr->S = Socket::Connection( -1);
-                  return;
-                }else{
-                  usr->Disconnect("Push denied - push already in progress!");
-                }
-              }else{
-                usr->Disconnect("Push denied - invalid IP address!");
-              }
-            }
-              break;
-            case 'S': { //Stats
-              usr->tmpStats = Stats(usr->S.Received().get().substr(2));
-              unsigned int secs = usr->tmpStats.conntime - usr->lastStats.conntime;
-              if (secs < 1){
-                secs = 1;
-              }
-              usr->curr_up = (usr->tmpStats.up - usr->lastStats.up) / secs;
-              usr->curr_down = (usr->tmpStats.down - usr->lastStats.down) / secs;
-              usr->lastStats = usr->tmpStats;
-              thisStream->saveStats(usr->MyStr, usr->tmpStats);
-            }
-              break;
-            case 's': { //second-seek
-              //ignored for now
-            }
-              break;
-            case 'f': { //frame-seek
-              //ignored for now
-            }
-              break;
-            case 'p': { //play
-              //ignored for now
-            }
-              break;
-            case 'o': { //once-play
-              //ignored for now
-            }
-              break;
-            case 'q': { //quit-playing
-              //ignored for now
-            }
-              break;
+      }
+    }
+    benchmarkResult("string framing", bytes, packets, getNowMS() - start);
+
+    bytes = 0;
+    packets = 0;
+    lseek(fd, 0, SEEK_SET);
+    start = getNowMS();
+    {
+      DTSC::Stream strm(1);
+      InputBuffer input;
+      std::string work;
+      const char * packet;
+      unsigned int len;
+      while (true){
+        if (input.next(packet, len)){
+          work.assign(packet, len);
+          if (strm.parsePacket(work)){
+            Packet * p = new Packet(packet, len, strm.getTime(), strm.getPacket(0).isMember("keyframe"));
+            bytes += p->data.size();
+            packets++;
+            p->release();
+          }
+        }else{
+          if (input.fill(fd) <= 0){
+            break;
           }
         }
       }
     }
-    usr->Disconnect("Socket closed.");
+    benchmarkResult("in-place framing", bytes, packets, getNowMS() - start);
+    close(fd);
+    return 0;
   }
 
-  /// Loop reading DTSC data from stdin and processing it at the correct speed.
-  void handleStdin(void * empty){
+  /// Loop reading DTSC data from the IP push addresses of all streams.
+  /// No changes to the speed are made. Sockets are only read when epoll reports them readable, at most once per
+  /// wakeup, and everything read is parsed and published before reading more. When publishing cannot keep up the
+  /// socket is simply read less often, so the kernel buffer fills up and TCP flow control slows down the publisher.
+  /// Every input is parsed on its own, so backup inputs are ready to take over at their next keyframe.
+  void handlePushin(void * empty){
     if (empty != 0){
       return;
     }
-    long long int timeDiff = 0; //difference between local time and stream time
-    unsigned int lastPacket = 0; //last parsed packet timestamp
-    std::string inBuffer;
-    char charBuffer[1024 * 10];
-    unsigned int charCount;
-    long long int now;
+    int epoll_fd = epoll_create(PUSHIN_EVENTS);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = 0; //a null pointer marks the wakeup descriptor
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, Stream::inputEvents(), &ev);
+    struct epoll_event events[PUSHIN_EVENTS];
+    std::map<PushSource*, std::pair<Stream*, int> > registered; //stream and descriptor of every input added to epoll
+    std::string work; //reused for parsing, so parsing a packet never allocates
+    const char * packet;
+    unsigned int len;
 
-    while (std::cin.good() && buffer_running){
-      //slow down packet receiving to real-time
-      now = getNowMS();
-      if ((now - timeDiff >= lastPacket) || (lastPacket - (now - timeDiff) > 15000)){
-        thisStream->getWriteLock();
-        if (thisStream->getStream()->parsePacket(inBuffer)){
-          thisStream->getStream()->outPacket(0);
-          lastPacket = thisStream->getStream()->getTime();
-          if ((now - timeDiff - lastPacket) > 15000 || (now - timeDiff - lastPacket < -15000)){
-            timeDiff = now - lastPacket;
-          }
-          thisStream->dropWriteLock(true);
+    while (buffer_running){
+      int n = epoll_wait(epoll_fd, events, PUSHIN_EVENTS, 100); //wakes up regularly to check for stalled inputs
+      streams_mutex.lock();
+      //forget inputs of streams that were closed - their inputs were deleted with them - and pick up new ones
+      std::set<Stream*> current;
+      for (std::map<std::string, Stream*>::iterator it = streams.begin(); it != streams.end(); it++){
+        current.insert(it->second);
+      }
+      for (std::map<PushSource*, std::pair<Stream*, int> >::iterator it = registered.begin(); it != registered.end();){
+        if ( !current.count(it->second.first)){
+          epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->second.second, 0);
+          registered.erase(it++);
         }else{
-          thisStream->dropWriteLock(false);
-          std::cin.read(charBuffer, 1024 * 10);
-          charCount = std::cin.gcount();
-          inBuffer.append(charBuffer, charCount);
+          it++;
         }
-      }else{
-        usleep(std::min(14999LL, lastPacket - (now - timeDiff)) * 1000);
       }
+      for (std::set<Stream*>::iterator it = current.begin(); it != current.end(); it++){
+        std::vector<PushSource*> inputs;
+        ( *it)->getInputs(inputs);
+        for (std::vector<PushSource*>::iterator sit = inputs.begin(); sit != inputs.end(); sit++){
+          if (registered.count( *sit)){
+            continue;
+          }
+          int fd = ( *sit)->conn.getSocket();
+          ev.events = EPOLLIN;
+          ev.data.ptr = (void *) *sit;
+          epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+          registered[ *sit] = std::make_pair( *it, fd);
+        }
+      }
+      //read and publish everything that arrived, waking the users of each stream once
+      std::set<Stream*> published;
+      for (int i = 0; i < n; i++){
+        PushSource * src = (PushSource *)events[i].data.ptr;
+        if ( !src){
+          uint64_t val;
+          if (read(Stream::inputEvents(), &val, sizeof(val)) < 0){
+            //nothing to read, ignore
+          }
+          continue;
+        }
+        std::map<PushSource*, std::pair<Stream*, int> >::iterator it = registered.find(src);
+        if (it == registered.end()){
+          continue; //closed in this same iteration
+        }
+        Stream * strm = it->second.first;
+        int r = src->data.fill(it->second.second);
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)){
+          std::cout << "Push to stream " << strm->getName() << " from " << src->conn.getHost() << " ended" << std::endl;
+          epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->second.second, 0);
+          registered.erase(it);
+          strm->removeInput(src);
+          continue;
+        }
+        while (src->data.next(packet, len)){
+          work.assign(packet, len);
+          if (src->parser->parsePacket(work) && strm->ingest(src, packet, len)){
+            published.insert(strm);
+          }
+        }
+      }
+      for (std::set<Stream*>::iterator it = published.begin(); it != published.end(); it++){
+        Fanout::wake( *it);
+      }
+      long long int now = Util::getMS();
+      for (std::set<Stream*>::iterator it = current.begin(); it != current.end(); it++){
+        ( *it)->checkInputs(now);
+      }
+      streams_mutex.unlock();
     }
-    buffer_running = false;
-    SS.close();
+    close(epoll_fd);
   }
 
-  /// Loop reading DTSC data from an IP push address.
-  /// No changes to the speed are made.
-  void handlePushin(void * empty){
+  /// Loop pulling DTSC data for the stream of this buffer from an upstream buffer over TCP, in edge mode.
+  /// The upstream buffer treats this edge like any other user, so every connection starts at its newest keyframe.
+  /// On a lost connection, reconnects with increasing delays. After reconnecting, packets are skipped until a keyframe
+  /// newer than the last packet pulled before, so the stream resumes where it left off. From there on everything is
+  /// published, including packets of different tracks that share or swap timestamps. Since the upstream starts at its
+  /// newest keyframe, a first packet more than UPSTREAM_RESTART_KEYS keyframe intervals (at least UPSTREAM_RESTART_MIN
+  /// milliseconds) older than the last packet pulled means the upstream was restarted; its timestamps are then
+  /// shifted to continue from the last packet.
+  void handleUpstream(void * empty){
     if (empty != 0){
       return;
     }
+    long long int lastTime = -1; //timestamp of the last published packet
+    long long int lastMS = 0; //time the last packet was published
+    unsigned int retry = 1;
+    std::string work; //reused for parsing, so parsing a packet never allocates
+    const char * packet;
+    unsigned int len;
     while (buffer_running){
-      if (thisStream->getIPInput().connected()){
-        if (thisStream->getIPInput().spool()){
-          thisStream->getWriteLock();
-          if (thisStream->getStream()->parsePacket(thisStream->getIPInput().Received())){
-            //thisStream->getStream()->outPacket(0);
-            thisStream->dropWriteLock(true);
+      Socket::Connection upstream(upstreamHost, upstreamPort, false);
+      if ( !upstream.connected()){
+        std::cerr << "Could not connect to upstream " << upstreamHost << ":" << upstreamPort << ", retrying in " << retry << "s" << std::endl;
+        for (unsigned int i = 0; i < retry * 10 && buffer_running; i++){
+          usleep(100000);
+        }
+        retry = std::min(retry * 2, (unsigned int)UPSTREAM_RETRY_MAX);
+        continue;
+      }
+      std::cout << "Pulling stream " << upstreamName << " from " << upstreamHost << ":" << upstreamPort << std::endl;
+      upstream.SendNow(upstreamName + "\n");
+      InputBuffer input;
+      DTSC::Stream * strm = thisStream->getStream();
+      bool first = true;
+      bool resuming = (lastTime >= 0); //skipping what was pulled before reconnecting
+      long long int offset = 0;
+      while (buffer_running && upstream.connected()){
+        if (input.next(packet, len)){
+          work.assign(packet, len);
+          if ( !strm->parsePacket(work)){
+            continue;
+          }
+          long long int time = strm->getPacket(0)["time"].asInt();
+          long long int now = Util::getMS();
+          if (first){
+            first = false;
+            retry = 1;
+            offset = 0;
+            long long int margin = UPSTREAM_RESTART_MIN;
+            if (strm->metadata.isMember("video") && strm->metadata["video"].isMember("keyms")){ //never add members
+              JSON::Value & video = strm->metadata["video"];
+              long long int keyvar = video.isMember("keyvar") ? video["keyvar"].asInt() : 0;
+              margin = std::max(margin, UPSTREAM_RESTART_KEYS * (video["keyms"].asInt() + keyvar));
+            }
+            if (lastTime >= 0 && time + margin < lastTime){
+              offset = lastTime + std::max(1LL, now - lastMS) - time;
+              std::cout << "Upstream restarted, shifting its timestamps by " << offset << "ms" << std::endl;
+            }
+          }
+          time += offset;
+          if (resuming){
+            if (time <= lastTime || (strm->metadata.isMember("video") && !strm->getPacket(0).isMember("keyframe"))){
+              continue; //pulled before reconnecting, or not a point to resume at
+            }
+            resuming = false;
+          }
+          if (offset){
+            strm->getPacket(0)["time"] = time;
+            std::string & shifted = strm->outPacket(0);
+            thisStream->publishPacket(shifted.data(), shifted.size(), true);
           }else{
-            thisStream->dropWriteLock(false);
-            usleep(1000); //1ms wait
+            thisStream->publishPacket(packet, len, true);
           }
-        }else{
-          usleep(1000); //1ms wait
+          lastTime = std::max(lastTime, time);
+          lastMS = now;
+          continue;
+        }
+        struct pollfd pfd;
+        pfd.fd = upstream.getSocket();
+        pfd.events = POLLIN;
+        if (poll( &pfd, 1, 1000) <= 0){
+          continue; //also rechecks buffer_running once per second
         }
+        int r = input.fill(upstream.getSocket());
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)){
+          upstream.close();
+        }
+      }
+      upstream.close();
+      if (buffer_running){
+        std::cerr << "Lost connection to upstream " << upstreamHost << ":" << upstreamPort << std::endl;
+      }
+    }
+  }
+
+  /// Creates, configures and starts listening for a new stream, returns null on failure.
+  Stream * openStream(std::string name, Util::Config & conf){
+    Socket::Server listener = Util::Stream::makeLive(name);
+    if ( !listener.connected()){
+      return 0;
+    }
+    Stream * strm = new Stream(name);
+    strm->setWindow(conf.getInteger("dvr"), conf.getInteger("dvrsize"));
+    strm->setBurst(conf.getInteger("burst"));
+    strm->setPolicy(conf.getInteger("queuetime"), conf.getInteger("queuesize") * 1024LL, conf.getInteger("lagkick"));
+    strm->openShm(conf.getInteger("shm"));
+    strm->openStats(conf.getInteger("viewers"));
+    strm->getPacer().setTiming(conf.getInteger("lead"), conf.getInteger("catchup"));
+    strm->getPacer().setFast(conf.getBool("fast"));
+    strm->setFailover(conf.getInteger("failover"));
+    std::string recordPath = conf.getString("record");
+    if (recordPath != "" && conf.getBool("multi")){
+      std::string safeName = name;
+      Util::Stream::sanitizeName(safeName);
+      recordPath += "/" + safeName + ".dtsc";
+    }
+    strm->record(recordPath);
+    listeners[name] = listener;
+    streams_mutex.lock();
+    streams[name] = strm;
+    streams_mutex.unlock();
+    return strm;
+  }
+
+  /// Stops listening for and deletes a stream, disconnecting all its users.
+  void closeStream(std::string name){
+    if (listeners.count(name)){
+      listeners[name].close();
+      listeners.erase(name);
+    }
+    streams_mutex.lock();
+    Stream * strm = streams[name];
+    streams.erase(name);
+    streams_mutex.unlock();
+    report_mutex.lock(); //wait for a statistics report that may still include this stream
+    report_mutex.unlock();
+    delete strm;
+  }
+
+  /// Makes the set of streams held match all push streams in the stream list of the controller.
+  /// The controller rewrites the list in place, so a list without config or streams is taken to be half written,
+  /// and left alone until the next call.
+  void syncStreams(Util::Config & conf){
+    JSON::Value list = JSON::fromFile("/tmp/mist/streamlist");
+    if ( !list.isMember("config") || !list.isMember("streams")){
+      return;
+    }
+    std::map<std::string, std::string> wanted; //stream names and the IP addresses to accept pushes from
+    for (JSON::ObjIter it = list["streams"].ObjBegin(); it != list["streams"].ObjEnd(); it++){
+      std::string URL = it->second["channel"]["URL"].asString();
+      if (URL.substr(0, 7) == "push://"){
+        wanted[it->first] = URL.substr(7);
+      }
+    }
+    std::vector<std::string> removed;
+    for (std::map<std::string, Stream*>::iterator it = streams.begin(); it != streams.end(); it++){
+      if ( !wanted.count(it->first)){
+        removed.push_back(it->first);
+      }
+    }
+    for (std::vector<std::string>::iterator it = removed.begin(); it != removed.end(); it++){
+      std::cout << "Removing stream " << *it << std::endl;
+      closeStream( *it);
+    }
+    for (std::map<std::string, std::string>::iterator it = wanted.begin(); it != wanted.end(); it++){
+      Stream * strm = 0;
+      if (streams.count(it->first)){
+        strm = streams[it->first];
       }else{
-        usleep(1000000); //1s wait
+        strm = openStream(it->first, conf);
+        if ( !strm){
+          continue; //probably held by another buffer, try again later
+        }
+        std::cout << "Holding stream " << it->first << std::endl;
+      }
+      strm->setWaitingIP(it->second);
+    }
+  }
+
+  /// Deletes the users released by their workers, for all streams, ten times per second.
+  void handleReaper(void * empty){
+    if (empty != 0){
+      return;
+    }
+    while (buffer_running){
+      usleep(100000); //sleep 100ms
+      streams_mutex.lock();
+      for (std::map<std::string, Stream*>::iterator it = streams.begin(); it != streams.end(); it++){
+        it->second->cleanUsers();
+      }
+      streams_mutex.unlock();
+    }
+  }
+
+  /// Hands a new connection to the given stream and the workers.
+  void addConnection(Socket::Connection & incoming, Stream * strm){
+    user * usr_ptr = new user(incoming, strm);
+    strm->addUser(usr_ptr);
+    Fanout::addUser(usr_ptr);
+  }
+
+  /// Waits up to a second for new connections on any stream and hands them to the workers.
+  /// Edge buffers connecting over TCP first send the name of the stream they want, on a line of its own.
+  void acceptUsers(){
+    std::vector<struct pollfd> fds;
+    std::vector<std::string> names;
+    for (std::map<std::string, Socket::Server>::iterator it = listeners.begin(); it != listeners.end(); it++){
+      struct pollfd pfd;
+      pfd.fd = it->second.getSocket();
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      fds.push_back(pfd);
+      names.push_back(it->first);
+    }
+    unsigned int streamFds = fds.size();
+    if (relayListener.connected()){
+      struct pollfd pfd;
+      pfd.fd = relayListener.getSocket();
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      fds.push_back(pfd);
+      for (std::vector<Socket::Connection>::iterator it = relayPending.begin(); it != relayPending.end(); it++){
+        pfd.fd = it->getSocket();
+        fds.push_back(pfd);
+      }
+    }
+    if (fds.empty()){
+      usleep(1000000);
+      return;
+    }
+    if (poll( &fds[0], fds.size(), 1000) < 0){
+      return;
+    }
+    for (unsigned int i = 0; i < streamFds; i++){
+      if ( !(fds[i].revents & POLLIN)){
+        continue;
+      }
+      Socket::Connection incoming = listeners[names[i]].accept(true);
+      if (incoming.connected()){
+        addConnection(incoming, streams[names[i]]);
+      }
+    }
+    if ( !relayListener.connected()){
+      return;
+    }
+    //pending edges: hand over the ones that named an existing stream, drop the ones that did not in time
+    long long int now = Util::epoch();
+    for (unsigned int i = relayPending.size(); i > 0; i--){
+      Socket::Connection & conn = relayPending[i - 1];
+      conn.spool();
+      std::string name;
+      if (conn.Received().size() && *(conn.Received().get().rbegin()) == '\n'){
+        name = conn.Received().get().substr(0, conn.Received().get().size() - 1);
+        conn.Received().get().clear();
+      }
+      if (name != "" && streams.count(name)){
+        std::cout << "Edge " << conn.getHost() << " pulling stream " << name << std::endl;
+        addConnection(conn, streams[name]);
+      }else if (name == "" && conn.connected() && now - relayPendingSince[i - 1] < RELAY_NAME_TIMEOUT){
+        continue;
+      }else{
+        conn.close();
+      }
+      relayPending.erase(relayPending.begin() + (i - 1));
+      relayPendingSince.erase(relayPendingSince.begin() + (i - 1));
+    }
+    if (fds[streamFds].revents & POLLIN){
+      Socket::Connection incoming = relayListener.accept(true);
+      if (incoming.connected()){
+        relayPending.push_back(incoming);
+        relayPendingSince.push_back(now);
       }
     }
-    SS.close();
   }
 
   /// Starts a loop, waiting for connections to send data to.
   int Start(int argc, char ** argv){
     Util::Config conf = Util::Config(argv[0], PACKAGE_VERSION);
     conf.addOption("stream_name",
-        JSON::fromString("{\"arg_num\":1, \"arg\":\"string\", \"help\":\"Name of the stream this buffer will be providing.\"}"));
+        JSON::fromString("{\"arg_num\":1, \"arg\":\"string\", \"default\":\"\", \"help\":\"Name of the stream this buffer will be providing.\"}"));
     conf.addOption("awaiting_ip",
         JSON::fromString(
             "{\"arg_num\":2, \"arg\":\"string\", \"default\":\"\", \"help\":\"IP address to expect incoming data from. This will completely disable reading from standard input if used.\"}"));
     conf.addOption("reportstats",
         JSON::fromString("{\"default\":0, \"help\":\"Report stats to a controller process.\", \"short\":\"s\", \"long\":\"reportstats\"}"));
+    conf.addOption("dvr",
+        JSON::fromString(
+            "{\"default\":30, \"arg\":\"integer\", \"help\":\"Amount of seconds of the stream to keep available for seeking, or 0 for as much as possible.\", \"short\":\"d\", \"long\":\"dvr\"}"));
+    conf.addOption("dvrsize",
+        JSON::fromString(
+            "{\"default\":256, \"arg\":\"integer\", \"help\":\"Maximum size in MiB of the stream data kept available for seeking, or 0 for unlimited.\", \"short\":\"D\", \"long\":\"dvrsize\"}"));
+    conf.addOption("burst",
+        JSON::fromString(
+            "{\"default\":4, \"arg\":\"integer\", \"help\":\"How many times faster than real-time new users may catch up with the live point, or 0 for unlimited.\", \"short\":\"b\", \"long\":\"burst\"}"));
+    conf.addOption("queuetime",
+        JSON::fromString(
+            "{\"default\":5000, \"arg\":\"integer\", \"help\":\"Milliseconds a live user may fall behind before skipping to the newest keyframe, or 0 for unlimited.\", \"short\":\"q\", \"long\":\"queuetime\"}"));
+    conf.addOption("queuesize",
+        JSON::fromString(
+            "{\"default\":4096, \"arg\":\"integer\", \"help\":\"KiB a live user may fall behind before skipping to the newest keyframe, or 0 for unlimited.\", \"short\":\"Q\", \"long\":\"queuesize\"}"));
+    conf.addOption("lagkick",
+        JSON::fromString(
+            "{\"default\":30, \"arg\":\"integer\", \"help\":\"Seconds a live user may stay too far behind before being disconnected, or 0 to never disconnect.\", \"short\":\"k\", \"long\":\"lagkick\"}"));
+    conf.addOption("shm",
+        JSON::fromString(
+            "{\"default\":32, \"arg\":\"integer\", \"help\":\"Size in MiB of the shared memory local connectors read packets from, or 0 to disable.\", \"short\":\"m\", \"long\":\"shm\"}"));
+    conf.addOption("viewers",
+        JSON::fromString(
+            "{\"default\":1024, \"arg\":\"integer\", \"help\":\"Amount of viewers per stream that report statistics through shared memory, any others report over their connection. 0 disables shared memory statistics.\", \"short\":\"n\", \"long\":\"viewers\"}"));
+    conf.addOption("workers",
+        JSON::fromString(
+            "{\"default\":0, \"arg\":\"integer\", \"help\":\"Amount of threads sending data to users, or 0 for one per CPU core.\", \"short\":\"w\", \"long\":\"workers\"}"));
+    conf.addOption("multi",
+        JSON::fromString(
+            "{\"default\":0, \"help\":\"Hold all push streams from the stream list of the controller, instead of a single named stream.\", \"short\":\"M\", \"long\":\"multi\"}"));
+    conf.addOption("lead",
+        JSON::fromString(
+            "{\"default\":0, \"arg\":\"integer\", \"help\":\"Milliseconds packets from standard input are published ahead of real-time.\", \"short\":\"l\", \"long\":\"lead\"}"));
+    conf.addOption("catchup",
+        JSON::fromString(
+            "{\"default\":1000, \"arg\":\"integer\", \"help\":\"Milliseconds standard input may fall behind real-time and still be caught up with at full speed, instead of continuing from the current packet.\", \"short\":\"c\", \"long\":\"catchup\"}"));
+    conf.addOption("fast",
+        JSON::fromString(
+            "{\"default\":0, \"help\":\"Publish packets from standard input as fast as they are read, without real-time pacing.\", \"short\":\"f\", \"long\":\"fast\"}"));
+    conf.addOption("failover",
+        JSON::fromString(
+            "{\"default\":2000, \"arg\":\"integer\", \"help\":\"Milliseconds the active push input may stall before a backup push input of the same stream takes over.\", \"short\":\"F\", \"long\":\"failover\"}"));
+    conf.addOption("relay",
+        JSON::fromString(
+            "{\"default\":0, \"arg\":\"integer\", \"help\":\"TCP port edge buffers may pull streams from, or 0 to disable.\", \"short\":\"r\", \"long\":\"relay\"}"));
+    conf.addOption("upstream",
+        JSON::fromString(
+            "{\"default\":\"\", \"arg\":\"string\", \"help\":\"Run as edge, pulling the stream from the buffer at host:port[/stream] instead of reading standard input.\", \"short\":\"u\", \"long\":\"upstream\"}"));
+    conf.addOption("record",
+        JSON::fromString(
+            "{\"default\":\"\", \"arg\":\"string\", \"help\":\"Record the stream to this DTSC file, or record every stream to a file in this directory when holding multiple streams.\", \"short\":\"R\", \"long\":\"record\"}"));
+    conf.addOption("benchmark",
+        JSON::fromString(
+            "{\"default\":\"\", \"arg\":\"string\", \"help\":\"Measure the DTSC ingest speed of the given file and exit.\", \"short\":\"B\", \"long\":\"benchmark\"}"));
     conf.parseArgs(argc, argv);
 
-    std::string name = conf.getString("stream_name");
+    if (conf.getString("benchmark") != ""){
+      return benchmarkIngest(conf.getString("benchmark"));
+    }
 
-    SS = Util::Stream::makeLive(name);
-    if ( !SS.connected()){
-      perror("Could not create stream socket");
-      return 1;
+    bool multi = conf.getBool("multi");
+    if ( !multi){
+      std::string name = conf.getString("stream_name");
+      thisStream = openStream(name, conf);
+      if ( !thisStream){
+        perror("Could not create stream socket");
+        return 1;
+      }
+    }
+    int relayPort = conf.getInteger("relay");
+    if (relayPort){
+      relayListener = Socket::Server(relayPort, "0.0.0.0", true);
+      if ( !relayListener.connected()){
+        perror("Could not create relay socket");
+        return 1;
+      }
+    }
+    std::string upstream = conf.getString("upstream");
+    if (upstream != ""){
+      if (multi){
+        std::cerr << "Edge mode only works for a single stream" << std::endl;
+        return 1;
+      }
+      upstreamName = conf.getString("stream_name");
+      size_t slash = upstream.find('/');
+      if (slash != std::string::npos){
+        upstreamName = upstream.substr(slash + 1);
+        upstream.erase(slash);
+      }
+      size_t colon = upstream.rfind(':');
+      if (colon == std::string::npos){
+        std::cerr << "Upstream must be given as host:port[/stream]" << std::endl;
+        return 1;
+      }
+      upstreamHost = upstream.substr(0, colon);
+      upstreamPort = atoi(upstream.substr(colon + 1).c_str());
     }
     conf.activate();
-    thisStream = Stream::get();
-    thisStream->setName(name);
-    Socket::Connection incoming;
     Socket::Connection std_input(fileno(stdin));
+    Fanout::start(conf.getInteger("workers"));
 
+    tthread::thread * ReaperThread = new tthread::thread(handleReaper, 0);
     tthread::thread * StatsThread = 0;
     if (conf.getBool("reportstats")){
       StatsThread = new tthread::thread(handleStats, 0);
     }
     tthread::thread * StdinThread = 0;
     std::string await_ip = conf.getString("awaiting_ip");
-    if (await_ip == ""){
+    if (upstreamPort){
+      StdinThread = new tthread::thread(handleUpstream, 0);
+    }else if ( !multi && await_ip == ""){
       StdinThread = new tthread::thread(handleStdin, 0);
     }else{
-      thisStream->setWaitingIP(await_ip);
+      if ( !multi){
+        thisStream->setWaitingIP(await_ip);
+      }
       StdinThread = new tthread::thread(handlePushin, 0);
     }
 
-    while (buffer_running && SS.connected() && conf.is_active){
-      //check for new connections, accept them if there are any
-      //starts a thread for every accepted connection
-      incoming = SS.accept(true);
-      if (incoming.connected()){
-        user * usr_ptr = new user(incoming);
-        thisStream->addUser(usr_ptr);
-        usr_ptr->Thread = new tthread::thread(handleUser, (void *)usr_ptr);
+    long long int lastSync = 0;
+    while (buffer_running && conf.is_active){
+      if (multi && Util::epoch() - lastSync >= 5){
+        lastSync = Util::epoch();
+        syncStreams(conf);
       }
+      //check for new connections, accept them if there are any
+      //hands every accepted connection to one of the workers
+      acceptUsers();
     } //main loop
 
-    // disconnect listener
+    // disconnect listeners
     buffer_running = false;
     std::cout << "Buffer shutting down" << std::endl;
-    SS.close();
+    for (std::map<std::string, Socket::Server>::iterator it = listeners.begin(); it != listeners.end(); it++){
+      it->second.close();
+    }
+    listeners.clear();
+    relayListener.close();
+    for (std::vector<Socket::Connection>::iterator it = relayPending.begin(); it != relayPending.end(); it++){
+      it->close();
+    }
+    relayPending.clear();
     if (StatsThread){
       StatsThread->join();
       delete StatsThread;
     }
-    if (thisStream->getIPInput().connected()){
-      thisStream->getIPInput().close();
-    }
-    StdinThread->join();
+    ReaperThread->join();
+    delete ReaperThread;
+    StdinThread->join(); //wakes the workers, so it must be done before they are stopped
     delete StdinThread;
-    delete thisStream;
+    Fanout::stop();
+    while ( !streams.empty()){
+      closeStream(streams.begin()->first);
+    }
     return 0;
   }
 
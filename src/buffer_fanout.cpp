@@ -0,0 +1,372 @@
+/// \file buffer_fanout.cpp
+/// Contains code for the buffer fan-out workers.
+
+#include <iostream>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "buffer_fanout.h"
+#include "buffer_stream.h"
+
+/// Maximum amount of events handled per epoll_wait call.
+#define WORKER_EVENTS 64
+
+/// Creates the epoll and wakeup descriptors and starts the worker thread, using the given PacketRing reader number.
+Buffer::Worker::Worker(int reader){
+  running = true;
+  count = 0;
+  epoll_fd = epoll_create(WORKER_EVENTS);
+  wake_fd = eventfd(0, EFD_NONBLOCK);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = 0; //a null pointer marks the wakeup descriptor
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+  this->reader = reader;
+  Thread = new tthread::thread(run, (void *)this);
+}
+
+/// Stops the worker thread and closes all descriptors.
+Buffer::Worker::~Worker(){
+  stop();
+  close(wake_fd);
+  close(epoll_fd);
+}
+
+/// Hands a user over to this worker. The worker owns the user until it sets user::myWorker to null.
+void Buffer::Worker::addUser(user * usr){
+  usr->myWorker = this;
+  usr->myStream->countWorkerUsers(reader, 1);
+  add_mutex.lock();
+  newUsers.push_back(usr);
+  add_mutex.unlock();
+  __sync_fetch_and_add( &count, 1);
+  wake();
+}
+
+/// Wakes the worker so it tries sending to all users of the given stream that are not blocked on their socket.
+void Buffer::Worker::wake(Stream * strm){
+  add_mutex.lock();
+  dirty.insert(strm);
+  add_mutex.unlock();
+  wake();
+}
+
+/// Wakes the worker so it picks up new users.
+void Buffer::Worker::wake(){
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) < 0){
+    //EAGAIN means the counter is saturated, which wakes the worker just as well
+  }
+}
+
+/// Stops the worker thread, disconnecting and releasing all users it still holds.
+void Buffer::Worker::stop(){
+  if ( !Thread){
+    return;
+  }
+  running = false;
+  wake();
+  Thread->join();
+  delete Thread;
+  Thread = 0;
+}
+
+/// Returns the amount of users currently held by this worker.
+unsigned int Buffer::Worker::userCount(){
+  return count;
+}
+
+/// Thread entry point, simply calls loop() on the given worker.
+void Buffer::Worker::run(void * w){
+  ((Worker *)w)->loop();
+}
+
+/// Main worker loop. Waits for socket readiness or wakeups and sends data to users.
+void Buffer::Worker::loop(){
+  struct epoll_event events[WORKER_EVENTS];
+  while (running){
+    int n = epoll_wait(epoll_fd, events, WORKER_EVENTS, 1000);
+    if (n < 0 && errno != EINTR){
+      break;
+    }
+    bool woken = (n == 0); //timeouts also retry sending, for users holding back their start-up burst
+    for (int i = 0; i < n; i++){
+      user * usr = (user *)events[i].data.ptr;
+      if ( !usr){
+        uint64_t val;
+        if (read(wake_fd, &val, sizeof(val)) < 0){
+          //nothing to read, ignore
+        }
+        woken = true;
+        continue;
+      }
+      if ( !serves(usr)){
+        continue; //released earlier in this same batch
+      }
+      int fd = usr->S.getSocket();
+      if (events[i].events & EPOLLOUT){
+        usr->blocked = false;
+        usr->Send(reader);
+      }
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+        handleInput(usr, fd);
+        continue;
+      }
+      if ( !usr->S.connected()){
+        release(usr, fd);
+      }
+    }
+    if (woken){
+      //pick up any newly added users and see which streams got new packets
+      add_mutex.lock();
+      std::vector<user*> adding;
+      adding.swap(newUsers);
+      std::set<Stream*> changed;
+      changed.swap(dirty);
+      add_mutex.unlock();
+      for (std::vector<user*>::iterator it = adding.begin(); it != adding.end(); it++){
+        attach( *it);
+      }
+      //try to send to everyone not waiting on their socket - on timeouts, to the users of all streams
+      std::vector<user*> gone;
+      for (std::map<Stream*, std::set<user*> >::iterator it = users.begin(); it != users.end(); it++){
+        if (n == 0 || changed.count(it->first)){
+          sendTo(it->second, gone);
+        }
+      }
+      for (std::vector<user*>::iterator it = gone.begin(); it != gone.end(); it++){
+        release( *it, -1);
+      }
+    }
+  }
+  //shutting down: disconnect and release everything we still hold
+  add_mutex.lock();
+  for (std::vector<user*>::iterator it = newUsers.begin(); it != newUsers.end(); it++){
+    users[( *it)->myStream].insert( *it);
+  }
+  newUsers.clear();
+  add_mutex.unlock();
+  while ( !users.empty()){
+    user * usr = *(users.begin()->second.begin());
+    usr->Disconnect("Buffer shutting down.");
+    release(usr, -1);
+  }
+}
+
+/// Returns true if the given user is currently served by this worker.
+bool Buffer::Worker::serves(user * usr){
+  std::map<Stream*, std::set<user*> >::iterator it = users.find(usr->myStream);
+  return it != users.end() && it->second.count(usr);
+}
+
+/// Tries sending to all given users that are not blocked on their socket.
+/// Users that got disconnected are added to gone, to be released by the caller.
+void Buffer::Worker::sendTo(std::set<user*> & list, std::vector<user*> & gone){
+  for (std::set<user*>::iterator it = list.begin(); it != list.end(); it++){
+    if ( !( *it)->blocked){
+      ( *it)->Send(reader);
+    }
+    if ( !( *it)->S.connected()){
+      gone.push_back( *it);
+    }
+  }
+}
+
+/// Registers a new user with epoll, sends the stream header and starts sending data.
+void Buffer::Worker::attach(user * usr){
+  usr->S.setBlocking(false);
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  ev.data.ptr = (void *)usr;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, usr->S.getSocket(), &ev) < 0){
+    usr->Disconnect("Could not register socket.");
+    users[usr->myStream].insert(usr);
+    release(usr, -1);
+    return;
+  }
+  users[usr->myStream].insert(usr);
+#if DEBUG >= 4
+  std::cerr << "Worker picked up user " << usr->MyStr << ", socket number " << usr->S.getSocket() << std::endl;
+#endif
+  PacketRing * ring = usr->myStream->getPackets();
+  usr->Start(ring->start());
+  usr->header = ring->getHeader(reader); //sent by Send before any packet, without blocking
+  usr->Send(reader);
+}
+
+/// Removes a user from this worker. After this call the worker no longer touches the user.
+/// If fd is -1, the descriptor is taken from the user's socket.
+void Buffer::Worker::release(user * usr, int fd){
+  if (fd == -1){
+    fd = usr->S.getSocket();
+  }
+  if (fd != -1){
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, 0);
+  }
+  std::map<Stream*, std::set<user*> >::iterator it = users.find(usr->myStream);
+  if (it != users.end()){
+    it->second.erase(usr);
+    if (it->second.empty()){
+      users.erase(it);
+    }
+  }
+  __sync_fetch_and_sub( &count, 1);
+  usr->myStream->countWorkerUsers(reader, -1);
+  usr->myWorker = 0;
+  usr->myStream->releaseUser(usr); //from here on Stream::cleanUsers may delete this user
+}
+
+/// Reads and handles all pending commands from a user.
+/// Releases the user if the connection was closed or handed over as push input.
+void Buffer::Worker::handleInput(user * usr, int fd){
+  //edge triggered - read everything that is available
+  while (usr->S.spool()){}
+  while (usr->S.connected() && usr->S.Received().size()){
+    //delete anything that doesn't end with a newline
+    if ( *(usr->S.Received().get().rbegin()) != '\n'){
+      usr->S.Received().get().clear();
+      continue;
+    }
+    usr->S.Received().get().resize(usr->S.Received().get().size() - 1);
+    if ( !usr->S.Received().get().empty()){
+      switch (usr->S.Received().get()[0]){
+        case 'P': { //Push
+          std::cout << "Push attempt from IP " << usr->S.Received().get().substr(2) << std::endl;
+          if (usr->myStream->checkWaitingIP(usr->S.Received().get().substr(2))){
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, 0);
+            usr->S.Received().get().clear();
+            if (usr->myStream->setInput(usr->S)){
+              std::cout << "Push accepted!" << std::endl;
+              usr->S = Socket::Connection( -1);
+              release(usr, -1);
+              return;
+            }else{
+              usr->Disconnect("Push denied - too many push inputs for this stream!");
+            }
+          }else{
+            usr->Disconnect("Push denied - invalid IP address!");
+          }
+        }
+          break;
+        case 'S': { //Stats
+          usr->tmpStats = Stats(usr->S.Received().get().substr(2));
+          usr->tmpStats.dropped = usr->droppedGops;
+          unsigned int secs = usr->tmpStats.conntime - usr->lastStats.conntime;
+          if (secs < 1){
+            secs = 1;
+          }
+          unsigned int up = (usr->tmpStats.up - usr->lastStats.up) / secs;
+          unsigned int down = (usr->tmpStats.down - usr->lastStats.down) / secs;
+          usr->myStream->countTraffic((long long int)up - usr->curr_up, (long long int)down - usr->curr_down);
+          usr->curr_up = up;
+          usr->curr_down = down;
+          usr->lastStats = usr->tmpStats;
+          usr->myStream->saveStats(usr->MyStr, usr->tmpStats);
+        }
+          break;
+        case 'B': { //binary stats in the stats table
+          int slot = JSON::Value(usr->S.Received().get().substr(2)).asInt();
+          if (usr->statSlot < 0 && slot >= 0 && usr->myStream->getStatsTable().link(slot, usr->MyNum)){
+            usr->statSlot = slot;
+          }
+        }
+          break;
+        case 'M': { //shared memory
+          usr->shared = true;
+        }
+          break;
+        case 's': { //second-seek
+          long long int ms = JSON::Value(usr->S.Received().get().substr(2)).asInt();
+          usr->Seek(usr->myStream->getPackets()->seekTime(ms));
+        }
+          break;
+        case 'f': { //frame-seek
+          long long int frame = JSON::Value(usr->S.Received().get().substr(2)).asInt();
+          usr->Seek(usr->myStream->getPackets()->seekKey(frame));
+        }
+          break;
+        case 'p': { //play
+          usr->playing = -1;
+        }
+          break;
+        case 'o': { //once-play
+          if (usr->playing <= 0){
+            usr->playing = 1;
+          }
+          ++usr->playing;
+        }
+          break;
+        case 'q': { //quit-playing
+          if (usr->shared){
+            //shared memory users keep reading there, and stay live; only a seek moves them to the socket
+            usr->pos = usr->myStream->getPackets()->end();
+          }
+          usr->playing = 0;
+        }
+          break;
+      }
+    }
+    usr->S.Received().get().clear();
+  }
+  if (usr->S.connected()){
+    usr->Send(reader); //seeking or playing may have made packets available
+    if (usr->S.connected()){
+      return;
+    }
+  }else{
+    usr->Disconnect("Socket closed.");
+  }
+  release(usr, fd);
+}
+
+namespace Buffer {
+  namespace Fanout {
+    std::vector<Worker*> workers; ///< All running workers.
+
+    /// Starts the given amount of workers, or one per CPU core if zero.
+    /// Never starts more workers than there are PacketRing reader numbers.
+    void start(unsigned int count){
+      if (count == 0){
+        count = tthread::thread::hardware_concurrency();
+      }
+      if (count == 0){
+        count = 1;
+      }
+      if (count > RING_MAX_READERS){
+        count = RING_MAX_READERS;
+      }
+      for (unsigned int i = 0; i < count; i++){
+        workers.push_back(new Worker(i)); //worker number doubles as reader number
+      }
+    }
+
+    /// Hands a new user to the least loaded worker.
+    void addUser(user * usr){
+      Worker * best = 0;
+      for (std::vector<Worker*>::iterator it = workers.begin(); it != workers.end(); it++){
+        if ( !best || ( *it)->userCount() < best->userCount()){
+          best = *it;
+        }
+      }
+      best->addUser(usr);
+    }
+
+    /// Wakes the workers serving users of the given stream, signalling that new packets of it are available.
+    void wake(Stream * strm){
+      for (unsigned int i = 0; i < workers.size(); i++){
+        if (strm->servedBy(i)){
+          workers[i]->wake(strm);
+        }
+      }
+    }
+
+    /// Stops and deletes all workers.
+    void stop(){
+      while ( !workers.empty()){
+        delete workers.back();
+        workers.pop_back();
+      }
+    }
+  }
+}
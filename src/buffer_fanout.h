@@ -0,0 +1,64 @@
+/// \file buffer_fanout.h
+/// Contains definitions for the buffer fan-out workers.
+
+#pragma once
+#include <map>
+#include <set>
+#include <vector>
+#include "tinythread.h"
+#include "buffer_user.h"
+
+namespace Buffer {
+  class Stream;
+
+  /// Serves many users, of any amount of streams, from a single thread.
+  /// The thread sleeps in epoll until a user socket becomes readable or writable, or until new packets are signalled.
+  class Worker{
+    public:
+      /// Creates the epoll and wakeup descriptors and starts the worker thread, using the given PacketRing reader number.
+      Worker(int reader);
+      /// Stops the worker thread and closes all descriptors.
+      ~Worker();
+      /// Hands a user over to this worker. The worker owns the user until it sets user::myWorker to null.
+      void addUser(user * usr);
+      /// Wakes the worker so it picks up new users.
+      void wake();
+      /// Wakes the worker so it tries sending to all users of the given stream that are not blocked on their socket.
+      void wake(Stream * strm);
+      /// Stops the worker thread, disconnecting and releasing all users it still holds.
+      void stop();
+      /// Returns the amount of users currently held by this worker.
+      unsigned int userCount();
+    private:
+      static void run(void * w);
+      void loop();
+      void attach(user * usr);
+      void release(user * usr, int fd);
+      void handleInput(user * usr, int fd);
+      bool serves(user * usr);
+      void sendTo(std::set<user*> & list, std::vector<user*> & gone);
+      int epoll_fd; ///< Descriptor for epoll.
+      int wake_fd; ///< Eventfd used to wake up the worker thread.
+      int reader; ///< Reader number of the worker thread in every PacketRing.
+      volatile bool running; ///< Set to false to make the worker thread exit.
+      volatile unsigned int count; ///< Amount of users currently held, only changed atomically.
+      tthread::thread * Thread; ///< The worker thread itself.
+      tthread::mutex add_mutex; ///< Mutex for newUsers and dirty.
+      std::vector<user*> newUsers; ///< Users waiting to be attached by the worker thread.
+      std::set<Stream*> dirty; ///< Streams that got new packets since the last wakeup.
+      std::map<Stream*, std::set<user*> > users; ///< Users currently served by this worker per stream, only touched by the worker thread.
+  };
+
+  /// Fixed pool of Worker threads that all users are spread over.
+  namespace Fanout {
+    /// Starts the given amount of workers, or one per CPU core if zero.
+    /// Never starts more workers than there are PacketRing reader numbers.
+    void start(unsigned int count);
+    /// Hands a new user to the least loaded worker.
+    void addUser(user * usr);
+    /// Wakes the workers serving users of the given stream, signalling that new packets of it are available.
+    void wake(Stream * strm);
+    /// Stops and deletes all workers.
+    void stop();
+  }
+}
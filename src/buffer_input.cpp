@@ -0,0 +1,117 @@
+/// \file buffer_input.cpp
+/// Contains code for framing incoming DTSC data.
+
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <errno.h>
+#include <mist/dtsc.h>
+#include "buffer_input.h"
+
+/// Creates an empty buffer of INPUT_BUFFER_SIZE bytes.
+Buffer::InputBuffer::InputBuffer(){
+  size = INPUT_BUFFER_SIZE;
+  data = (char *)malloc(size);
+  start = 0;
+  end = 0;
+}
+
+/// Frees the buffer.
+Buffer::InputBuffer::~InputBuffer(){
+  free(data);
+}
+
+/// Reads once from the given descriptor into the free space.
+/// Returns the amount of bytes read, 0 on end of file or -1 on error, like read(2) itself.
+int Buffer::InputBuffer::fill(int fd){
+  if (end == size && !makeRoom(size / 2)){
+    errno = ENOMEM;
+    return -1;
+  }
+  int r = read(fd, data + end, size - end);
+  if (r > 0){
+    end += r;
+  }
+  return r;
+}
+
+/// Adds data that was already read from the input elsewhere behind the unread bytes.
+/// The data is dropped if the buffer cannot grow to hold it.
+void Buffer::InputBuffer::append(const std::string & bytes){
+  if (bytes.size() > INPUT_MAX_SIZE || !makeRoom(end - start + bytes.size())){
+    return;
+  }
+  memcpy(data + end, bytes.data(), bytes.size());
+  end += bytes.size();
+}
+
+/// Points data and len at the next complete DTSC packet, including its 8 byte header, and skips past it.
+/// Returns false if no complete packet is available. The data stays valid until the next call to next() or fill().
+/// Bytes that do not start a packet are skipped, so the stream resynchronizes after corruption. The same goes for
+/// packets claiming to be larger than INPUT_MAX_PACKET, so a corrupt length never makes the buffer grow without limit.
+bool Buffer::InputBuffer::next(const char * & packet, unsigned int & len){
+  while (end - start >= 8){
+    const char * p = data + start;
+    if (memcmp(p, DTSC::Magic_Packet, 4) != 0 && memcmp(p, DTSC::Magic_Header, 4) != 0){
+      start++;
+      continue;
+    }
+    unsigned int payload = ((unsigned char)p[4] << 24) | ((unsigned char)p[5] << 16) | ((unsigned char)p[6] << 8) | (unsigned char)p[7];
+    if (payload > INPUT_MAX_PACKET - 8){
+      start++; //not a real packet start
+      continue;
+    }
+    if (end - start < payload + 8){
+      if ( !makeRoom(payload + 8)){ //make sure the rest of this packet fits when reading
+        start++; //no memory for it, skip it like a corrupt packet
+        continue;
+      }
+      return false;
+    }
+    packet = p;
+    len = payload + 8;
+    start += len;
+    if (start == end){
+      start = 0;
+      end = 0;
+    }
+    return true;
+  }
+  return false;
+}
+
+/// Returns the amount of unread bytes.
+unsigned int Buffer::InputBuffer::available(){
+  return end - start;
+}
+
+/// Makes sure a packet of the given size fits behind the read cursor.
+/// Moves the unread bytes to the start of the buffer only if needed, and grows the buffer only if that is not enough.
+/// Returns false if the buffer would have to grow beyond INPUT_MAX_SIZE, or could not be grown; it is then unchanged
+/// apart from the unread bytes having moved.
+bool Buffer::InputBuffer::makeRoom(unsigned int needed){
+  if (size - start >= needed && end < size){
+    return true;
+  }
+  if (start){
+    memmove(data, data + start, end - start);
+    end -= start;
+    start = 0;
+  }
+  if (size < needed || end == size){
+    unsigned int newSize = size;
+    while (newSize < needed || end == newSize){
+      if (newSize >= INPUT_MAX_SIZE){
+        return false;
+      }
+      newSize *= 2;
+    }
+    char * grown = (char *)realloc(data, newSize);
+    if ( !grown){
+      return false;
+    }
+    data = grown;
+    size = newSize;
+  }
+  return true;
+}
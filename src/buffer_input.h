@@ -0,0 +1,42 @@
+/// \file buffer_input.h
+/// Contains definitions for framing incoming DTSC data.
+
+#pragma once
+#include <string>
+
+/// Initial size of an InputBuffer, in bytes.
+#define INPUT_BUFFER_SIZE (1024 * 1024)
+/// Largest DTSC packet accepted, including its 8 byte header. Anything claiming to be larger is skipped as corrupt.
+#define INPUT_MAX_PACKET (16 * 1024 * 1024)
+/// Largest size an InputBuffer grows to, enough for the largest packet behind any partly read data.
+#define INPUT_MAX_SIZE (2 * INPUT_MAX_PACKET)
+
+namespace Buffer {
+  /// Contiguous buffer that raw DTSC data is read into, and that complete packets are taken from in place.
+  /// Data is read with read(2) straight into the free space behind the read cursor, so nothing is erased
+  /// from the front: the unread remainder is only moved back to the start when the end of the buffer is reached.
+  class InputBuffer{
+    public:
+      /// Creates an empty buffer of INPUT_BUFFER_SIZE bytes.
+      InputBuffer();
+      /// Frees the buffer.
+      ~InputBuffer();
+      /// Reads once from the given descriptor into the free space.
+      /// Returns the amount of bytes read, 0 on end of file or -1 on error, like read(2) itself.
+      /// Fails with ENOMEM if the buffer is full and cannot grow.
+      int fill(int fd);
+      /// Adds data that was already read from the input elsewhere behind the unread bytes.
+      void append(const std::string & bytes);
+      /// Points data and len at the next complete DTSC packet, including its 8 byte header, and skips past it.
+      /// Returns false if no complete packet is available. The data stays valid until the next call to next() or fill().
+      bool next(const char * & data, unsigned int & len);
+      /// Returns the amount of unread bytes.
+      unsigned int available();
+    private:
+      bool makeRoom(unsigned int needed);
+      char * data; ///< The buffer itself.
+      unsigned int size; ///< Size of the buffer.
+      unsigned int start; ///< Read cursor, position of the first unread byte.
+      unsigned int end; ///< Position right after the last byte read.
+  };
+}
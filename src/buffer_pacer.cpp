@@ -0,0 +1,111 @@
+/// \file buffer_pacer.cpp
+/// Contains code for pacing buffer input to real-time.
+
+#include <iostream>
+#include <time.h>
+#include <errno.h>
+#include "buffer_pacer.h"
+
+/// Creates a real-time pacer without lead, with a one second burst allowance.
+Buffer::Pacer::Pacer(){
+  fast = false;
+  started = false;
+  lead = 0;
+  burst = 1000000;
+  base = 0;
+  baseTime = 0;
+  lastTime = 0;
+  lastLate = 0;
+  lag = 0;
+  jitter = 0;
+}
+
+/// Sets the lead and the burst allowance, in milliseconds.
+void Buffer::Pacer::setTiming(unsigned int lead, unsigned int burst){
+  this->lead = lead * 1000LL;
+  this->burst = burst * 1000LL;
+}
+
+/// Disables pacing completely if fast is true, releasing all packets as soon as they are read.
+void Buffer::Pacer::setFast(bool fast){
+  this->fast = fast;
+}
+
+/// Blocks until the packet with the given timestamp in milliseconds is due.
+/// The first packet, packets going back in time and packets jumping ahead more than PACER_MAX_JUMP
+/// restart pacing, as do packets that are read more than the burst allowance after they were due.
+/// Lateness is measured against the time the packet is due, not the earlier time it is released at.
+void Buffer::Pacer::wait(long long int packetTime){
+  long long int cur = now();
+  if (fast){
+    started = true;
+    lastTime = packetTime;
+    return;
+  }
+  if ( !started || packetTime < lastTime || packetTime - lastTime > PACER_MAX_JUMP){
+    restart(packetTime, cur);
+  }
+  lastTime = packetTime;
+  long long int due = base + (packetTime - baseTime) * 1000;
+  long long int release = due - lead;
+  if (release > cur){
+    struct timespec ts;
+    ts.tv_sec = release / 1000000;
+    ts.tv_nsec = (release % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR){}
+    cur = now();
+  }
+  long long int late = cur - due; //the lead does not count as being late
+  if (late > burst){
+    //too far behind to catch up with - continue from here instead of bursting
+    restart(packetTime, cur);
+    late = 0;
+  }
+  if (late < 0){
+    late = 0;
+  }
+  long long int diff = late - lastLate;
+  if (diff < 0){
+    diff = -diff;
+  }
+  jitter += (diff - jitter) / 16;
+  lastLate = late;
+  lag = late;
+}
+
+/// Returns true once wait() has been called at least once.
+bool Buffer::Pacer::active(){
+  return started;
+}
+
+/// Returns true if pacing is disabled.
+bool Buffer::Pacer::isFast(){
+  return fast;
+}
+
+/// Returns how many milliseconds the last packet was released after it was due.
+long long int Buffer::Pacer::getLag(){
+  return lag / 1000;
+}
+
+/// Returns the smoothed variation in lag between packets, in milliseconds.
+long long int Buffer::Pacer::getJitter(){
+  return jitter / 1000;
+}
+
+/// Makes the given packet due at the given time.
+void Buffer::Pacer::restart(long long int packetTime, long long int at){
+  started = true;
+  base = at;
+  baseTime = packetTime;
+#if DEBUG >= 4
+  std::cerr << "Pacing restarted at stream time " << packetTime << std::endl;
+#endif
+}
+
+/// Returns the current monotonic clock time in microseconds.
+long long int Buffer::Pacer::now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
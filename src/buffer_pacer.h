@@ -0,0 +1,46 @@
+/// \file buffer_pacer.h
+/// Contains definitions for pacing buffer input to real-time.
+
+#pragma once
+
+/// Jumps in stream time larger than this many milliseconds restart pacing from the current packet.
+#define PACER_MAX_JUMP 15000
+
+namespace Buffer {
+  /// Paces input packets to real-time, using absolute sleeps on the monotonic clock.
+  /// Packets are released lead milliseconds before they are due. Input that falls behind is caught up
+  /// at full speed as long as it is no more than the burst allowance behind; beyond that pacing restarts
+  /// from the current packet. Keeps track of how late packets were released and how much that varies.
+  class Pacer{
+    public:
+      /// Creates a real-time pacer without lead, with a one second burst allowance.
+      Pacer();
+      /// Sets the lead and the burst allowance, in milliseconds.
+      void setTiming(unsigned int lead, unsigned int burst);
+      /// Disables pacing completely if fast is true, releasing all packets as soon as they are read.
+      void setFast(bool fast);
+      /// Blocks until the packet with the given timestamp in milliseconds is due.
+      void wait(long long int packetTime);
+      /// Returns true once wait() has been called at least once.
+      bool active();
+      /// Returns true if pacing is disabled.
+      bool isFast();
+      /// Returns how many milliseconds the last packet was released after it was due.
+      long long int getLag();
+      /// Returns the smoothed variation in lag between packets, in milliseconds.
+      long long int getJitter();
+    private:
+      void restart(long long int packetTime, long long int at);
+      static long long int now();
+      bool fast; ///< Whether pacing is disabled.
+      bool started; ///< Whether a base time was set.
+      long long int lead; ///< Time packets are released before they are due, in microseconds.
+      long long int burst; ///< How far packets may be released after they are due, in microseconds.
+      long long int base; ///< Monotonic clock time at which baseTime was due, in microseconds.
+      long long int baseTime; ///< Stream time pacing started from, in milliseconds.
+      long long int lastTime; ///< Stream time of the last packet, in milliseconds.
+      long long int lastLate; ///< How late the last packet was released, in microseconds.
+      volatile long long int lag; ///< How late the last packet was released, in microseconds.
+      volatile long long int jitter; ///< Smoothed variation in lag, in microseconds.
+  };
+}
@@ -0,0 +1,27 @@
+/// \file buffer_push.cpp
+/// Contains code for push inputs of buffer streams.
+
+#include <mist/timing.h>
+#include "buffer_push.h"
+
+/// Creates a push input reading from the given connection.
+/// Anything already received on it after the push command, such as the DTSC header, is taken over as input data.
+Buffer::PushSource::PushSource(Socket::Connection S){
+  conn = S;
+  while (conn.Received().size()){
+    data.append(conn.Received().get());
+    conn.Received().get().clear();
+  }
+  parser = new DTSC::Stream(1);
+  lastData = Util::getMS();
+  lastTime = 0;
+  offset = 0;
+}
+
+/// Closes the connection.
+Buffer::PushSource::~PushSource(){
+  if (conn.connected()){
+    conn.close();
+  }
+  delete parser;
+}
@@ -0,0 +1,30 @@
+/// \file buffer_push.h
+/// Contains definitions for push inputs of buffer streams.
+
+#pragma once
+#include <mist/dtsc.h>
+#include <mist/socket.h>
+#include "buffer_input.h"
+
+/// Default amount of milliseconds the active push input may stall before a backup takes over.
+#define PUSH_FAILOVER 2000
+/// Maximum amount of push inputs per stream, including the active one.
+#define PUSH_MAX_INPUTS 4
+
+namespace Buffer {
+  /// A single push input of a stream.
+  /// Created when a push is accepted, from then on only used by the push input thread.
+  class PushSource{
+    public:
+      /// Creates a push input reading from the given connection.
+      PushSource(Socket::Connection S);
+      /// Closes the connection.
+      ~PushSource();
+      Socket::Connection conn; ///< Connection the push data arrives on.
+      InputBuffer data; ///< Data read but not parsed yet.
+      DTSC::Stream * parser; ///< Parser for this input only, holding the metadata of this input.
+      long long int lastData; ///< Time the last packet arrived, in milliseconds.
+      long long int lastTime; ///< Timestamp of the last packet.
+      long long int offset; ///< Added to the timestamps of this input when publishing, to keep them monotonic.
+  };
+}
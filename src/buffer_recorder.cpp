@@ -0,0 +1,232 @@
+/// \file buffer_recorder.cpp
+/// Contains code for recording buffer streams to DTSC files.
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <mist/dtsc.h>
+#include "buffer_recorder.h"
+
+/// Creates the given file, replacing any existing file, and starts the writer thread.
+Buffer::Recorder::Recorder(std::string filename){
+  this->filename = filename;
+  firstHeaderLen = 0;
+  position = 0;
+  firstTime = -1;
+  lastTime = 0;
+  firstVideo = -1;
+  lastVideo = 0;
+  dropping = false;
+  current = 0;
+  currentLen = 0;
+  stopping = false;
+  failed = false;
+  writer = 0;
+  fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0){
+    perror("Could not create recording");
+    return;
+  }
+  if (posix_memalign((void**) &current, 4096, RECORD_CHUNK)){
+    close(fd);
+    fd = -1;
+    return;
+  }
+  writer = new tthread::thread(writeLoop, this);
+  std::cout << "Recording to " << filename << std::endl;
+}
+
+/// Finalizes the file and stops the writer thread.
+Buffer::Recorder::~Recorder(){
+  if (fd >= 0){
+    finish();
+  }
+  free(current);
+  while ( !spare.empty()){
+    free(spare.back());
+    spare.pop_back();
+  }
+}
+
+/// Returns true if the file was created successfully.
+bool Buffer::Recorder::connected(){
+  return fd >= 0;
+}
+
+/// Sets the metadata of the stream, without keyframe lists.
+/// The latest metadata ends up in the final header, so init data arriving later is still recorded.
+void Buffer::Recorder::setMeta(const JSON::Value & newMeta){
+  meta = newMeta;
+  meta.removeMember("keytime");
+  meta.removeMember("keynum");
+  meta.removeMember("keybpos");
+  meta.removeMember("moreheader");
+}
+
+/// Appends a DTSC packet to the recording and adds video keyframes to the index.
+/// Recordings of streams with video start at a keyframe, so the file is playable from its first packet.
+void Buffer::Recorder::write(const char * data, unsigned int len, long long int time, bool isKey, bool isVideo){
+  if (fd < 0){
+    return;
+  }
+  bool hasVideo = meta.isMember("video");
+  if (dropping || firstTime < 0){
+    if (hasVideo && !isKey){
+      return;
+    }
+    if (dropping){
+      chunk_mutex.lock();
+      dropping = (queued.size() > RECORD_MAX_CHUNKS / 2);
+      chunk_mutex.unlock();
+      if (dropping){
+        return;
+      }
+      std::cerr << "Recording to " << filename << " resumed" << std::endl;
+    }
+  }
+  if (firstTime < 0){
+    firstHeader = meta;
+    firstHeader["moreheader"] = 0LL;
+    std::string packed = firstHeader.toPacked();
+    firstHeaderLen = packed.size();
+    unsigned int size = htonl(firstHeaderLen);
+    append(DTSC::Magic_Header, 4);
+    append((char*) &size, 4);
+    append(packed.data(), packed.size());
+    firstTime = time;
+  }
+  if (isKey && isVideo){
+    keytime.append(time);
+    keybpos.append(position);
+  }
+  if (isVideo){
+    if (firstVideo < 0){
+      firstVideo = time;
+    }
+    lastVideo = time;
+  }
+  lastTime = time;
+  append(data, len);
+}
+
+/// Copies data into the current chunk, queueing it for the writer thread whenever it is full.
+/// Starts dropping packets once too many chunks are waiting.
+void Buffer::Recorder::append(const char * data, unsigned int len){
+  position += len;
+  while (len){
+    unsigned int part = std::min(len, (unsigned int)RECORD_CHUNK - currentLen);
+    memcpy(current + currentLen, data, part);
+    currentLen += part;
+    data += part;
+    len -= part;
+    if (currentLen < RECORD_CHUNK){
+      break;
+    }
+    chunk_mutex.lock();
+    queued.push_back(std::make_pair(current, currentLen));
+    if (queued.size() >= RECORD_MAX_CHUNKS && !dropping){
+      std::cerr << "Recording to " << filename << " fell behind, dropping packets" << std::endl;
+      dropping = true;
+    }
+    current = 0;
+    if ( !spare.empty()){
+      current = spare.back();
+      spare.pop_back();
+    }
+    chunk_cond.notify_all();
+    chunk_mutex.unlock();
+    if ( !current && posix_memalign((void**) &current, 4096, RECORD_CHUNK)){
+      abort();
+    }
+    currentLen = 0;
+  }
+}
+
+/// Writes queued chunks to the file until told to stop and no chunks are left.
+void Buffer::Recorder::writeLoop(void * arg){
+  Recorder * rec = (Recorder*)arg;
+  rec->chunk_mutex.lock();
+  while (true){
+    while (rec->queued.empty() && !rec->stopping){
+      rec->chunk_cond.wait(rec->chunk_mutex);
+    }
+    if (rec->queued.empty()){
+      break;
+    }
+    std::pair<char*, unsigned int> chunk = rec->queued.front();
+    rec->queued.pop_front();
+    bool failed = rec->failed;
+    rec->chunk_mutex.unlock();
+    unsigned int done = 0;
+    while ( !failed && done < chunk.second){
+      int r = ::write(rec->fd, chunk.first + done, chunk.second - done);
+      if (r < 0 && errno == EINTR){
+        continue;
+      }
+      if (r <= 0){
+        perror("Could not write recording");
+        failed = true;
+        break;
+      }
+      done += r;
+    }
+    rec->chunk_mutex.lock();
+    rec->failed = failed;
+    rec->spare.push_back(chunk.first);
+  }
+  rec->chunk_mutex.unlock();
+}
+
+/// Appends the final header with the keyframe index, writes all data and points the first header at the final one.
+/// A recording without any packets is removed.
+void Buffer::Recorder::finish(){
+  long long int headerPos = position;
+  if (firstTime >= 0){
+    JSON::Value full = meta;
+    full["keytime"] = keytime;
+    full["keybpos"] = keybpos;
+    full["lastms"] = lastTime;
+    full["length"] = (lastTime - firstTime) / 1000;
+    if (full.isMember("video") && keytime.size()){
+      full["video"]["keyms"] = (lastVideo - firstVideo) / (long long int)keytime.size();
+    }
+    std::string packed = full.toPacked();
+    unsigned int size = htonl(packed.size());
+    append(DTSC::Magic_Header, 4);
+    append((char*) &size, 4);
+    append(packed.data(), packed.size());
+  }
+  chunk_mutex.lock();
+  if (currentLen){
+    queued.push_back(std::make_pair(current, currentLen));
+    current = 0;
+    currentLen = 0;
+  }
+  stopping = true;
+  chunk_cond.notify_all();
+  chunk_mutex.unlock();
+  writer->join();
+  delete writer;
+  writer = 0;
+  if (firstTime < 0){
+    close(fd);
+    fd = -1;
+    unlink(filename.c_str());
+    return;
+  }
+  firstHeader["moreheader"] = headerPos;
+  std::string packed = firstHeader.toPacked();
+  if (failed || packed.size() != firstHeaderLen || pwrite(fd, packed.data(), packed.size(), 8) != (int)packed.size()){
+    std::cerr << "Could not finalize recording " << filename << ", run DTSCFix on it to make it playable" << std::endl;
+  }else{
+    std::cout << "Recorded " << keytime.size() << " keyframes to " << filename << std::endl;
+  }
+  close(fd);
+  fd = -1;
+}
@@ -0,0 +1,62 @@
+/// \file buffer_recorder.h
+/// Contains definitions for recording buffer streams to DTSC files.
+
+#pragma once
+#include <string>
+#include <deque>
+#include <vector>
+#include <mist/json.h>
+#include "tinythread.h"
+
+/// Size of the chunks recorded data is written to disk in, in bytes.
+#define RECORD_CHUNK (1024 * 1024)
+/// Maximum amount of full chunks waiting for the writer thread before packets are dropped.
+#define RECORD_MAX_CHUNKS 64
+
+namespace Buffer {
+  /// Records the packets of a stream to an indexed DTSC file.
+  /// Packets are copied into large page aligned chunks; a dedicated thread writes every full chunk with a single
+  /// write(2), so the thread publishing packets never waits for the disk. The file starts with a header that
+  /// has a "moreheader" field of zero. On close the complete metadata with the keyframe index is appended as
+  /// a second header and the first header is rewritten to point at it, the same layout DTSCFix produces.
+  /// If the disk falls behind too far, packets are dropped until the next keyframe.
+  class Recorder{
+    public:
+      /// Creates the given file and starts the writer thread.
+      Recorder(std::string filename);
+      /// Finalizes the file and stops the writer thread.
+      ~Recorder();
+      /// Returns true if the file was created successfully.
+      bool connected();
+      /// Sets the metadata of the stream, without keyframe lists.
+      void setMeta(const JSON::Value & meta);
+      /// Appends a DTSC packet to the recording.
+      void write(const char * data, unsigned int len, long long int time, bool isKey, bool isVideo);
+    private:
+      static void writeLoop(void * arg);
+      void append(const char * data, unsigned int len);
+      void finish();
+      std::string filename; ///< Name of the file being recorded to.
+      int fd; ///< The file being recorded to, -1 on failure.
+      JSON::Value meta; ///< Stream metadata as last set.
+      JSON::Value firstHeader; ///< Header at the start of the file, rewritten on close.
+      unsigned int firstHeaderLen; ///< Length of the packed first header, without magic and size.
+      JSON::Value keytime; ///< Timestamps of all recorded keyframes.
+      JSON::Value keybpos; ///< File positions of all recorded keyframes.
+      long long int position; ///< File position the next appended byte will end up at.
+      long long int firstTime; ///< Timestamp of the first recorded packet, -1 if none.
+      long long int lastTime; ///< Timestamp of the last recorded packet.
+      long long int firstVideo; ///< Timestamp of the first recorded video packet, -1 if none.
+      long long int lastVideo; ///< Timestamp of the last recorded video packet.
+      bool dropping; ///< Set while packets are dropped until the next keyframe.
+      char * current; ///< Chunk currently being filled.
+      unsigned int currentLen; ///< Amount of bytes in the current chunk.
+      tthread::mutex chunk_mutex; ///< Mutex for the chunk lists and the stop flag.
+      tthread::condition_variable chunk_cond; ///< Signalled when a chunk is queued or the writer should stop.
+      std::deque<std::pair<char*, unsigned int> > queued; ///< Chunks waiting to be written, with their lengths.
+      std::vector<char*> spare; ///< Written chunks available for reuse.
+      bool stopping; ///< Set when the writer thread should write all queued chunks and stop.
+      bool failed; ///< Set by the writer thread when writing failed, after which all data is discarded.
+      tthread::thread * writer; ///< The writer thread.
+  };
+}
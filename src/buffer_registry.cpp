@@ -0,0 +1,47 @@
+/// \file buffer_registry.cpp
+/// Contains code for the buffer user registry.
+
+#include "buffer_registry.h"
+#include "buffer_user.h"
+
+Buffer::UserRegistry::UserRegistry(){
+  count = 0;
+}
+
+/// Adds a user, storing its slot in user::slot.
+void Buffer::UserRegistry::add(user * usr){
+  if (freeSlots.empty()){
+    usr->slot = list.size();
+    list.push_back(usr);
+  }else{
+    usr->slot = freeSlots.back();
+    freeSlots.pop_back();
+    list[usr->slot] = usr;
+  }
+  count++;
+}
+
+/// Removes a user that was added earlier.
+void Buffer::UserRegistry::remove(user * usr){
+  if (usr->slot >= list.size() || list[usr->slot] != usr){
+    return;
+  }
+  list[usr->slot] = 0;
+  freeSlots.push_back(usr->slot);
+  count--;
+}
+
+/// Returns the amount of users, may be called without locking.
+unsigned int Buffer::UserRegistry::size(){
+  return count;
+}
+
+/// Returns the amount of slots, including free ones.
+unsigned int Buffer::UserRegistry::slots(){
+  return list.size();
+}
+
+/// Returns the user in the given slot, or null if it is free.
+Buffer::user * Buffer::UserRegistry::at(unsigned int slot){
+  return list[slot];
+}
@@ -0,0 +1,31 @@
+/// \file buffer_registry.h
+/// Contains definitions for the buffer user registry.
+
+#pragma once
+#include <vector>
+
+namespace Buffer {
+  class user;
+
+  /// Slab of users, with constant time adding and removing.
+  /// Removed users leave their slot on a free list, from which the next added user takes it.
+  /// Not thread-safe by itself, except for size().
+  class UserRegistry{
+    public:
+      UserRegistry();
+      /// Adds a user, storing its slot in user::slot.
+      void add(user * usr);
+      /// Removes a user that was added earlier.
+      void remove(user * usr);
+      /// Returns the amount of users, may be called without locking.
+      unsigned int size();
+      /// Returns the amount of slots, including free ones.
+      unsigned int slots();
+      /// Returns the user in the given slot, or null if it is free.
+      user * at(unsigned int slot);
+    private:
+      std::vector<user*> list; ///< All slots, null if free.
+      std::vector<unsigned int> freeSlots; ///< Numbers of all free slots.
+      volatile unsigned int count; ///< Amount of users.
+  };
+}
@@ -0,0 +1,351 @@
+/// \file buffer_ring.cpp
+/// Contains code for the lock-free buffer packet ring.
+
+#include "buffer_ring.h"
+
+/// Creates a new packet holding one reference, owned by the creator.
+Buffer::Packet::Packet(const std::string & packetData, long long int packetTime, bool isKey){
+  data = packetData;
+  time = packetTime;
+  keyframe = isKey;
+  seq = 0;
+  offset = 0;
+  refs = 1;
+}
+
+/// Creates a new packet from raw DTSC bytes, holding one reference, owned by the creator.
+/// The bytes are copied exactly once, straight into the packet.
+Buffer::Packet::Packet(const char * packetData, unsigned int packetLen, long long int packetTime, bool isKey){
+  data.assign(packetData, packetLen);
+  time = packetTime;
+  keyframe = isKey;
+  seq = 0;
+  offset = 0;
+  refs = 1;
+}
+
+/// Only called through release().
+Buffer::Packet::~Packet(){
+}
+
+/// Takes an extra reference to this packet.
+void Buffer::Packet::claim(){
+  __sync_add_and_fetch( &refs, 1);
+}
+
+/// Drops a reference to this packet, deleting it when none are left.
+void Buffer::Packet::release(){
+  if (__sync_sub_and_fetch( &refs, 1) == 0){
+    delete this;
+  }
+}
+
+/// Creates a ring holding at most size packets.
+Buffer::PacketRing::PacketRing(unsigned int size){
+  if (size < 2){
+    size = 2;
+  }
+  this->size = size;
+  slots = new Packet * volatile[size];
+  for (unsigned int i = 0; i < size; i++){
+    slots[i] = 0;
+  }
+  keys = new RingKey[size];
+  header = 0;
+  written = 0;
+  first = 0;
+  keysWritten = 0;
+  keysFirst = 0;
+  window = 0;
+  maxBytes = 0;
+  bytes = 0;
+  totalBytes = 0;
+  lastTime = 0;
+  epoch = 1; //zero means "not reading"
+  for (unsigned int i = 0; i < RING_MAX_READERS; i++){
+    readerEpochs[i] = 0;
+  }
+}
+
+/// Releases all packets still held.
+/// No readers may be active anymore when this is called.
+Buffer::PacketRing::~PacketRing(){
+  for (unsigned int i = 0; i < size; i++){
+    if (slots[i]){
+      slots[i]->release();
+    }
+  }
+  delete[] slots;
+  delete[] keys;
+  if (header){
+    header->release();
+  }
+  while ( !limbo.empty()){
+    limbo.front().first->release();
+    limbo.pop_front();
+  }
+}
+
+/// Sets the amount of milliseconds and bytes to keep, zero means unlimited.
+/// Must be called before any packets are pushed.
+void Buffer::PacketRing::setWindow(unsigned int ms, unsigned long long maxBytes){
+  window = ms;
+  this->maxBytes = maxBytes;
+}
+
+/// Writer only: appends a packet, taking over the reference held by the caller.
+void Buffer::PacketRing::push(Packet * p){
+  unsigned long long seq = written;
+  p->seq = seq;
+  p->offset = totalBytes;
+  if (seq - first >= size){
+    dropOldest(); //all slots are in use - make room
+  }
+  if (p->keyframe){
+    RingKey & key = keys[keysWritten % size];
+    key.seq = seq;
+    key.time = p->time;
+    __sync_synchronize();
+    keysWritten++;
+  }
+  __sync_synchronize(); //packet contents must be visible before the packet is
+  slots[seq % size] = p;
+  bytes += p->data.size();
+  totalBytes += p->data.size();
+  lastTime = p->time;
+  __sync_synchronize();
+  written = seq + 1;
+  trim(p->time);
+  reclaim();
+}
+
+/// Writer only: replaces the stream header, taking over the reference held by the caller.
+void Buffer::PacketRing::setHeader(Packet * p){
+  Packet * old = header;
+  __sync_synchronize();
+  header = p;
+  if (old){
+    retire(old);
+  }
+  reclaim();
+}
+
+/// Returns a claimed reference to the packet with the given sequence number.
+/// Returns null if this packet was not written yet or was already dropped.
+Buffer::Packet * Buffer::PacketRing::get(int reader, unsigned long long seq){
+  if (seq >= written){
+    return 0;
+  }
+  enter(reader);
+  Packet * p = slots[seq % size];
+  if (p && p->seq == seq){
+    p->claim();
+  }else{
+    p = 0;
+  }
+  leave(reader);
+  return p;
+}
+
+/// Returns a claimed reference to the current header, or null if none is available.
+Buffer::Packet * Buffer::PacketRing::getHeader(int reader){
+  enter(reader);
+  Packet * p = header;
+  if (p){
+    p->claim();
+  }
+  leave(reader);
+  return p;
+}
+
+/// Returns the sequence number the next packet will get.
+unsigned long long Buffer::PacketRing::end(){
+  return written;
+}
+
+/// Returns the oldest sequence number that may still be available.
+unsigned long long Buffer::PacketRing::begin(){
+  return first;
+}
+
+/// Returns the total amount of packet bytes ever pushed.
+unsigned long long Buffer::PacketRing::bytesEnd(){
+  return totalBytes;
+}
+
+/// Returns the timestamp of the newest packet.
+long long int Buffer::PacketRing::endTime(){
+  return lastTime;
+}
+
+/// Returns the best sequence number for a new reader to start at.
+/// This is the newest keyframe if available, or the live point otherwise.
+unsigned long long Buffer::PacketRing::start(){
+  unsigned long long w = written;
+  unsigned long long k = keysWritten;
+  if (k > keysFirst){
+    unsigned long long seq = keys[(k - 1) % size].seq;
+    if (seq >= first){
+      return seq;
+    }
+  }
+  return w;
+}
+
+/// Returns the sequence number of the newest keyframe at or before the given time.
+/// Times before the oldest keyframe give the oldest keyframe. Binary searches the keyframe index.
+/// If the writer drops keyframes during the search, the result may already be gone - get() then simply fails.
+unsigned long long Buffer::PacketRing::seekTime(long long int ms){
+  unsigned long long lo = keysFirst;
+  unsigned long long hi = keysWritten;
+  if (lo >= hi){
+    return start();
+  }
+  if (keys[lo % size].time > ms){
+    return keys[lo % size].seq;
+  }
+  while (hi - lo > 1){
+    unsigned long long mid = lo + (hi - lo) / 2;
+    if (keys[mid % size].time <= ms){
+      lo = mid;
+    }else{
+      hi = mid;
+    }
+  }
+  return keys[lo % size].seq;
+}
+
+/// Returns the sequence number of the keyframe with the given number.
+/// Numbers outside of the available range give the nearest available keyframe.
+unsigned long long Buffer::PacketRing::seekKey(unsigned long long number){
+  unsigned long long lo = keysFirst;
+  unsigned long long hi = keysWritten;
+  if (lo >= hi){
+    return start();
+  }
+  if (number <= lo){
+    number = lo + 1;
+  }
+  if (number > hi){
+    number = hi;
+  }
+  return keys[(number - 1) % size].seq;
+}
+
+/// Returns the amount of keyframes pushed before the given sequence number.
+/// Keyframes that were already dropped are always counted. Binary searches the keyframe index.
+unsigned long long Buffer::PacketRing::keysUntil(unsigned long long seq){
+  unsigned long long lo = keysFirst;
+  unsigned long long hi = keysWritten;
+  while (lo < hi){
+    unsigned long long mid = lo + (hi - lo) / 2;
+    if (keys[mid % size].seq < seq){
+      lo = mid + 1;
+    }else{
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/// Returns the number of the oldest keyframe still available.
+unsigned long long Buffer::PacketRing::keyBegin(){
+  return keysFirst + 1;
+}
+
+/// Returns the number the next keyframe will get.
+unsigned long long Buffer::PacketRing::keyEnd(){
+  return keysWritten + 1;
+}
+
+/// Writer only: returns the timestamp of the keyframe with the given number.
+long long int Buffer::PacketRing::keyTime(unsigned long long number){
+  return keys[(number - 1) % size].time;
+}
+
+/// Announces that the given reader is about to dereference slots.
+void Buffer::PacketRing::enter(int reader){
+  readerEpochs[reader] = epoch;
+  __sync_synchronize();
+}
+
+/// Announces that the given reader no longer dereferences slots.
+void Buffer::PacketRing::leave(int reader){
+  __sync_synchronize();
+  readerEpochs[reader] = 0;
+}
+
+/// Writer only: drops the oldest keyframe intervals for as long as they are outside the window,
+/// or for as long as too many bytes are held. The newest keyframe interval is always kept.
+/// Without any keyframes, single packets are dropped instead.
+void Buffer::PacketRing::trim(long long int now){
+  while (written - first > 1){
+    unsigned long long until = first + 1;
+    if (keysFirst < keysWritten){
+      unsigned long long key = keys[keysFirst % size].seq;
+      if (key > first){
+        until = key; //packets from before the first keyframe
+      }else{
+        if (keysWritten - keysFirst < 2){
+          break;
+        }
+        until = keys[(keysFirst + 1) % size].seq;
+      }
+    }
+    //the packet at until covers the window by itself if it is old enough
+    bool tooOld = window && slots[until % size]->time + window <= now;
+    bool tooBig = maxBytes && bytes > maxBytes;
+    if ( !tooOld && !tooBig){
+      break;
+    }
+    while (first < until){
+      dropOldest();
+    }
+  }
+}
+
+/// Writer only: drops the oldest packet held, along with its keyframe index entry if any.
+void Buffer::PacketRing::dropOldest(){
+  Packet * p = slots[first % size];
+  slots[first % size] = 0;
+  if (p){
+    bytes -= p->data.size();
+    retire(p);
+  }
+  while (keysFirst < keysWritten && keys[keysFirst % size].seq <= first){
+    keysFirst++;
+  }
+  __sync_synchronize();
+  first++;
+}
+
+/// Writer only: queues a replaced packet for reclaiming.
+void Buffer::PacketRing::retire(Packet * p){
+  __sync_synchronize();
+  limbo.push_back(std::make_pair(p, (unsigned long long)epoch));
+}
+
+/// Writer only: advances the epoch if all readers caught up with it,
+/// then drops the ring's reference to all packets that can no longer be seen by any reader.
+void Buffer::PacketRing::reclaim(){
+  if (limbo.empty()){
+    return;
+  }
+  unsigned long long e = epoch;
+  bool advance = true;
+  for (int i = 0; i < RING_MAX_READERS; i++){
+    unsigned long long r = readerEpochs[i];
+    if (r != 0 && r != e){
+      advance = false;
+      break;
+    }
+  }
+  if (advance){
+    epoch = e + 1;
+    __sync_synchronize();
+  }
+  while ( !limbo.empty() && limbo.front().second + 2 <= epoch){
+    limbo.front().first->release();
+    limbo.pop_front();
+  }
+}
@@ -0,0 +1,112 @@
+/// \file buffer_ring.h
+/// Contains definitions for the lock-free buffer packet ring.
+
+#pragma once
+#include <string>
+#include <deque>
+
+/// Maximum amount of threads that can read from a PacketRing at the same time.
+/// Readers are numbered from 0 up to this amount, each number may only be used by a single thread.
+#define RING_MAX_READERS 128
+
+namespace Buffer {
+  /// A single immutable, reference-counted DTSC packet.
+  /// Once published, a packet is never modified. Whoever holds a reference may read it without locking.
+  class Packet{
+    public:
+      /// Creates a new packet holding one reference, owned by the creator.
+      Packet(const std::string & packetData, long long int packetTime, bool isKey);
+      /// Creates a new packet from raw DTSC bytes, holding one reference, owned by the creator.
+      Packet(const char * packetData, unsigned int packetLen, long long int packetTime, bool isKey);
+      /// Takes an extra reference to this packet.
+      void claim();
+      /// Drops a reference to this packet, deleting it when none are left.
+      void release();
+      std::string data; ///< The complete DTSC packet, ready for sending.
+      long long int time; ///< Timestamp of this packet in milliseconds.
+      bool keyframe; ///< Whether this packet is a video keyframe.
+      unsigned long long seq; ///< Sequence number in the ring this packet was pushed to.
+      unsigned long long offset; ///< Total amount of packet bytes pushed to the ring before this packet.
+    private:
+      ~Packet();
+      volatile int refs; ///< Current reference count.
+  };
+
+  /// Keyframe index entry of a PacketRing.
+  struct RingKey{
+    volatile unsigned long long seq; ///< Sequence number of the keyframe packet.
+    volatile long long int time; ///< Timestamp of the keyframe in milliseconds.
+  };
+
+  /// Lock-free single-producer, multi-consumer ring of packets.
+  /// Packets are numbered by sequence number. Readers never block the writer and the writer never blocks readers.
+  /// The writer drops the oldest packets, a keyframe interval at a time, once they fall outside the configured
+  /// window or once the packets held take up more than the configured amount of bytes.
+  /// Keyframes are kept in a separate index, numbered from 1 upwards, so seeks are answered in O(log n).
+  /// Packets replaced by the writer are reclaimed using epochs: a replaced packet loses the ring's
+  /// reference only once every reader has left the epoch in which it could have seen it.
+  class PacketRing{
+    public:
+      /// Creates a ring holding at most size packets.
+      PacketRing(unsigned int size);
+      /// Releases all packets still held.
+      ~PacketRing();
+      /// Sets the amount of milliseconds and bytes to keep, zero means unlimited.
+      void setWindow(unsigned int ms, unsigned long long maxBytes);
+      /// Writer only: appends a packet, taking over the reference held by the caller.
+      void push(Packet * p);
+      /// Writer only: replaces the stream header, taking over the reference held by the caller.
+      void setHeader(Packet * p);
+      /// Returns a claimed reference to the packet with the given sequence number.
+      /// Returns null if this packet was not written yet or was already dropped.
+      Packet * get(int reader, unsigned long long seq);
+      /// Returns a claimed reference to the current header, or null if none is available.
+      Packet * getHeader(int reader);
+      /// Returns the sequence number the next packet will get.
+      unsigned long long end();
+      /// Returns the oldest sequence number that may still be available.
+      unsigned long long begin();
+      /// Returns the total amount of packet bytes ever pushed.
+      unsigned long long bytesEnd();
+      /// Returns the timestamp of the newest packet.
+      long long int endTime();
+      /// Returns the best sequence number for a new reader to start at.
+      /// This is the newest keyframe if available, or the live point otherwise.
+      unsigned long long start();
+      /// Returns the sequence number of the newest keyframe at or before the given time.
+      unsigned long long seekTime(long long int ms);
+      /// Returns the sequence number of the keyframe with the given number.
+      unsigned long long seekKey(unsigned long long number);
+      /// Returns the amount of keyframes pushed before the given sequence number.
+      unsigned long long keysUntil(unsigned long long seq);
+      /// Returns the number of the oldest keyframe still available.
+      unsigned long long keyBegin();
+      /// Returns the number the next keyframe will get.
+      unsigned long long keyEnd();
+      /// Writer only: returns the timestamp of the keyframe with the given number.
+      long long int keyTime(unsigned long long number);
+    private:
+      void enter(int reader);
+      void leave(int reader);
+      void retire(Packet * p);
+      void reclaim();
+      void trim(long long int now);
+      void dropOldest();
+      unsigned int size; ///< Amount of slots in the ring.
+      Packet * volatile * slots; ///< The slots themselves.
+      Packet * volatile header; ///< The current header.
+      volatile unsigned long long written; ///< Sequence number of the next packet.
+      volatile unsigned long long first; ///< Sequence number of the oldest packet still held.
+      RingKey * keys; ///< Keyframe index, holding as many entries as there are slots.
+      volatile unsigned long long keysWritten; ///< Amount of keyframes ever pushed.
+      volatile unsigned long long keysFirst; ///< Index of the oldest keyframe still held.
+      unsigned int window; ///< Milliseconds of packets to keep, zero for unlimited.
+      unsigned long long maxBytes; ///< Maximum amount of packet bytes to keep, zero for unlimited.
+      unsigned long long bytes; ///< Amount of packet bytes currently held, writer only.
+      volatile unsigned long long totalBytes; ///< Amount of packet bytes ever pushed.
+      volatile long long int lastTime; ///< Timestamp of the newest packet.
+      volatile unsigned long long epoch; ///< Current global epoch.
+      volatile unsigned long long readerEpochs[RING_MAX_READERS]; ///< Epoch each reader is in, or 0 when not reading.
+      std::deque<std::pair<Packet*, unsigned long long> > limbo; ///< Replaced packets and the epoch they were replaced in.
+  };
+}
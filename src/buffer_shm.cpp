@@ -0,0 +1,310 @@
+/// \file buffer_shm.cpp
+/// Contains code for publishing buffer packets through shared memory.
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mist/stream.h>
+#include "buffer_shm.h"
+
+/// Rounds up to a multiple of 64 bytes, so all areas start on their own cache line.
+#define SHM_ALIGN(x) ((((x) + 63) / 64) * 64)
+#define SHM_HEADER_OFFSET SHM_ALIGN(sizeof(Buffer::ShmHead))
+#define SHM_SLOTS_OFFSET (SHM_HEADER_OFFSET + SHM_ALIGN(SHM_HEADER_SIZE))
+#define SHM_KEYS_OFFSET (SHM_SLOTS_OFFSET + SHM_ALIGN(sizeof(Buffer::ShmSlot) * SHM_SLOTS))
+#define SHM_DATA_OFFSET (SHM_KEYS_OFFSET + SHM_ALIGN(sizeof(Buffer::ShmKey) * SHM_KEYS))
+
+/// Returns the shared memory name used for the given stream.
+std::string Buffer::shmName(std::string streamname){
+  Util::Stream::sanitizeName(streamname);
+  return "/MstStrm" + streamname;
+}
+
+/// Creates the segment for the given stream, with a data area of the given size.
+/// A size of zero disables the segment.
+Buffer::ShmWriter::ShmWriter(std::string streamname, unsigned int megabytes){
+  map = 0;
+  if ( !megabytes){
+    return;
+  }
+  name = shmName(streamname);
+  uint64_t dataSize = (uint64_t)megabytes * 1024 * 1024;
+  mapSize = SHM_DATA_OFFSET + dataSize;
+  shm_unlink(name.c_str()); //remove leftovers of a previous buffer for this stream
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0){
+    perror("Could not create shared memory segment");
+    return;
+  }
+  if (ftruncate(fd, mapSize) < 0){
+    perror("Could not size shared memory segment");
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return;
+  }
+  void * mapped = mmap(0, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED){
+    perror("Could not map shared memory segment");
+    shm_unlink(name.c_str());
+    return;
+  }
+  map = (char *)mapped;
+  head = (ShmHead *)map;
+  header = map + SHM_HEADER_OFFSET;
+  slots = (ShmSlot *)(map + SHM_SLOTS_OFFSET);
+  keys = (ShmKey *)(map + SHM_KEYS_OFFSET);
+  data = map + SHM_DATA_OFFSET;
+  memset(map, 0, SHM_DATA_OFFSET);
+  for (unsigned int i = 0; i < SHM_SLOTS; i++){
+    slots[i].seq = (uint64_t) -1;
+  }
+  head->dataSize = dataSize;
+  head->alive = 1;
+  __sync_synchronize();
+  memcpy(head->magic, "MShm", 4);
+}
+
+/// Marks the segment as dead and removes it.
+/// Readers that still have it mapped notice and stop using it.
+Buffer::ShmWriter::~ShmWriter(){
+  if ( !map){
+    return;
+  }
+  head->alive = 0;
+  munmap(map, mapSize);
+  shm_unlink(name.c_str());
+}
+
+/// Returns true if the segment was created successfully.
+bool Buffer::ShmWriter::connected(){
+  return map != 0;
+}
+
+/// Replaces the stream header. Headers too large for the segment make it unavailable.
+void Buffer::ShmWriter::setHeader(const std::string & newHeader){
+  if ( !map){
+    return;
+  }
+  head->headerGen++;
+  __sync_synchronize();
+  if (newHeader.size() > SHM_HEADER_SIZE){
+    head->headerLen = 0;
+  }else{
+    memcpy(header, newHeader.data(), newHeader.size());
+    head->headerLen = newHeader.size();
+  }
+  __sync_synchronize();
+  head->headerGen++;
+}
+
+/// Appends a packet to the segment.
+/// Packets larger than half the data area are not published.
+void Buffer::ShmWriter::write(const std::string & packet, long long int time, bool keyframe){
+  if ( !map || packet.size() > head->dataSize / 2){
+    return;
+  }
+  uint64_t start = head->reserved;
+  uint64_t len = packet.size();
+  //announce which bytes are about to be overwritten before touching them
+  head->reserved = start + len;
+  __sync_synchronize();
+  uint64_t off = start % head->dataSize;
+  uint64_t first = head->dataSize - off;
+  if (first > len){
+    first = len;
+  }
+  memcpy(data + off, packet.data(), first);
+  if (first < len){
+    memcpy(data, packet.data() + first, len - first);
+  }
+  uint64_t seq = head->written;
+  ShmSlot & slot = slots[seq % SHM_SLOTS];
+  slot.seq = (uint64_t) -1;
+  __sync_synchronize();
+  slot.offset = start;
+  slot.len = len;
+  slot.keyframe = keyframe ? 1 : 0;
+  slot.time = time;
+  __sync_synchronize();
+  slot.seq = seq;
+  if (keyframe){
+    uint64_t k = head->keys;
+    keys[k % SHM_KEYS].seq = seq;
+    keys[k % SHM_KEYS].time = time;
+    __sync_synchronize();
+    head->keys = k + 1;
+  }
+  __sync_synchronize();
+  head->written = seq + 1;
+}
+
+Buffer::ShmReader::ShmReader(){
+  map = 0;
+  pos = 0;
+  headerGen = 0;
+}
+
+/// Unmaps the segment, if mapped.
+Buffer::ShmReader::~ShmReader(){
+  close();
+}
+
+/// Maps the segment for the given stream. Returns false if it is not available.
+/// Reading starts at the newest keyframe.
+bool Buffer::ShmReader::open(std::string streamname){
+  close();
+  int fd = shm_open(shmName(streamname).c_str(), O_RDONLY, 0);
+  if (fd < 0){
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size <= (off_t)SHM_DATA_OFFSET){
+    ::close(fd);
+    return false;
+  }
+  void * mapped = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED){
+    return false;
+  }
+  map = (char *)mapped;
+  mapSize = st.st_size;
+  head = (ShmHead *)map;
+  header = map + SHM_HEADER_OFFSET;
+  slots = (ShmSlot *)(map + SHM_SLOTS_OFFSET);
+  keys = (ShmKey *)(map + SHM_KEYS_OFFSET);
+  data = map + SHM_DATA_OFFSET;
+  if (memcmp(head->magic, "MShm", 4) != 0 || !head->alive || SHM_DATA_OFFSET + head->dataSize != mapSize
+      || (head->headerGen && !head->headerLen)){
+    close();
+    return false;
+  }
+  headerGen = 0;
+  pos = newestKey();
+  return true;
+}
+
+/// Unmaps the segment, if mapped.
+void Buffer::ShmReader::close(){
+  if (map){
+    munmap(map, mapSize);
+    map = 0;
+  }
+}
+
+/// Returns true if a live segment is mapped.
+bool Buffer::ShmReader::connected(){
+  return map && head->alive;
+}
+
+/// Replacement for Socket::Connection::spool() on a buffer connection.
+/// If a segment is mapped, discards anything received over the socket and appends new packets from
+/// the segment to its receive buffer instead. Otherwise simply spools the socket.
+/// Packets are always appended whole, so a parse loop that empties the buffer never loses data here.
+bool Buffer::ShmReader::spool(Socket::Connection & conn){
+  if ( !map){
+    return conn.spool();
+  }
+  if ( !head->alive){
+    close();
+    return conn.spool();
+  }
+  //the socket is only used for control messages - anything received on it is a duplicate
+  conn.spool();
+  conn.Received().clear();
+  std::string out;
+  uint64_t gen = head->headerGen;
+  if (gen != headerGen && !(gen & 1) && head->headerLen){
+    std::string tmp(header, head->headerLen);
+    __sync_synchronize();
+    if (head->headerGen == gen){
+      out = tmp;
+      headerGen = gen;
+    }
+  }
+  if ( !headerGen){
+    return false; //never send packets before a header
+  }
+  int laps = 0;
+  for (int i = 0; i < 64; i++){
+    uint64_t before = pos;
+    if (readPacket(out)){
+      continue;
+    }
+    if (pos == before){
+      break; //nothing new available
+    }
+    //we were lapped and moved - retry, but do not keep chasing a segment that is too small
+    if (++laps > 2){
+      pos = head->written;
+      break;
+    }
+  }
+  if (out.empty()){
+    return false;
+  }
+  conn.Received().append(out);
+  return true;
+}
+
+/// Appends the packet at pos to out and advances pos, returning true.
+/// Returns false without changing pos if no new packet is available.
+/// If the packet was already overwritten, moves pos to the newest keyframe and returns false.
+bool Buffer::ShmReader::readPacket(std::string & out){
+  uint64_t written = head->written;
+  if (pos >= written){
+    return false;
+  }
+  ShmSlot & slot = slots[pos % SHM_SLOTS];
+  if (written - pos < SHM_SLOTS && slot.seq == pos){
+    __sync_synchronize();
+    uint64_t offset = slot.offset;
+    uint64_t len = slot.len;
+    __sync_synchronize();
+    if (slot.seq == pos && len <= head->dataSize){
+      size_t oldSize = out.size();
+      uint64_t off = offset % head->dataSize;
+      uint64_t first = head->dataSize - off;
+      if (first > len){
+        first = len;
+      }
+      out.append(data + off, first);
+      if (first < len){
+        out.append(data, len - first);
+      }
+      __sync_synchronize();
+      if (head->reserved <= offset + head->dataSize){
+        pos++;
+        return true;
+      }
+      out.resize(oldSize);
+    }
+  }
+#if DEBUG >= 3
+  std::cerr << "Shared memory reader could not keep up, skipping to the newest keyframe" << std::endl;
+#endif
+  uint64_t key = newestKey();
+  if (key == pos){
+    key = head->written;
+  }
+  pos = key;
+  return false;
+}
+
+/// Returns the sequence number of the newest keyframe still in the segment, or the live point if there is none.
+uint64_t Buffer::ShmReader::newestKey(){
+  uint64_t written = head->written;
+  uint64_t k = head->keys;
+  if (k){
+    uint64_t seq = keys[(k - 1) % SHM_KEYS].seq;
+    if (seq < written && written - seq < SHM_SLOTS){
+      return seq;
+    }
+  }
+  return written;
+}
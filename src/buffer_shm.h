@@ -0,0 +1,103 @@
+/// \file buffer_shm.h
+/// Contains definitions for publishing buffer packets through shared memory.
+
+#pragma once
+#include <string>
+#include <stdint.h>
+#include <mist/socket.h>
+
+/// Amount of packet slots in a shared memory segment.
+#define SHM_SLOTS 8192
+/// Amount of keyframe index entries in a shared memory segment.
+#define SHM_KEYS 1024
+/// Maximum size of the stream header in a shared memory segment.
+#define SHM_HEADER_SIZE (256 * 1024)
+
+namespace Buffer {
+  /// Layout of the start of a shared memory segment.
+  /// All positions are absolute and only ever increase; they are taken modulo the respective sizes.
+  struct ShmHead{
+    char magic[4]; ///< Always "MShm".
+    volatile uint32_t alive; ///< Set to zero when the buffer stops writing.
+    uint64_t dataSize; ///< Size of the packet data area in bytes.
+    volatile uint64_t written; ///< Sequence number of the next packet.
+    volatile uint64_t reserved; ///< Data position up to which bytes may currently be written to.
+    volatile uint64_t keys; ///< Amount of keyframes written to the index.
+    volatile uint64_t headerGen; ///< Header generation, odd while the header is being replaced.
+    volatile uint32_t headerLen; ///< Length of the header, zero if none is available.
+  };
+
+  /// Location of a single packet in a shared memory segment.
+  struct ShmSlot{
+    volatile uint64_t seq; ///< Sequence number of the packet in this slot.
+    uint64_t offset; ///< Data position of the packet.
+    uint32_t len; ///< Length of the packet in bytes.
+    uint32_t keyframe; ///< Nonzero if this packet is a video keyframe.
+    int64_t time; ///< Timestamp of the packet in milliseconds.
+  };
+
+  /// Keyframe index entry in a shared memory segment.
+  struct ShmKey{
+    volatile uint64_t seq; ///< Sequence number of the keyframe packet.
+    int64_t time; ///< Timestamp of the keyframe in milliseconds.
+  };
+
+  /// Returns the shared memory name used for the given stream.
+  std::string shmName(std::string streamname);
+
+  /// Publishes the packets of a stream in a named shared memory segment.
+  /// Only a single thread may write.
+  class ShmWriter{
+    public:
+      /// Creates the segment for the given stream, with a data area of the given size.
+      ShmWriter(std::string streamname, unsigned int megabytes);
+      /// Marks the segment as dead and removes it.
+      ~ShmWriter();
+      /// Returns true if the segment was created successfully.
+      bool connected();
+      /// Replaces the stream header. Headers too large for the segment make it unavailable.
+      void setHeader(const std::string & header);
+      /// Appends a packet to the segment.
+      void write(const std::string & packet, long long int time, bool keyframe);
+    private:
+      std::string name; ///< Name of the segment.
+      size_t mapSize; ///< Size of the mapping.
+      char * map; ///< The mapping itself, or null.
+      ShmHead * head; ///< Start of the segment.
+      char * header; ///< Header area.
+      ShmSlot * slots; ///< Packet slots.
+      ShmKey * keys; ///< Keyframe index.
+      char * data; ///< Packet data area.
+  };
+
+  /// Follows the packets of a stream through its shared memory segment, read-only.
+  /// Used by connectors instead of receiving packets over their buffer socket.
+  class ShmReader{
+    public:
+      ShmReader();
+      /// Unmaps the segment, if mapped.
+      ~ShmReader();
+      /// Maps the segment for the given stream. Returns false if it is not available.
+      bool open(std::string streamname);
+      /// Unmaps the segment, if mapped.
+      void close();
+      /// Returns true if a live segment is mapped.
+      bool connected();
+      /// Replacement for Socket::Connection::spool() on a buffer connection.
+      /// If a segment is mapped, discards anything received over the socket and appends new packets from
+      /// the segment to its receive buffer instead. Otherwise simply spools the socket.
+      bool spool(Socket::Connection & conn);
+    private:
+      bool readPacket(std::string & out);
+      uint64_t newestKey();
+      size_t mapSize; ///< Size of the mapping.
+      char * map; ///< The mapping itself, or null.
+      ShmHead * head; ///< Start of the segment.
+      char * header; ///< Header area.
+      ShmSlot * slots; ///< Packet slots.
+      ShmKey * keys; ///< Keyframe index.
+      char * data; ///< Packet data area.
+      uint64_t pos; ///< Sequence number of the next packet to read.
+      uint64_t headerGen; ///< Generation of the last header read.
+  };
+}
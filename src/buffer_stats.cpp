@@ -0,0 +1,341 @@
+/// \file buffer_stats.cpp
+/// Contains code for passing viewer statistics from connectors to the buffer through shared memory.
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mist/stream.h>
+#include <mist/timing.h>
+#include "buffer_stats.h"
+#include "buffer_user.h"
+
+#define STATS_SIZE(count) (sizeof(Buffer::StatsHead) + sizeof(Buffer::StatsSlot) * (count))
+#define STATS_SLOT(map, i) (((Buffer::StatsSlot *)((map) + sizeof(Buffer::StatsHead))) + (i))
+
+/// Returns the stats segment name used for the given stream.
+std::string Buffer::statsName(std::string streamname){
+  Util::Stream::sanitizeName(streamname);
+  return "/MstStat" + streamname;
+}
+
+/// Creates a segment for the given amount of viewers of the given stream, or none if zero.
+/// The segment is only accessible to the user and group of the buffer, so connectors must run as either.
+/// It is never cleared explicitly: a new segment reads as zeroes, and only the pages of used slots take memory.
+Buffer::StatsTable::StatsTable(std::string streamname, unsigned int count){
+  map = 0;
+  this->count = count;
+  slots = 0;
+  users = 0;
+  dropped = 0;
+  walked = 0;
+  name = statsName(streamname);
+  shm_unlink(name.c_str()); //remove leftovers of a previous buffer for this stream
+  if ( !count){
+    return;
+  }
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+  if (fd < 0){
+    perror("Could not create stats segment");
+    return;
+  }
+  fchmod(fd, 0660); //not limited by the umask
+  if (ftruncate(fd, STATS_SIZE(count)) < 0){
+    perror("Could not size stats segment");
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return;
+  }
+  void * mapped = mmap(0, STATS_SIZE(count), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED){
+    perror("Could not map stats segment");
+    shm_unlink(name.c_str());
+    return;
+  }
+  map = (char *)mapped;
+  slots = STATS_SLOT(map, 0);
+  users = new int[count];
+  dropped = new uint32_t[count];
+  for (unsigned int i = 0; i < count; i++){
+    users[i] = -1;
+    dropped[i] = 0;
+  }
+  StatsHead * head = (StatsHead *)map;
+  head->slots = count;
+  head->alive = 1;
+  __sync_synchronize();
+  memcpy(head->magic, "MSta", 4);
+}
+
+/// Marks the segment as dead and removes it.
+Buffer::StatsTable::~StatsTable(){
+  if ( !map){
+    return;
+  }
+  ((StatsHead *)map)->alive = 0;
+  munmap(map, STATS_SIZE(count));
+  shm_unlink(name.c_str());
+  delete[] users;
+  delete[] dropped;
+}
+
+/// Returns true if the segment was created successfully.
+bool Buffer::StatsTable::connected(){
+  return map != 0;
+}
+
+/// Links a claimed slot to the given user number. Returns false if the slot cannot be used.
+/// The next collect call notices the new user number and starts its speed calculation.
+bool Buffer::StatsTable::link(unsigned int slot, int userNum){
+  if ( !map || slot >= count || !__sync_bool_compare_and_swap( &slots[slot].state, 1, 2)){
+    return false;
+  }
+  dropped[slot] = 0;
+  __sync_synchronize();
+  users[slot] = userNum;
+  return true;
+}
+
+/// Reads the record in the given slot. Returns false if the slot is not linked.
+bool Buffer::StatsTable::read(unsigned int slot, Stats & out){
+  if ( !map || slot >= count || slots[slot].state != 2){
+    return false;
+  }
+  StatsSlot & s = slots[slot];
+  for (int tries = 0; tries < 100; tries++){
+    uint32_t gen = s.gen;
+    if (gen & 1){
+      continue;
+    }
+    __sync_synchronize();
+    out.conntime = s.conntime;
+    out.up = s.up;
+    out.down = s.down;
+    out.host = std::string(s.host, strnlen(s.host, sizeof(s.host)));
+    out.connector = std::string(s.connector, strnlen(s.connector, sizeof(s.connector)));
+    __sync_synchronize();
+    if (s.gen == gen){
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Frees a linked slot for reuse.
+/// The claim time is cleared before the slot is freed, so the next claim of it is never judged by an old time.
+void Buffer::StatsTable::release(unsigned int slot){
+  if ( !map || slot >= count){
+    return;
+  }
+  users[slot] = -1;
+  slots[slot].claimed = 0;
+  __sync_synchronize();
+  slots[slot].state = 0;
+}
+
+/// Walks all used slots once, computing current speeds of all linked slots and taking back stale claims.
+/// A connector stamps its claim only after claiming, so a claim without a time is stamped here instead, and
+/// only taken back once it is older than STATS_CLAIM_TIMEOUT.
+/// Adds the summed speeds of all linked slots to up and down.
+void Buffer::StatsTable::collect(long long int & up, long long int & down){
+  if ( !map){
+    return;
+  }
+  uint32_t now = Util::epoch();
+  walked = std::min((uint32_t)((StatsHead *)map)->used, (uint32_t)count);
+  if (seen.size() < walked){
+    seen.resize(walked, -1);
+    lastTime.resize(walked, 0);
+    lastUp.resize(walked, 0);
+    lastDown.resize(walked, 0);
+    speedUp.resize(walked, 0);
+    speedDown.resize(walked, 0);
+    fresh.resize(walked, 0);
+  }
+  for (unsigned int i = 0; i < walked; i++){
+    StatsSlot & s = slots[i];
+    uint32_t state = s.state;
+    int num = users[i];
+    if (num != seen[i]){
+      //linked to a new user, or released - start over
+      seen[i] = num;
+      fresh[i] = (num >= 0);
+      lastTime[i] = s.conntime;
+      lastUp[i] = s.up;
+      lastDown[i] = s.down;
+      speedUp[i] = 0;
+      speedDown[i] = 0;
+    }
+    if (state == 1){
+      uint32_t claimed = s.claimed;
+      if ( !claimed){
+        __sync_bool_compare_and_swap( &s.claimed, 0, now); //just claimed
+      }else if (now - claimed > STATS_CLAIM_TIMEOUT && __sync_bool_compare_and_swap( &s.state, 1, 3)){
+        //claimed, but never announced to us - hold it in a state link() refuses until the time is cleared
+        s.claimed = 0;
+        __sync_synchronize();
+        s.state = 0;
+      }
+      continue;
+    }
+    if (state != 2 || num < 0){
+      continue;
+    }
+    uint32_t gen = s.gen;
+    if (gen & 1){
+      continue; //being written - keep the previous speeds
+    }
+    __sync_synchronize();
+    uint32_t conntime = s.conntime;
+    uint32_t sent = s.up;
+    uint32_t received = s.down;
+    __sync_synchronize();
+    if (s.gen != gen){
+      continue;
+    }
+    if (conntime != lastTime[i]){
+      uint32_t secs = conntime - lastTime[i];
+      if (secs < 1){
+        secs = 1;
+      }
+      speedUp[i] = (sent - lastUp[i]) / secs;
+      speedDown[i] = (received - lastDown[i]) / secs;
+      lastTime[i] = conntime;
+      lastUp[i] = sent;
+      lastDown[i] = received;
+    }
+    up += speedUp[i];
+    down += speedDown[i];
+  }
+}
+
+/// Amount of slots walked by the last collect call.
+unsigned int Buffer::StatsTable::size(){
+  return walked;
+}
+
+/// User number the given slot is linked to, or -1 if not linked.
+int Buffer::StatsTable::userNum(unsigned int slot){
+  return users[slot];
+}
+
+/// Sets the amount of keyframe intervals the viewer in the given slot skipped, as counted by the buffer.
+void Buffer::StatsTable::setDropped(unsigned int slot, unsigned int gops){
+  if (map && slot < count){
+    dropped[slot] = gops;
+  }
+}
+
+/// Amount of keyframe intervals the viewer in the given slot skipped.
+unsigned int Buffer::StatsTable::getDropped(unsigned int slot){
+  return dropped[slot];
+}
+
+/// Returns true once after the given slot was linked, so its user can be reported before the next full report.
+bool Buffer::StatsTable::takeNew(unsigned int slot){
+  if ( !fresh[slot]){
+    return false;
+  }
+  fresh[slot] = 0;
+  return true;
+}
+
+Buffer::StatsWriter::StatsWriter(){
+  map = 0;
+  mapSize = 0;
+  slot = 0;
+  owner = 0;
+}
+
+/// Unmaps the segment, if mapped. The slot itself is freed by the buffer.
+Buffer::StatsWriter::~StatsWriter(){
+  close();
+}
+
+/// Claims a slot in the stats segment of the given stream, and announces it to the buffer over conn.
+/// Returns false if no slot could be claimed, in which case send() uses text lines.
+bool Buffer::StatsWriter::open(std::string streamname, Socket::Connection & conn){
+  close();
+  int fd = shm_open(statsName(streamname).c_str(), O_RDWR, 0);
+  if (fd < 0){
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size <= (off_t)STATS_SIZE(0) || (st.st_size - STATS_SIZE(0)) % sizeof(StatsSlot)){
+    ::close(fd);
+    return false;
+  }
+  unsigned int count = (st.st_size - STATS_SIZE(0)) / sizeof(StatsSlot);
+  void * mapped = mmap(0, STATS_SIZE(count), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED){
+    return false;
+  }
+  map = (char *)mapped;
+  mapSize = STATS_SIZE(count);
+  StatsHead * head = (StatsHead *)map;
+  if (memcmp(head->magic, "MSta", 4) != 0 || !head->alive || head->slots != count){
+    close();
+    return false;
+  }
+  //take the lowest free slot, so the buffer only walks as many slots as there were viewers at once
+  owner = getpid();
+  for (unsigned int num = 0; num < count; num++){
+    StatsSlot * s = STATS_SLOT(map, num);
+    if (s->state == 0 && __sync_bool_compare_and_swap( &s->state, 0, 1)){
+      s->claimed = Util::epoch();
+      s->owner = owner;
+      slot = s;
+      uint32_t used = head->used;
+      while (used <= num && !__sync_bool_compare_and_swap( &head->used, used, num + 1)){
+        used = head->used;
+      }
+      std::stringstream st;
+      st << "B " << num << "\n";
+      conn.SendNow(st.str());
+      return true;
+    }
+  }
+  close();
+  return false;
+}
+
+/// Unmaps the segment, if mapped.
+void Buffer::StatsWriter::close(){
+  if (map){
+    munmap(map, mapSize);
+    map = 0;
+    slot = 0;
+  }
+}
+
+/// Publishes the current statistics of a viewer, either in the claimed slot or as a text line over conn.
+/// Once the buffer stopped using the segment, freed the slot or it was claimed by someone else, text lines are used again.
+void Buffer::StatsWriter::send(Socket::Connection & conn, std::string host, std::string connector, unsigned int conntime,
+    unsigned int up, unsigned int down){
+  if (map && ( !((StatsHead *)map)->alive || slot->state == 0 || slot->state == 3 || slot->owner != owner)){
+    close();
+  }
+  if ( !map){
+    std::stringstream st;
+    st << "S " << host << " " << connector << " " << conntime << " " << up << " " << down << "\n";
+    conn.SendNow(st.str());
+    return;
+  }
+  slot->gen++;
+  __sync_synchronize();
+  slot->conntime = conntime;
+  slot->up = up;
+  slot->down = down;
+  strncpy(slot->host, host.c_str(), sizeof(slot->host) - 1);
+  slot->host[sizeof(slot->host) - 1] = 0;
+  strncpy(slot->connector, connector.c_str(), sizeof(slot->connector) - 1);
+  slot->connector[sizeof(slot->connector) - 1] = 0;
+  __sync_synchronize();
+  slot->gen++;
+}
@@ -0,0 +1,110 @@
+/// \file buffer_stats.h
+/// Contains definitions for passing viewer statistics from connectors to the buffer through shared memory.
+
+#pragma once
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <mist/socket.h>
+
+/// Seconds a claimed slot may stay unannounced to the buffer before it is taken back.
+#define STATS_CLAIM_TIMEOUT 10
+
+namespace Buffer {
+  /// Layout of the start of a stats segment.
+  struct StatsHead{
+    char magic[4]; ///< Always "MSta".
+    volatile uint32_t alive; ///< Set to zero when the buffer stops reading.
+    uint32_t slots; ///< Amount of slots in this segment.
+    volatile uint32_t used; ///< One more than the highest slot ever claimed, only raised atomically by connectors.
+  };
+
+  /// Fixed-size statistics record of a single viewer.
+  /// Written by one connector, read by the buffer. The generation is odd while the record is being written.
+  struct StatsSlot{
+    volatile uint32_t state; ///< 0 when free, 1 when claimed by a connector, 2 once the buffer linked it to a user, 3 while being taken back.
+    volatile uint32_t gen; ///< Record generation, odd while the record is being written.
+    volatile uint32_t claimed; ///< Time the slot was claimed, in seconds since the epoch. Zero if not stamped yet.
+    volatile uint32_t owner; ///< Process ID of the connector that claimed the slot.
+    uint32_t conntime; ///< Seconds the viewer has been connected.
+    uint32_t up; ///< Total bytes sent to the viewer.
+    uint32_t down; ///< Total bytes received from the viewer.
+    char host[64]; ///< Address of the viewer, zero terminated.
+    char connector[24]; ///< Name of the connector, zero terminated.
+  };
+
+  /// Returns the stats segment name used for the given stream.
+  std::string statsName(std::string streamname);
+
+  class Stats;
+
+  /// Buffer side of a stats segment: creates it and reads the records.
+  /// Also keeps per-slot speed calculations, local to the buffer process. Connectors claim the lowest free slot,
+  /// so walks over the slots stop at the highest slot ever claimed, and the local state only grows that far.
+  /// Slots are linked, released and given dropped counts by any thread; everything else is owned by the single
+  /// thread calling collect.
+  class StatsTable{
+    public:
+      /// Creates a segment for the given amount of viewers of the given stream, or none if zero.
+      StatsTable(std::string streamname, unsigned int count);
+      /// Marks the segment as dead and removes it.
+      ~StatsTable();
+      /// Returns true if the segment was created successfully.
+      bool connected();
+      /// Links a claimed slot to the given user number. Returns false if the slot cannot be used.
+      bool link(unsigned int slot, int userNum);
+      /// Reads the record in the given slot. Returns false if the slot is not linked.
+      bool read(unsigned int slot, Stats & out);
+      /// Frees a linked slot for reuse.
+      void release(unsigned int slot);
+      /// Walks all used slots once, computing current speeds of all linked slots and taking back stale claims.
+      void collect(long long int & up, long long int & down);
+      /// Amount of slots walked by the last collect call.
+      unsigned int size();
+      /// User number the given slot is linked to, or -1 if not linked.
+      int userNum(unsigned int slot);
+      /// Sets the amount of keyframe intervals the viewer in the given slot skipped, as counted by the buffer.
+      void setDropped(unsigned int slot, unsigned int gops);
+      /// Amount of keyframe intervals the viewer in the given slot skipped.
+      unsigned int getDropped(unsigned int slot);
+      /// Returns true once after the given slot was linked, so its user can be reported before the next full report.
+      bool takeNew(unsigned int slot);
+    private:
+      std::string name; ///< Name of the segment.
+      char * map; ///< Start of the mapped segment, null if not available.
+      unsigned int count; ///< Amount of slots, as created.
+      StatsSlot * slots; ///< All slots.
+      volatile int * users; ///< User number of each linked slot, -1 if not linked.
+      volatile uint32_t * dropped; ///< Keyframe intervals skipped, per slot.
+      unsigned int walked; ///< Amount of slots walked by the last collect call.
+      std::vector<int> seen; ///< User number of each slot as of the previous collect call.
+      std::vector<uint32_t> lastTime; ///< Connection time at the previous collect call, per slot.
+      std::vector<uint32_t> lastUp; ///< Bytes sent at the previous collect call, per slot.
+      std::vector<uint32_t> lastDown; ///< Bytes received at the previous collect call, per slot.
+      std::vector<uint32_t> speedUp; ///< Current upload speed, per slot.
+      std::vector<uint32_t> speedDown; ///< Current download speed, per slot.
+      std::vector<char> fresh; ///< Set when collect finds a slot newly linked, cleared by takeNew.
+  };
+
+  /// Connector side of a stats segment: claims a slot and keeps its record up to date.
+  /// Falls back to sending text stats lines over the buffer connection if no slot is available.
+  class StatsWriter{
+    public:
+      StatsWriter();
+      /// Unmaps the segment, if mapped. The slot itself is freed by the buffer.
+      ~StatsWriter();
+      /// Claims a slot in the stats segment of the given stream, and announces it to the buffer over conn.
+      /// Returns false if no slot could be claimed, in which case send() uses text lines.
+      bool open(std::string streamname, Socket::Connection & conn);
+      /// Unmaps the segment, if mapped.
+      void close();
+      /// Publishes the current statistics of a viewer, either in the claimed slot or as a text line over conn.
+      void send(Socket::Connection & conn, std::string host, std::string connector, unsigned int conntime, unsigned int up,
+          unsigned int down);
+    private:
+      char * map; ///< Start of the mapped segment, null if not available.
+      size_t mapSize; ///< Size of the mapped segment.
+      StatsSlot * slot; ///< Claimed slot.
+      uint32_t owner; ///< Process ID written to the claimed slot.
+  };
+}
@@ -1,94 +1,272 @@
 /// \file buffer_stream.cpp
 /// Contains definitions for buffer streams.
 
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
 #include "buffer_stream.h"
+#include "buffer_fanout.h"
 #include <mist/timing.h>
 
-/// Stores the globally equal reference.
-Buffer::Stream * Buffer::Stream::ref = 0;
-
-/// Returns a globally equal reference to this class.
-Buffer::Stream * Buffer::Stream::get(){
-  static tthread::mutex creator;
-  if (ref == 0){
-    //prevent creating two at the same time
-    creator.lock();
-    if (ref == 0){
-      ref = new Stream();
-    }
-    creator.unlock();
+/// Creates a new stream with the given name.
+Buffer::Stream::Stream(std::string name){
+  this->name = name;
+  Strm = new DTSC::Stream(1);
+  ring = new PacketRing(BUFFER_RING_SIZE);
+  shm = 0;
+  recorder = 0;
+  statsTable = new StatsTable(name, 0);
+  burst = 0;
+  firstFrames = 0;
+  firstFrameTotal = 0;
+  firstFrameMax = 0;
+  firstFrameLast = 0;
+  released = 0;
+  headerSent = false;
+  for (unsigned int i = 0; i < RING_MAX_READERS; i++){
+    workerUsers[i] = 0;
   }
-  return ref;
-}
-
-/// Creates a new DTSC::Stream object, private function so only one instance can exist.
-Buffer::Stream::Stream(){
-  Strm = new DTSC::Stream(5);
-  readers = 0;
-  writers = 0;
+  activeInput = 0;
+  failover = PUSH_FAILOVER;
+  lastPublished = -1;
+  lastPublishedMS = 0;
+  metaVersion = 0;
+  sentMetaVersion = 0;
+  fullStats = true;
+  lastFullStats = 0;
+  totalUp = 0;
+  totalDown = 0;
+  totalDropped = 0;
 }
 
 /// Do cleanup on delete.
+/// Users still held by a worker have their socket shut down, so their worker disconnects and releases them.
+/// Waits until all users were released.
 Buffer::Stream::~Stream(){
-  while (users.size() > 0){
-    stats_mutex.lock();
-    for (usersIt = users.begin(); usersIt != users.end(); usersIt++){
-      if (( * *usersIt).S.connected()){
-        ( * *usersIt).S.close();
-        printf("Closing user %s\n", ( * *usersIt).MyStr.c_str());
-      }
+  users_mutex.lock();
+  for (unsigned int i = 0; i < users.slots(); i++){
+    user * usr = users.at(i);
+    if (usr && usr->myWorker && usr->S.connected()){
+      shutdown(usr->S.getSocket(), SHUT_RDWR);
+      printf("Closing user %s\n", usr->MyStr.c_str());
     }
-    stats_mutex.unlock();
-    moreData.notify_all();
+  }
+  users_mutex.unlock();
+  cleanUsers();
+  while (users.size() > 0){
+    usleep(10000);
     cleanUsers();
   }
+  while ( !inputs.empty()){
+    delete inputs.back();
+    inputs.pop_back();
+  }
+  delete ring;
+  delete statsTable;
+  if (shm){
+    delete shm;
+  }
+  if (recorder){
+    delete recorder;
+  }
   delete Strm;
 }
 
-/// Calculate and return the current statistics in JSON format.
+/// Returns the name of this stream.
+std::string & Buffer::Stream::getName(){
+  return name;
+}
+
+/// Get the statistics that changed since the last call in JSON format.
+/// Metadata is only included when it changed, and users only with the fields that changed, marked by "delta".
+/// Users that disconnected are listed in "gone". Every BUFFER_STATS_FULL seconds, or after resetStats(),
+/// everything is reported instead, without the "delta" marker. The result is serialized without holding any locks.
+/// Users reporting through the stats table are only read into the JSON tree once after linking and on full
+/// reports; in between, their traffic only counts towards the totals.
 std::string & Buffer::Stream::getStats(){
   static std::string ret;
+  JSON::Value out;
   long long int now = Util::epoch();
-  unsigned int tot_up = 0, tot_down = 0, tot_count = 0;
+  //the totals are kept up to date as users come, go and report, so users are never walked here
+  //users reporting through the stats table are summed in a single pass over its flat array of slots
+  long long int tableUp = 0, tableDown = 0;
+  statsTable->collect(tableUp, tableDown);
   stats_mutex.lock();
-  if (users.size() > 0){
-    for (usersIt = users.begin(); usersIt != users.end(); usersIt++){
-      tot_down += ( * *usersIt).curr_down;
-      tot_up += ( * *usersIt).curr_up;
-      tot_count++;
-    }
-  }
-  Storage["totals"]["down"] = tot_down;
-  Storage["totals"]["up"] = tot_up;
-  Storage["totals"]["count"] = tot_count;
-  Storage["totals"]["now"] = now;
-  Storage["buffer"] = name;
-  Storage["meta"] = Strm->metadata;
-  if (Storage["meta"].isMember("audio")){
-    Storage["meta"]["audio"].removeMember("init");
-  }
-  if (Storage["meta"].isMember("video")){
-    Storage["meta"]["video"].removeMember("init");
-  }
-  ret = Storage.toString();
+  if (now - lastFullStats >= BUFFER_STATS_FULL){
+    fullStats = true;
+  }
+  for (unsigned int i = 0; i < statsTable->size(); i++){
+    int num = statsTable->userNum(i);
+    if (num < 0 || ( !statsTable->takeNew(i) && !fullStats)){
+      continue;
+    }
+    Stats slotStats;
+    if (statsTable->read(i, slotStats)){
+      slotStats.dropped = statsTable->getDropped(i);
+      std::string username = JSON::Value((long long int)num).asString();
+      storeStats(Storage["curr"][username], slotStats);
+      changedUsers.insert(username);
+    }
+  }
+  if (fullStats){
+    out["curr"] = Storage["curr"];
+    sentUsers = Storage["curr"];
+    lastFullStats = now;
+  }else{
+    out["delta"] = 1LL;
+    for (std::set<std::string>::iterator it = changedUsers.begin(); it != changedUsers.end(); it++){
+      JSON::Value & curr = Storage["curr"][ *it];
+      JSON::Value & sent = sentUsers[ *it];
+      for (JSON::ObjIter fit = curr.ObjBegin(); fit != curr.ObjEnd(); fit++){
+        if ( !sent.isMember(fit->first) || sent[fit->first] != fit->second){
+          out["curr"][ *it][fit->first] = fit->second;
+        }
+      }
+      sent = curr;
+    }
+    for (std::set<std::string>::iterator it = goneUsers.begin(); it != goneUsers.end(); it++){
+      out["gone"].append( *it);
+      sentUsers.removeMember( *it);
+    }
+  }
+  changedUsers.clear();
+  goneUsers.clear();
+  out["log"] = Storage["log"];
   Storage["log"].null();
+  if (firstFrames){
+    out["ttff"]["count"] = (long long int)firstFrames;
+    out["ttff"]["avg"] = firstFrameTotal / (long long int)firstFrames;
+    out["ttff"]["max"] = firstFrameMax;
+    out["ttff"]["last"] = firstFrameLast;
+  }
   stats_mutex.unlock();
+  out["totals"]["down"] = (long long int)totalDown + tableDown;
+  out["totals"]["up"] = (long long int)totalUp + tableUp;
+  out["totals"]["count"] = (long long int)users.size();
+  out["totals"]["dropped"] = (long long int)totalDropped;
+  out["totals"]["now"] = now;
+  out["buffer"] = name;
+  if (pacer.active()){
+    out["ingest"]["lag"] = pacer.getLag();
+    out["ingest"]["jitter"] = pacer.getJitter();
+    out["ingest"]["fast"] = pacer.isFast() ? 1LL : 0LL;
+  }
+  meta_mutex.lock();
+  if (fullStats || metaVersion != sentMetaVersion){
+    out["meta"] = metadata;
+    sentMetaVersion = metaVersion;
+  }
+  meta_mutex.unlock();
+  fullStats = false;
+  ret = out.toString();
   return ret;
 }
 
-/// Get a new DTSC::Ring object for a user.
-DTSC::Ring * Buffer::Stream::getRing(){
-  return Strm->getRing();
+/// Makes the next getStats call report everything, for a newly connected controller.
+void Buffer::Stream::resetStats(){
+  stats_mutex.lock();
+  fullStats = true;
+  stats_mutex.unlock();
+}
+
+/// Returns the shared memory table connectors write viewer statistics to.
+Buffer::StatsTable & Buffer::Stream::getStatsTable(){
+  return *statsTable;
+}
+
+/// Returns the pacer for input read from standard input, for use by the ingest thread only.
+Buffer::Pacer & Buffer::Stream::getPacer(){
+  return pacer;
+}
+
+/// Get the ring of packets users read from.
+Buffer::PacketRing * Buffer::Stream::getPackets(){
+  return ring;
 }
 
-/// Drop a DTSC::Ring object.
-void Buffer::Stream::dropRing(DTSC::Ring * ring){
-  Strm->dropRing(ring);
+/// Publishes the newest parsed packet to all users.
+/// Must be called by the ingest thread after every successfully parsed packet.
+/// The header is re-checked at the first packet and at every keyframe, which is where new users start.
+/// The header also lists the times and numbers of all keyframes available for seeking as keytime and keynum.
+void Buffer::Stream::publishPacket(){
+  std::string & packet = Strm->outPacket(0);
+  publishPacket(packet.data(), packet.size(), true);
 }
 
-/// Get the (constant) header data of this stream.
-std::string & Buffer::Stream::getHeader(){
-  return Strm->outHeader();
+/// Publishes the newest parsed packet, using the raw DTSC bytes it was parsed from.
+/// The bytes are sent out as they are, so the packet is never serialized again.
+/// Users are only woken if notify is set, so a batch of packets can be followed by a single Fanout::wake call.
+void Buffer::Stream::publishPacket(const char * data, unsigned int len, bool notify){
+  publishPacket( *Strm, data, len, notify);
+}
+
+/// Publishes the newest packet parsed by the given parser, using the raw DTSC bytes it was parsed from.
+/// The header is built from the metadata of that same parser, plus the keyframe lists of the ring for seeking.
+/// The keyframe lists are kept up to date a keyframe at a time. Only the ring header carries them: the shared
+/// memory segment, the recording and the statistics get the metadata alone, and only when it changed.
+void Buffer::Stream::publishPacket(DTSC::Stream & src, const char * data, unsigned int len, bool notify){
+  bool isKey = src.getPacket(0).isMember("keyframe");
+  long long int time = src.getPacket(0)["time"].asInt();
+  if (isKey || !headerSent){
+    JSON::Value meta = src.metadata;
+    meta.removeMember("keytime");
+    meta.removeMember("keynum");
+    bool changed = ( !headerSent || meta != plainMeta);
+    if (changed){
+      JSON::Value old = header;
+      header = meta;
+      if (old.isMember("keytime")){
+        header["keytime"] = old["keytime"];
+        header["keynum"] = old["keynum"];
+      }
+      plainMeta = meta;
+    }
+    if (isKey){
+      header["keytime"].append(time);
+      header["keynum"].append((long long int)ring->keyEnd());
+    }
+    if (header.isMember("keytime")){
+      //forget keyframes the ring dropped, the new one is not in the ring yet
+      unsigned int held = ring->keyEnd() - ring->keyBegin() + (isKey ? 1 : 0);
+      header["keytime"].shrink(held);
+      header["keynum"].shrink(held);
+    }
+    headerSent = true;
+    ring->setHeader(new Packet(header.toNetPacked(), 0, false));
+    if (changed){
+      if (shm){
+        shm->setHeader(meta.toNetPacked());
+      }
+      if (recorder){
+        recorder->setMeta(meta);
+      }
+      //statistics only carry the metadata without keyframe lists and init data, reported only when it changes
+      JSON::Value statMeta = meta;
+      if (statMeta.isMember("audio")){
+        statMeta["audio"].removeMember("init");
+      }
+      if (statMeta.isMember("video")){
+        statMeta["video"].removeMember("init");
+      }
+      meta_mutex.lock();
+      if (statMeta != metadata){
+        metadata = statMeta;
+        metaVersion++;
+      }
+      meta_mutex.unlock();
+    }
+  }
+  Packet * p = new Packet(data, len, time, isKey);
+  if (shm){
+    shm->write(p->data, p->time, p->keyframe);
+  }
+  if (recorder){
+    recorder->write(p->data.data(), p->data.size(), time, isKey, src.getPacket(0)["datatype"].asString() == "video");
+  }
+  ring->push(p);
+  if (notify){
+    Fanout::wake(this);
+  }
 }
 
 /// Set the IP address to accept push data from.
@@ -106,30 +284,121 @@ bool Buffer::Stream::checkWaitingIP(std::string ip){
   }
 }
 
-/// Sets the current socket for push data.
+/// Adds a socket for push data, as the active input if there is none yet, otherwise as a backup.
+/// Returns false if the stream already has PUSH_MAX_INPUTS push inputs.
 bool Buffer::Stream::setInput(Socket::Connection S){
-  if (ip_input.connected()){
+  input_mutex.lock();
+  if (inputs.size() >= PUSH_MAX_INPUTS){
+    input_mutex.unlock();
     return false;
+  }
+  inputs.push_back(new PushSource(S));
+  input_mutex.unlock();
+  uint64_t one = 1;
+  if (write(inputEvents(), &one, sizeof(one)) < 0){
+    //EAGAIN means the counter is saturated, which wakes the push input thread just as well
+  }
+  return true;
+}
+
+/// Gets all current push inputs, for use by the push input thread only.
+void Buffer::Stream::getInputs(std::vector<PushSource*> & list){
+  input_mutex.lock();
+  list = inputs;
+  input_mutex.unlock();
+}
+
+/// Publishes the packet just parsed by the given push input, if it is the active one or should take over.
+/// Backups only have their timestamps tracked. While there is no active input, the first input to deliver a
+/// keyframe (or any packet, for streams without video) takes over. Its timestamps are shifted if needed, so
+/// the published timestamps keep increasing in step with real time. Returns true if the packet was published.
+bool Buffer::Stream::ingest(PushSource * src, const char * data, unsigned int len){
+  DTSC::Stream & parser = *(src->parser);
+  long long int now = Util::getMS();
+  long long int time = parser.getPacket(0)["time"].asInt();
+  src->lastData = now;
+  src->lastTime = time;
+  if (src != activeInput){
+    if (activeInput || ( !parser.getPacket(0).isMember("keyframe") && parser.metadata.isMember("video"))){
+      return false;
+    }
+    long long int gap = now - lastPublishedMS;
+    if (gap < 1){
+      gap = 1;
+    }
+    if (lastPublished < 0 || (time > lastPublished && time <= lastPublished + gap + 1000)){
+      src->offset = 0; //timestamps already continue where the previous input left off
+    }else{
+      src->offset = lastPublished + gap - time;
+    }
+    activeInput = src;
+    std::cout << "Stream " << name << " now publishing push input from " << src->conn.getHost() << ", timestamp offset "
+        << src->offset << std::endl;
+  }
+  if (src->offset){
+    parser.getPacket(0)["time"] = time + src->offset;
+    std::string & packet = parser.outPacket(0);
+    publishPacket(parser, packet.data(), packet.size(), false);
   }else{
-    ip_input = S;
-    return true;
+    publishPacket(parser, data, len, false);
+  }
+  lastPublished = time + src->offset;
+  lastPublishedMS = now;
+  return true;
+}
+
+/// Removes and deletes a push input whose connection closed.
+/// If it was the active input, the first backup to deliver a keyframe takes over.
+void Buffer::Stream::removeInput(PushSource * src){
+  if (src == activeInput){
+    activeInput = 0;
+  }
+  input_mutex.lock();
+  for (std::vector<PushSource*>::iterator it = inputs.begin(); it != inputs.end(); it++){
+    if ( *it == src){
+      inputs.erase(it);
+      break;
+    }
   }
+  input_mutex.unlock();
+  delete src;
+}
+
+/// Gives up on the active push input if it stalled while a backup is still receiving data.
+/// The first input to deliver a keyframe after this takes over, which may be the stalled one once it recovers.
+void Buffer::Stream::checkInputs(long long int now){
+  if ( !activeInput || now - activeInput->lastData <= failover){
+    return;
+  }
+  input_mutex.lock();
+  for (std::vector<PushSource*>::iterator it = inputs.begin(); it != inputs.end(); it++){
+    if ( *it != activeInput && now - ( *it)->lastData <= failover){
+      std::cout << "Push input of stream " << name << " from " << activeInput->conn.getHost() << " stalled, switching to a backup"
+          << std::endl;
+      activeInput = 0;
+      break;
+    }
+  }
+  input_mutex.unlock();
+}
+
+/// Sets how many milliseconds the active push input may stall before a backup takes over.
+void Buffer::Stream::setFailover(unsigned int ms){
+  failover = ms;
 }
 
-/// Gets the current socket for push data.
-Socket::Connection & Buffer::Stream::getIPInput(){
-  return ip_input;
+/// Returns a descriptor that becomes readable whenever any stream got a new socket for push data.
+/// The push input thread waits on it, so it starts reading new pushes right away.
+int Buffer::Stream::inputEvents(){
+  static int events = eventfd(0, EFD_NONBLOCK);
+  return events;
 }
 
 /// Stores intermediate statistics.
 void Buffer::Stream::saveStats(std::string username, Stats & stats){
   stats_mutex.lock();
-  Storage["curr"][username]["connector"] = stats.connector;
-  Storage["curr"][username]["up"] = stats.up;
-  Storage["curr"][username]["down"] = stats.down;
-  Storage["curr"][username]["conntime"] = stats.conntime;
-  Storage["curr"][username]["host"] = stats.host;
-  Storage["curr"][username]["start"] = Util::epoch() - stats.conntime;
+  storeStats(Storage["curr"][username], stats);
+  changedUsers.insert(username);
   stats_mutex.unlock();
 }
 
@@ -138,107 +407,173 @@ void Buffer::Stream::clearStats(std::string username, Stats & stats, std::string
   stats_mutex.lock();
   if (Storage["curr"].isMember(username)){
     Storage["curr"].removeMember(username);
+    changedUsers.erase(username);
+    if (sentUsers.isMember(username)){
+      goneUsers.insert(username);
+    }
 #if DEBUG >= 4
     std::cout << "Disconnected user " << username << ": " << reason << ". " << stats.connector << " transferred " << stats.up << " up and "
         << stats.down << " down in " << stats.conntime << " seconds to " << stats.host << std::endl;
 #endif
   }
-  Storage["log"][username]["connector"] = stats.connector;
-  Storage["log"][username]["up"] = stats.up;
-  Storage["log"][username]["down"] = stats.down;
-  Storage["log"][username]["conntime"] = stats.conntime;
-  Storage["log"][username]["host"] = stats.host;
-  Storage["log"][username]["start"] = Util::epoch() - stats.conntime;
+  storeStats(Storage["log"][username], stats);
   stats_mutex.unlock();
 }
 
-/// Cleans up broken connections
+/// Writes the given statistics to an entry of the curr or log lists.
+void Buffer::Stream::storeStats(JSON::Value & entry, Stats & stats){
+  entry["connector"] = stats.connector;
+  entry["up"] = stats.up;
+  entry["down"] = stats.down;
+  entry["conntime"] = stats.conntime;
+  entry["dropped"] = stats.dropped;
+  entry["host"] = stats.host;
+  entry["start"] = Util::epoch() - stats.conntime;
+}
+
+/// Deletes all users released by their worker since the last call.
+/// Takes time proportional to the amount of released users only, and holds the users mutex for one removal at a time.
 void Buffer::Stream::cleanUsers(){
-  bool repeat = false;
-  stats_mutex.lock();
-  do{
-    repeat = false;
-    if (users.size() > 0){
-      for (usersIt = users.begin(); usersIt != users.end(); usersIt++){
-        if (( * *usersIt).Thread == 0 && !( * *usersIt).S.connected()){
-          delete *usersIt;
-          users.erase(usersIt);
-          repeat = true;
-          break;
-        }else{
-          if ( !( * *usersIt).S.connected()){
-            if (( * *usersIt).Thread->joinable()){
-              ( * *usersIt).Thread->join();
-              delete ( * *usersIt).Thread;
-              ( * *usersIt).Thread = 0;
-            }
-          }
-        }
-      }
+  user * usr = __sync_lock_test_and_set( &released, (user *)0);
+  while (usr){
+    user * next = usr->nextReleased;
+    users_mutex.lock();
+    users.remove(usr);
+    users_mutex.unlock();
+    if (usr->statSlot >= 0){
+      statsTable->release(usr->statSlot);
     }
-  }while (repeat);
-  stats_mutex.unlock();
+    countTraffic( -(long long int)usr->curr_up, -(long long int)usr->curr_down);
+    countDropped( -(long long int)usr->droppedGops);
+    delete usr;
+    usr = next;
+  }
 }
 
-/// Blocks until writing is safe.
-void Buffer::Stream::getWriteLock(){
-  rw_mutex.lock();
-  writers++;
-  while (writers != 1 && readers != 0){
-    rw_change.wait(rw_mutex);
-  }
-  rw_mutex.unlock();
+/// Hands a user that is no longer served by any worker over for deletion. Never blocks.
+/// The user is deleted by the next cleanUsers call.
+void Buffer::Stream::releaseUser(user * usr){
+  user * head;
+  do{
+    head = released;
+    usr->nextReleased = head;
+  }while ( !__sync_bool_compare_and_swap( &released, head, usr));
 }
 
-/// Drops a previously gotten write lock.
-void Buffer::Stream::dropWriteLock(bool newpackets_available){
-  rw_mutex.lock();
-  writers--;
-  rw_mutex.unlock();
-  rw_change.notify_all();
-  if (newpackets_available){
-    moreData.notify_all();
-  }
+/// Changes the amount of users of this stream served by the worker with the given number.
+/// Called by the worker when it is handed a user and when it releases one.
+void Buffer::Stream::countWorkerUsers(int worker, int change){
+  __sync_fetch_and_add( &workerUsers[worker], change);
 }
 
-/// Blocks until reading is safe.
-void Buffer::Stream::getReadLock(){
-  rw_mutex.lock();
-  while (writers > 0){
-    rw_change.wait(rw_mutex);
-  }
-  readers++;
-  rw_mutex.unlock();
+/// Returns true if the worker with the given number serves any users of this stream.
+bool Buffer::Stream::servedBy(int worker){
+  return workerUsers[worker] != 0;
 }
 
-/// Drops a previously gotten read lock.
-void Buffer::Stream::dropReadLock(){
-  rw_mutex.lock();
-  readers--;
-  rw_mutex.unlock();
-  rw_change.notify_all();
+/// Adds to the summed transfer speeds of all users.
+void Buffer::Stream::countTraffic(long long int up, long long int down){
+  __sync_add_and_fetch( &totalUp, up);
+  __sync_add_and_fetch( &totalDown, down);
 }
 
-/// Retrieves a reference to the DTSC::Stream
+/// Adds to the summed amount of keyframe intervals skipped by all users.
+void Buffer::Stream::countDropped(long long int gops){
+  __sync_add_and_fetch( &totalDropped, gops);
+}
+
+/// Retrieves a reference to the DTSC::Stream, for use by the ingest thread only.
 DTSC::Stream * Buffer::Stream::getStream(){
   return Strm;
 }
 
-/// Sets the buffer name.
-void Buffer::Stream::setName(std::string n){
-  name = n;
+/// Sets the amount of seconds and megabytes of packets to keep available for seeking.
+/// Zero seconds keeps as much as the size limit allows, in a ring of BUFFER_RING_MAX packets; zero megabytes is unlimited.
+/// Must be called before any users are served or packets are published.
+void Buffer::Stream::setWindow(unsigned int seconds, unsigned int megabytes){
+  unsigned int size = seconds * BUFFER_PACKET_RATE;
+  if (seconds == 0){
+    size = BUFFER_RING_MAX; //as much as possible, within the size limit
+  }
+  if (size < BUFFER_RING_SIZE){
+    size = BUFFER_RING_SIZE;
+  }
+  delete ring;
+  ring = new PacketRing(size);
+  ring->setWindow(seconds * 1000, (unsigned long long)megabytes * 1024 * 1024);
 }
 
-/// Add a user to the userlist.
-void Buffer::Stream::addUser(user * new_user){
-  stats_mutex.lock();
-  users.push_back(new_user);
-  stats_mutex.unlock();
+/// Sets how many times faster than real-time new users may catch up with the live point, zero for unlimited.
+void Buffer::Stream::setBurst(unsigned int speed){
+  burst = speed;
 }
 
-/// Blocks the thread until new data is available.
-void Buffer::Stream::waitForData(){
+/// Returns how many times faster than real-time new users may catch up with the live point.
+unsigned int Buffer::Stream::getBurst(){
+  return burst;
+}
+
+/// Sets the limits on how far behind the live point users may fall.
+void Buffer::Stream::setPolicy(unsigned int maxTime, unsigned long long maxBytes, unsigned int kickTime){
+  policy.maxTime = maxTime;
+  policy.maxBytes = maxBytes;
+  policy.kickTime = kickTime;
+}
+
+/// Returns the limits on how far behind the live point users may fall.
+Buffer::QueuePolicy & Buffer::Stream::getPolicy(){
+  return policy;
+}
+
+/// Stores the time it took for a user to receive its first packet.
+/// Reported in the statistics as ttff.
+void Buffer::Stream::saveFirstFrame(long long int ms){
   stats_mutex.lock();
-  moreData.wait(stats_mutex);
+  firstFrames++;
+  firstFrameTotal += ms;
+  if (ms > firstFrameMax){
+    firstFrameMax = ms;
+  }
+  firstFrameLast = ms;
   stats_mutex.unlock();
 }
+
+/// Also publishes packets in a shared memory segment of the given size, for local connectors.
+/// Must be called before any packets are published.
+void Buffer::Stream::openShm(unsigned int megabytes){
+  if (shm || !megabytes){
+    return;
+  }
+  shm = new ShmWriter(name, megabytes);
+  if ( !shm->connected()){
+    delete shm;
+    shm = 0;
+  }
+}
+
+/// Also records all packets to the given DTSC file, until the stream is deleted.
+/// An empty filename disables recording.
+void Buffer::Stream::record(std::string filename){
+  if (recorder || filename == ""){
+    return;
+  }
+  recorder = new Recorder(filename);
+  if ( !recorder->connected()){
+    delete recorder;
+    recorder = 0;
+  }
+}
+
+/// Lets up to the given amount of viewers report statistics through shared memory, or none if zero.
+/// Viewers beyond that report over their connection instead. Must be called before any users connect.
+void Buffer::Stream::openStats(unsigned int viewers){
+  delete statsTable;
+  statsTable = new StatsTable(name, viewers);
+}
+
+/// Add a user to the userlist.
+void Buffer::Stream::addUser(user * new_user){
+  users_mutex.lock();
+  users.add(new_user);
+  users_mutex.unlock();
+}
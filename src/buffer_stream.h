@@ -3,74 +3,155 @@
 
 #pragma once
 #include <string>
+#include <set>
 #include <mist/dtsc.h>
 #include <mist/json.h>
 #include <mist/socket.h>
 #include "tinythread.h"
 #include "buffer_user.h"
+#include "buffer_ring.h"
+#include "buffer_shm.h"
+#include "buffer_pacer.h"
+#include "buffer_registry.h"
+#include "buffer_stats.h"
+#include "buffer_push.h"
+#include "buffer_recorder.h"
+
+/// Seconds between complete statistics reports, in between only changes are reported.
+#define BUFFER_STATS_FULL 30
+/// Minimum amount of packets kept in the ring for users to read.
+#define BUFFER_RING_SIZE 1024
+/// Amount of packets kept in the ring when the DVR window is not limited in time, but only in size.
+#define BUFFER_RING_MAX (256 * 1024)
+/// Highest expected amount of packets per second, used to size the ring for the DVR window.
+#define BUFFER_PACKET_RATE 200
 
 namespace Buffer {
   /// Keeps track of a single streams inputs and outputs, taking care of thread safety and all other related issues.
+  /// A single buffer process may hold any amount of these, each fully independent of the others.
   class Stream{
     public:
-      /// Get a reference to this Stream object.
-      static Stream * get();
-      /// Get the current statistics in JSON format.
+      /// Creates a new stream with the given name.
+      Stream(std::string name);
+      /// Returns the name of this stream.
+      std::string & getName();
+      /// Get the statistics that changed since the last call in JSON format.
       std::string & getStats();
-      /// Get a new DTSC::Ring object for a user.
-      DTSC::Ring * getRing();
-      /// Drop a DTSC::Ring object.
-      void dropRing(DTSC::Ring * ring);
-      /// Get the (constant) header data of this stream.
-      std::string & getHeader();
+      /// Makes the next getStats call report everything, for a newly connected controller.
+      void resetStats();
+      /// Get the ring of packets users read from.
+      PacketRing * getPackets();
+      /// Publishes the newest parsed packet to all users.
+      void publishPacket();
+      /// Publishes the newest parsed packet, using the raw DTSC bytes it was parsed from. Wakes the users only if notify is set.
+      void publishPacket(const char * data, unsigned int len, bool notify);
+      /// Publishes the newest packet parsed by the given parser, using the raw DTSC bytes it was parsed from.
+      void publishPacket(DTSC::Stream & src, const char * data, unsigned int len, bool notify);
       /// Set the IP address to accept push data from.
       void setWaitingIP(std::string ip);
       /// Check if this is the IP address to accept push data from.
       bool checkWaitingIP(std::string ip);
-      /// Sets the current socket for push data.
+      /// Adds a socket for push data, as the active input if there is none yet, otherwise as a backup.
       bool setInput(Socket::Connection S);
-      /// Gets the current socket for push data.
-      Socket::Connection & getIPInput();
+      /// Gets all current push inputs, for use by the push input thread only.
+      void getInputs(std::vector<PushSource*> & list);
+      /// Publishes the packet just parsed by the given push input, if it is the active one or should take over.
+      bool ingest(PushSource * src, const char * data, unsigned int len);
+      /// Removes and deletes a push input whose connection closed.
+      void removeInput(PushSource * src);
+      /// Gives up on the active push input if it stalled while a backup is still receiving data.
+      void checkInputs(long long int now);
+      /// Sets how many milliseconds the active push input may stall before a backup takes over.
+      void setFailover(unsigned int ms);
+      /// Returns a descriptor that becomes readable whenever any stream got a new socket for push data.
+      static int inputEvents();
       /// Stores intermediate statistics.
       void saveStats(std::string username, Stats & stats);
       /// Stores final statistics.
       void clearStats(std::string username, Stats & stats, std::string reason);
-      /// Cleans up broken connections
+      /// Deletes all users released by their worker since the last call.
       void cleanUsers();
-      /// Blocks until writing is safe.
-      void getWriteLock();
-      /// Drops a previously gotten write lock.
-      void dropWriteLock(bool newpackets_available);
-      /// Blocks until reading is safe.
-      void getReadLock();
-      /// Drops a previously gotten read lock.
-      void dropReadLock();
-      /// Retrieves a reference to the DTSC::Stream
+      /// Hands a user that is no longer served by any worker over for deletion. Never blocks.
+      void releaseUser(user * usr);
+      /// Changes the amount of users of this stream served by the worker with the given number.
+      void countWorkerUsers(int worker, int change);
+      /// Returns true if the worker with the given number serves any users of this stream.
+      bool servedBy(int worker);
+      /// Adds to the summed transfer speeds of all users.
+      void countTraffic(long long int up, long long int down);
+      /// Adds to the summed amount of keyframe intervals skipped by all users.
+      void countDropped(long long int gops);
+      /// Retrieves a reference to the DTSC::Stream, for use by the ingest thread only.
       DTSC::Stream * getStream();
-      /// Sets the buffer name.
-      void setName(std::string n);
+      /// Sets the amount of seconds and megabytes of packets to keep available for seeking.
+      void setWindow(unsigned int seconds, unsigned int megabytes);
+      /// Sets how many times faster than real-time new users may catch up with the live point, zero for unlimited.
+      void setBurst(unsigned int speed);
+      /// Returns how many times faster than real-time new users may catch up with the live point.
+      unsigned int getBurst();
+      /// Sets the limits on how far behind the live point users may fall.
+      void setPolicy(unsigned int maxTime, unsigned long long maxBytes, unsigned int kickTime);
+      /// Returns the limits on how far behind the live point users may fall.
+      QueuePolicy & getPolicy();
+      /// Stores the time it took for a user to receive its first packet.
+      void saveFirstFrame(long long int ms);
+      /// Also publishes packets in a shared memory segment of the given size, for local connectors.
+      void openShm(unsigned int megabytes);
+      /// Also records all packets to the given DTSC file, until the stream is deleted.
+      void record(std::string filename);
+      /// Lets up to the given amount of viewers report statistics through shared memory, or none if zero.
+      void openStats(unsigned int viewers);
+      /// Returns the shared memory table connectors write viewer statistics to.
+      StatsTable & getStatsTable();
+      /// Returns the pacer for input read from standard input, for use by the ingest thread only.
+      Pacer & getPacer();
       /// Add a user to the userlist.
       void addUser(user * new_user);
-      /// Blocks the thread until new data is available.
-      void waitForData();
       /// Cleanup function
       ~Stream();
     private:
-      volatile int readers; ///< Current count of active readers;
-      volatile int writers; ///< Current count of waiting/active writers.
-      tthread::mutex rw_mutex; ///< Mutex for read/write locking.
-      tthread::condition_variable rw_change; ///< Triggered when reader/writer count changes.
-      static Stream * ref;
-      Stream();
+      void storeStats(JSON::Value & entry, Stats & stats);
       JSON::Value Storage; ///< Global storage of data.
-      DTSC::Stream * Strm;
+      DTSC::Stream * Strm; ///< Parser for incoming data, only used by the ingest thread.
+      PacketRing * ring; ///< Packets available to users.
+      ShmWriter * shm; ///< Packets available to local connectors, if any.
+      Recorder * recorder; ///< Recording of all packets, if any.
+      Pacer pacer; ///< Real-time pacing of input read from standard input.
+      StatsTable * statsTable; ///< Viewer statistics written by connectors.
+      bool headerSent; ///< Whether a header was published to the ring yet.
+      JSON::Value header; ///< Header last published to the ring, with the keyframe lists of the packets in the ring.
+      JSON::Value plainMeta; ///< Metadata of the header, without keyframe lists.
+      tthread::mutex meta_mutex; ///< Mutex for metadata.
+      JSON::Value metadata; ///< Copy of the metadata of the header, without keyframe lists and init data.
+      unsigned long long metaVersion; ///< Incremented whenever metadata changes.
+      unsigned long long sentMetaVersion; ///< Version of the metadata last reported in the statistics.
+      bool fullStats; ///< Whether the next statistics report should contain everything.
+      long long int lastFullStats; ///< Time of the last complete statistics report.
+      std::set<std::string> changedUsers; ///< Users whose statistics changed since the last report.
+      std::set<std::string> goneUsers; ///< Users that disconnected since the last report.
+      JSON::Value sentUsers; ///< User statistics as last reported.
       std::string waiting_ip; ///< IP address for media push.
-      Socket::Connection ip_input; ///< Connection used for media push.
-      tthread::mutex stats_mutex; ///< Mutex for stats/users modifications.
-      std::vector<user*> users; ///< All connected users.
-      std::vector<user*>::iterator usersIt; ///< Iterator for all connected users.
+      tthread::mutex input_mutex; ///< Mutex for inputs.
+      std::vector<PushSource*> inputs; ///< All push inputs.
+      PushSource * activeInput; ///< Push input that is currently published, null while waiting for one to take over.
+      unsigned int failover; ///< Milliseconds the active push input may stall before a backup takes over.
+      long long int lastPublished; ///< Timestamp of the last published push packet, -1 if none.
+      long long int lastPublishedMS; ///< Time the last push packet was published, in milliseconds.
+      tthread::mutex stats_mutex; ///< Mutex for stats modifications.
+      tthread::mutex users_mutex; ///< Mutex for users.
+      UserRegistry users; ///< All connected users.
+      volatile unsigned int workerUsers[RING_MAX_READERS]; ///< Amount of users per worker number, only changed atomically.
+      user * volatile released; ///< Users released by their worker and not deleted yet, linked through user::nextReleased.
+      volatile long long int totalUp; ///< Sum of the current upload speeds of all users.
+      volatile long long int totalDown; ///< Sum of the current download speeds of all users.
+      volatile long long int totalDropped; ///< Sum of the keyframe intervals skipped by all users.
       std::string name; ///< Name for this buffer.
-      tthread::condition_variable moreData; ///< Triggered when more data becomes available.
+      unsigned int burst; ///< Start-up burst speed, as a multiple of real-time.
+      QueuePolicy policy; ///< Limits on how far behind the live point users may fall.
+      unsigned long long firstFrames; ///< Amount of users that received their first packet.
+      long long int firstFrameTotal; ///< Sum of all times to first packet, in milliseconds.
+      long long int firstFrameMax; ///< Longest time to first packet, in milliseconds.
+      long long int firstFrameLast; ///< Most recent time to first packet, in milliseconds.
   };
 }
 ;
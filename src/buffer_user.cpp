@@ -3,14 +3,16 @@
 
 #include "buffer_user.h"
 #include "buffer_stream.h"
+#include <mist/timing.h>
 #include <sstream>
 #include <stdlib.h> //for atoi and friends
 int Buffer::user::UserCount = 0;
 
-/// Creates a new user from a newly connected socket.
+/// Creates a new user of the given stream from a newly connected socket.
 /// Also prints "User connected" text to stdout.
-Buffer::user::user(Socket::Connection fd){
+Buffer::user::user(Socket::Connection fd, Stream * stream){
   S = fd;
+  myStream = stream;
   MyNum = UserCount++;
   std::stringstream st;
   st << MyNum;
@@ -18,15 +20,35 @@ Buffer::user::user(Socket::Connection fd){
   curr_up = 0;
   curr_down = 0;
   currsend = 0;
-  myRing = 0;
-  Thread = 0;
+  pos = 0;
+  current = 0;
+  header = 0;
+  myWorker = 0;
   gotproperaudio = false;
+  blocked = false;
+  shared = false;
+  playing = -1;
+  connTime = Util::getMS();
+  burstStart = 0;
+  burstTime = -1;
+  gotFirstFrame = false;
+  live = true;
+  lagStart = 0;
+  droppedGops = 0;
+  slot = 0;
+  nextReleased = 0;
+  statSlot = -1;
   lastpointer = 0;
 } //constructor
 
-/// Drops held DTSC::Ring class, if one is held.
+/// Releases the packet currently being sent and the unsent header, if any.
 Buffer::user::~user(){
-  Stream::get()->dropRing(myRing);
+  if (current){
+    current->release();
+  }
+  if (header){
+    header->release();
+  }
 } //destructor
 
 /// Disconnects the current user. Doesn't do anything if already disconnected.
@@ -35,7 +57,14 @@ void Buffer::user::Disconnect(std::string reason){
   if (S.connected()){
     S.close();
   }
-  Stream::get()->clearStats(MyStr, lastStats, reason);
+  if (statSlot >= 0){
+    //take the final statistics from the stats table, and stop reporting them before clearing them
+    myStream->getStatsTable().read(statSlot, lastStats);
+    myStream->getStatsTable().release(statSlot);
+    statSlot = -1;
+  }
+  lastStats.dropped = droppedGops;
+  myStream->clearStats(MyStr, lastStats, reason);
 } //Disconnect
 
 /// Tries to send the current buffer, returns true if success, false otherwise.
@@ -47,6 +76,7 @@ bool Buffer::user::doSend(const char * ptr, int len){
   int r = S.iwrite(ptr + currsend, len - currsend);
   if (r <= 0){
     if (errno == EWOULDBLOCK){
+      blocked = true;
       return false;
     }
     Disconnect(S.getError());
@@ -56,48 +86,185 @@ bool Buffer::user::doSend(const char * ptr, int len){
   return (currsend == len);
 } //doSend
 
-/// Try to send data to this user. Disconnects if any problems occur.
-void Buffer::user::Send(){
-  if ( !myRing){
-    return;
-  } //no ring!
-  if ( !S.connected()){
-    return;
-  } //cancel if not connected
-  if (myRing->waiting){
-    Stream::get()->waitForData();
-    return;
-  } //still waiting for next buffer?
-  if (myRing->starved){
-    //if corrupt data, warn and get new DTSC::Ring
-    std::cout << "Warning: User " << MyNum << " was send corrupt video data and send to the next keyframe!" << std::endl;
-    Stream::get()->dropRing(myRing);
-    myRing = Stream::get()->getRing();
-    return;
-  }
-  //try to complete a send
-  Stream::get()->getReadLock();
-  if (doSend(Stream::get()->getStream()->outPacket(myRing->b).c_str(), Stream::get()->getStream()->outPacket(myRing->b).length())){
-    //switch to next buffer
-    currsend = 0;
-    if (myRing->b <= 0){
-      myRing->waiting = true;
+/// Starts sending from the packet with the given sequence number, as fast as the burst speed allows until live.
+/// Called once, when the user is attached to a worker.
+void Buffer::user::Start(unsigned long long seq){
+  pos = seq;
+  burstStart = Util::getMS();
+  burstTime = -1;
+}
+
+/// Continues sending from the packet with the given sequence number.
+/// A packet that was partially sent already is completed first.
+/// Also stops reading from shared memory, since that always follows the live point.
+void Buffer::user::Seek(unsigned long long seq){
+  shared = false;
+  live = false;
+  burstStart = 0; //seeking users get their data as fast as possible
+  pos = seq;
+  if (current && !currsend){
+    current->release();
+    current = 0;
+  }
+}
+
+/// Send as much data to this user as possible without blocking. Disconnects if any problems occur.
+/// The reader number is the one registered with the PacketRing by the calling thread.
+/// When a keyframe is reached that ends a play-once request, a pause marker is sent in its place.
+/// The stream header is completed before anything else is sent.
+void Buffer::user::Send(int reader){
+  PacketRing * ring = myStream->getPackets();
+  while (S.connected() && !blocked){
+    if (header){
+      if (header->data.size() && !doSend(header->data.c_str(), header->data.size())){
+        return;
+      }
+      currsend = 0;
+      header->release();
+      header = 0;
+      continue;
+    }
+    if ( !current){
+      if (shared || !playing){
+        return;
+      } //reads from shared memory or paused, only finish the packet in progress
+      current = ring->get(reader, pos);
+      if ( !current){
+        if (pos >= ring->end()){
+          lagStart = 0;
+          return;
+        } //still waiting for next packet? the worker is woken when it arrives.
+        //this packet was already dropped - warn and skip to the newest keyframe
+        std::cout << "Warning: User " << MyNum << " could not keep up and was sent to the next keyframe!" << std::endl;
+        skipTo(ring, ring->start());
+        continue;
+      }
+      if (checkLag(ring)){
+        continue;
+      }
+      if (playing > 0 && current->keyframe && --playing == 0){
+        //done playing - send a pause marker instead, this keyframe is sent when playing again
+        JSON::Value pausemark;
+        pausemark["datatype"] = "pause_marker";
+        pausemark["time"] = current->time;
+        pausemark.toPacked();
+        Packet * marker = new Packet(pausemark.toNetPacked(), current->time, false);
+        marker->seq = pos - 1; //never equal to pos, so pos stays at the keyframe
+        current->release();
+        current = marker;
+      }
+    }
+    if (holdBurst(ring)){
       return;
-    } //no next buffer? go in waiting mode.
-    myRing->b--;
-  } //completed a send
-  Stream::get()->dropReadLock();
+    } //retried on the next wakeup
+    //try to complete a send
+    if ( !doSend(current->data.c_str(), current->data.size())){
+      return;
+    }
+    //switch to next packet, unless this was a marker or we seeked in the meantime
+    currsend = 0;
+    if (current->seq == pos){
+      pos++;
+      if ( !gotFirstFrame){
+        gotFirstFrame = true;
+        myStream->saveFirstFrame(Util::getMS() - connTime);
+      }
+    }
+    current->release();
+    current = 0;
+  }
 } //send
 
+/// Applies the slow-consumer policy to the packet just fetched, for users following the live point.
+/// Users too far behind skip to the newest keyframe, users that do not catch up in time are disconnected.
+/// Returns true if the packet was dropped.
+bool Buffer::user::checkLag(PacketRing * ring){
+  if ( !live){
+    return false;
+  }
+  QueuePolicy & policy = myStream->getPolicy();
+  bool behind = (policy.maxTime && ring->endTime() - current->time > policy.maxTime)
+      || (policy.maxBytes && ring->bytesEnd() - current->offset > policy.maxBytes);
+  if ( !behind){
+    return false;
+  }
+  long long int now = Util::getMS();
+  if ( !lagStart){
+    lagStart = now;
+  }
+  if (policy.kickTime && now - lagStart > policy.kickTime * 1000LL){
+    current->release();
+    current = 0;
+    Disconnect("Could not keep up with the stream.");
+    return true;
+  }
+  unsigned long long target = ring->start();
+  if (target <= pos){
+    return false;
+  } //already in the newest keyframe interval, nothing left to skip
+#if DEBUG >= 4
+  std::cerr << "User " << MyNum << " is too far behind, skipping to the newest keyframe" << std::endl;
+#endif
+  current->release();
+  current = 0;
+  skipTo(ring, target);
+  return true;
+}
+
+/// Moves to the given sequence number, counting the keyframe intervals that are skipped.
+void Buffer::user::skipTo(PacketRing * ring, unsigned long long seq){
+  if (seq > pos){
+    unsigned int gops = ring->keysUntil(seq) - ring->keysUntil(pos);
+    droppedGops += gops;
+    myStream->countDropped(gops);
+    if (statSlot >= 0){
+      myStream->getStatsTable().setDropped(statSlot, droppedGops);
+    }
+  }
+  pos = seq;
+}
+
+/// Returns true if the current packet should wait, to keep the start-up burst below the configured speed.
+/// The burst ends once the live point is reached.
+bool Buffer::user::holdBurst(PacketRing * ring){
+  if ( !burstStart || currsend || current->seq != pos){
+    return false;
+  }
+  if (pos + 1 >= ring->end()){
+    burstStart = 0; //caught up with the live point
+    return false;
+  }
+  if (burstTime < 0){
+    burstTime = current->time;
+  }
+  unsigned int speed = myStream->getBurst();
+  if ( !speed){
+    return false;
+  }
+  return current->time - burstTime > (Util::getMS() - burstStart) * speed;
+}
+
+/// Creates a policy without any limits.
+Buffer::QueuePolicy::QueuePolicy(){
+  maxTime = 0;
+  maxBytes = 0;
+  kickTime = 0;
+}
+
 /// Default constructor - should not be in use.
 Buffer::Stats::Stats(){
   up = 0;
   down = 0;
   conntime = 0;
+  dropped = 0;
 }
 
 /// Reads a stats string and parses it to the internal representation.
 Buffer::Stats::Stats(std::string s){
+  up = 0;
+  down = 0;
+  conntime = 0;
+  dropped = 0;
   size_t f = s.find(' ');
   if (f != std::string::npos){
     host = s.substr(0, f);
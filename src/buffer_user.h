@@ -6,8 +6,12 @@
 #include <mist/dtsc.h>
 #include <mist/socket.h>
 #include "tinythread.h"
+#include "buffer_ring.h"
 
 namespace Buffer {
+  class Worker;
+  class Stream;
+
   /// Converts a stats line to up, down, host, connector and conntime values.
   class Stats{
     public:
@@ -16,16 +20,29 @@ namespace Buffer {
       std::string host;
       std::string connector;
       unsigned int conntime;
+      unsigned int dropped; ///< Amount of keyframe intervals skipped, filled in by the buffer itself.
       Stats();
       Stats(std::string s);
   };
 
+  /// Limits on how far behind the live point a user may fall, zero meaning unlimited.
+  class QueuePolicy{
+    public:
+      unsigned int maxTime; ///< Milliseconds a user may be behind before skipping to the newest keyframe.
+      unsigned long long maxBytes; ///< Bytes a user may be behind before skipping to the newest keyframe.
+      unsigned int kickTime; ///< Seconds a user may stay behind before being disconnected.
+      QueuePolicy();
+  };
+
   /// Holds connected users.
   /// Keeps track of what buffer users are using and the connection status.
   class user{
     public:
-      tthread::thread * Thread; ///< Holds the thread dealing with this user.
-      DTSC::Ring * myRing; ///< Ring of the buffer for this user.
+      Stream * myStream; ///< Stream this user is connected to.
+      Worker * volatile myWorker; ///< Worker serving this user, null once released.
+      unsigned long long pos; ///< Sequence number of the next packet to send to this user.
+      Packet * current; ///< Claimed packet currently being sent, if any.
+      Packet * header; ///< Claimed stream header that was not completely sent yet, sent before any packet.
       int MyNum; ///< User ID of this user.
       std::string MyStr; ///< User ID of this user as a string.
       std::string inbuffer; ///< Used to buffer input data.
@@ -35,13 +52,26 @@ namespace Buffer {
       unsigned int curr_up; ///< Holds the current estimated transfer speed up.
       unsigned int curr_down; ///< Holds the current estimated transfer speed down.
       bool gotproperaudio; ///< Whether the user received proper audio yet.
+      bool blocked; ///< Whether the last send attempt would have blocked.
+      bool shared; ///< Whether this user reads packets from shared memory instead.
+      int playing; ///< -1 while playing, 0 while paused, or the amount of keyframes left to pass before pausing.
+      long long int connTime; ///< Time this user connected, in milliseconds.
+      long long int burstStart; ///< Time the start-up burst began in milliseconds, or 0 when not bursting.
+      long long int burstTime; ///< Timestamp of the first packet of the start-up burst, or -1 if none was sent yet.
+      bool gotFirstFrame; ///< Whether a complete packet was sent to this user yet.
+      bool live; ///< Whether this user follows the live point, as opposed to having seeked.
+      long long int lagStart; ///< Time this user first fell too far behind in milliseconds, 0 if not behind.
+      unsigned int droppedGops; ///< Amount of keyframe intervals skipped because this user could not keep up.
+      unsigned int slot; ///< Slot of this user in the UserRegistry of its stream.
+      user * nextReleased; ///< Next user released by its worker, while waiting for deletion.
+      int statSlot; ///< Slot in the stats table of the stream this user reports statistics in, -1 if none.
       void * lastpointer; ///< Pointer to data part of current buffer.
       static int UserCount; ///< Global user counter.
       Socket::Connection S; ///< Connection to user
-      /// Creates a new user from a newly connected socket.
+      /// Creates a new user of the given stream from a newly connected socket.
       /// Also prints "User connected" text to stdout.
-      user(Socket::Connection fd);
-      /// Drops held DTSC::Ring class, if one is held.
+      user(Socket::Connection fd, Stream * stream);
+      /// Releases the packet currently being sent and the unsent header, if any.
       ~user();
       /// Disconnects the current user. Doesn't do anything if already disconnected.
       /// Prints "Disconnected user" to stdout if disconnect took place.
@@ -49,7 +79,17 @@ namespace Buffer {
       /// Tries to send the current buffer, returns true if success, false otherwise.
       /// Has a side effect of dropping the connection if send will never complete.
       bool doSend(const char * ptr, int len);
-      /// Try to send data to this user. Disconnects if any problems occur.
-      void Send();
+      /// Starts sending from the packet with the given sequence number, as fast as the burst speed allows until live.
+      void Start(unsigned long long seq);
+      /// Continues sending from the packet with the given sequence number.
+      /// A packet that was partially sent already is completed first.
+      void Seek(unsigned long long seq);
+      /// Send as much data to this user as possible without blocking. Disconnects if any problems occur.
+      /// The reader number is the one registered with the PacketRing by the calling thread.
+      void Send(int reader);
+    private:
+      bool holdBurst(PacketRing * ring);
+      bool checkLag(PacketRing * ring);
+      void skipTo(PacketRing * ring, unsigned long long seq);
   };
 }
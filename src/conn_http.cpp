@@ -10,7 +10,6 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <getopt.h>
-#include <set>
 #include <mist/socket.h>
 #include <mist/http_parser.h>
 #include <mist/config.h>
@@ -18,96 +17,45 @@
 #include <mist/timing.h>
 #include <mist/auth.h>
 #include "tinythread.h"
-#include "embed.js.h"
+#include "conn_http_reactor.h"
+#include "conn_http_cache.h"
+#include "conn_http_embed.h"
+#include "conn_http_router.h"
 
 /// Holds everything unique to HTTP Connector.
 namespace Connector_HTTP {
 
-  /// Class for keeping track of connections to connectors.
-  class ConnConn{
-    public:
-      Socket::Connection * conn; ///< The socket of this connection
-      unsigned int lastuse; ///< Seconds since last use of this connection.
-      tthread::mutex in_use; ///< Mutex for this connection.
-      /// Constructor that sets the socket and lastuse to 0.
-      ConnConn(){
-        conn = 0;
-        lastuse = 0;
-      }
-      ;
-      /// Constructor that sets lastuse to 0, but socket to s.
-      ConnConn(Socket::Connection * s){
-        conn = s;
-        lastuse = 0;
-      }
-      ;
-      /// Destructor that deletes the socket if non-null.
-      ~ConnConn(){
-        if (conn){
-          conn->close();
-          delete conn;
-        }
-        conn = 0;
-      }
-      ;
-  };
-
-  std::map<std::string, ConnConn *> connconn; ///< Connections to connectors
-  std::set<tthread::thread *> active_threads; ///< Holds currently active threads
-  std::set<tthread::thread *> done_threads; ///< Holds threads that are done and ready to be joined.
-  tthread::mutex thread_mutex; ///< Mutex for adding/removing threads.
-  tthread::mutex conn_mutex; ///< Mutex for adding/removing connector connections.
-  tthread::mutex timeout_mutex; ///< Mutex for timeout thread.
-  tthread::thread * timeouter = 0; ///< Thread that times out connections to connectors.
-
-  void Timeout_Thread(void * n){
-    n = 0; //prevent unused variable warning
-    tthread::lock_guard<tthread::mutex> guard(timeout_mutex);
-    while (true){
-      {
-        tthread::lock_guard<tthread::mutex> guard(conn_mutex);
-        if (connconn.empty()){
-          return;
-        }
-        std::map<std::string, ConnConn*>::iterator it;
-        for (it = connconn.begin(); it != connconn.end(); it++){
-          if ( !it->second->conn->connected() || it->second->lastuse++ > 15){
-            if (it->second->in_use.try_lock()){
-              it->second->in_use.unlock();
-              delete it->second;
-              connconn.erase(it);
-              it = connconn.begin(); //get a valid iterator
-              if (it == connconn.end()){
-                return;
-              }
-            }
-          }
-        }
-        conn_mutex.unlock();
-      }
-      usleep(1000000); //sleep 1 second and re-check
-    }
-  }
+  volatile bool stats_running = true; ///< Set to false to stop reporting statistics to the controller.
 
   /// Handles requests without associated handler, displaying a nice friendly error message.
-  void Handle_None(HTTP::Parser & H, Socket::Connection * conn){
+  void Handle_None(HTTP::Parser & H, Client * C){
     H.Clean();
     H.SetHeader("Server", "mistserver/" PACKAGE_VERSION "/" + Util::Config::libver);
     H.SetBody(
         "<!DOCTYPE html><html><head><title>Unsupported Media Type</title></head><body><h1>Unsupported Media Type</h1>The server isn't quite sure what you wanted to receive from it.</body></html>");
-    conn->SendNow(H.BuildResponse("415", "Unsupported Media Type"));
+    C->send(H.BuildResponse("415", "Unsupported Media Type"));
   }
 
-  void Handle_Timeout(HTTP::Parser & H, Socket::Connection * conn){
+  /// Handles requests a sub-connector did not answer in time, displaying a nice friendly error message.
+  void Handle_Timeout(HTTP::Parser & H, Client * C){
     H.Clean();
     H.SetHeader("Server", "mistserver/" PACKAGE_VERSION "/" + Util::Config::libver);
     H.SetBody(
         "<!DOCTYPE html><html><head><title>Gateway timeout</title></head><body><h1>Gateway timeout</h1>Though the server understood your request and attempted to handle it, somehow handling it took longer than it should. Your request has been cancelled - please try again later.</body></html>");
-    conn->SendNow(H.BuildResponse("504", "Gateway Timeout"));
+    C->send(H.BuildResponse("504", "Gateway Timeout"));
+  }
+
+  /// Handles requests of viewers that already have too many requests waiting, displaying a nice friendly error message.
+  void Handle_Busy(HTTP::Parser & H, Client * C){
+    H.Clean();
+    H.SetHeader("Server", "mistserver/" PACKAGE_VERSION "/" + Util::Config::libver);
+    H.SetBody(
+        "<!DOCTYPE html><html><head><title>Service unavailable</title></head><body><h1>Service unavailable</h1>The server is currently handling too many of your requests at once. Your request has been cancelled - please try again later.</body></html>");
+    C->send(H.BuildResponse("503", "Service Unavailable"));
   }
 
   /// Handles internal requests.
-  void Handle_Internal(HTTP::Parser & H, Socket::Connection * conn){
+  void Handle_Internal(HTTP::Parser & H, Client * C){
 
     std::string url = H.getUrl();
 
@@ -117,7 +65,7 @@ namespace Connector_HTTP {
       H.SetHeader("Server", "mistserver/" PACKAGE_VERSION "/" + Util::Config::libver);
       H.SetBody(
           "<?xml version=\"1.0\"?><!DOCTYPE cross-domain-policy SYSTEM \"http://www.adobe.com/xml/dtds/cross-domain-policy.dtd\"><cross-domain-policy><allow-access-from domain=\"*\" /><site-control permitted-cross-domain-policies=\"all\"/></cross-domain-policy>");
-      conn->SendNow(H.BuildResponse("200", "OK"));
+      C->send(H.BuildResponse("200", "OK"));
       return;
     } //crossdomain.xml
 
@@ -127,232 +75,104 @@ namespace Connector_HTTP {
       H.SetHeader("Server", "mistserver/" PACKAGE_VERSION "/" + Util::Config::libver);
       H.SetBody(
           "<?xml version=\"1.0\" encoding=\"utf-8\"?><access-policy><cross-domain-access><policy><allow-from http-methods=\"*\" http-request-headers=\"*\"><domain uri=\"*\"/></allow-from><grant-to><resource path=\"/\" include-subpaths=\"true\"/></grant-to></policy></cross-domain-access></access-policy>");
-      conn->SendNow(H.BuildResponse("200", "OK"));
+      C->send(H.BuildResponse("200", "OK"));
       return;
     } //clientaccesspolicy.xml
 
-    if ((url.length() > 9 && url.substr(0, 6) == "/info_" && url.substr(url.length() - 3, 3) == ".js")
-        || (url.length() > 10 && url.substr(0, 7) == "/embed_" && url.substr(url.length() - 3, 3) == ".js")){
-      std::string streamname;
-      if (url.substr(0, 6) == "/info_"){
-        streamname = url.substr(6, url.length() - 9);
-      }else{
-        streamname = url.substr(7, url.length() - 10);
-      }
-      Util::Stream::sanitizeName(streamname);
-      JSON::Value ServConf = JSON::fromFile("/tmp/mist/streamlist");
-      std::string response;
-      std::string host = H.GetHeader("Host");
-      if (host.find(':')){
-        host.resize(host.find(':'));
-      }
-      H.Clean();
-      H.SetHeader("Server", "mistserver/" PACKAGE_VERSION "/" + Util::Config::libver);
-      H.SetHeader("Content-Type", "application/javascript");
-      response = "// Generating info code for stream " + streamname + "\n\nif (!mistvideo){var mistvideo = {};}\n";
-      JSON::Value json_resp;
-      if (ServConf["streams"].isMember(streamname) && ServConf["config"]["protocols"].size() > 0){
-        json_resp["width"] = ServConf["streams"][streamname]["meta"]["video"]["width"].asInt();
-        json_resp["height"] = ServConf["streams"][streamname]["meta"]["video"]["height"].asInt();
-        //first, see if we have RTMP working and output all the RTMP.
-        for (JSON::ArrIter it = ServConf["config"]["protocols"].ArrBegin(); it != ServConf["config"]["protocols"].ArrEnd(); it++){
-          if (( *it)["connector"].asString() == "RTMP"){
-            JSON::Value tmp;
-            tmp["type"] = "rtmp";
-            tmp["url"] = "rtmp://" + host + ":" + ( *it)["port"].asString() + "/play/" + streamname;
-            json_resp["source"].append(tmp);
-          }
-        }
-        //then, see if we have HTTP working and output all the dynamic.
-        for (JSON::ArrIter it = ServConf["config"]["protocols"].ArrBegin(); it != ServConf["config"]["protocols"].ArrEnd(); it++){
-          if (( *it)["connector"].asString() == "HTTP"){
-            JSON::Value tmp;
-            tmp["type"] = "f4v";
-            tmp["url"] = "http://" + host + ":" + ( *it)["port"].asString() + "/" + streamname + "/manifest.f4m";
-            json_resp["source"].append(tmp);
-          }
-        }
-        //and all the progressive.
-        for (JSON::ArrIter it = ServConf["config"]["protocols"].ArrBegin(); it != ServConf["config"]["protocols"].ArrEnd(); it++){
-          if (( *it)["connector"].asString() == "HTTP"){
-            JSON::Value tmp;
-            tmp["type"] = "flv";
-            tmp["url"] = "http://" + host + ":" + ( *it)["port"].asString() + "/" + streamname + ".flv";
-            json_resp["source"].append(tmp);
-          }
-        }
-      }else{
-        json_resp["error"] = "The specified stream is not available on this server.";
-        json_resp["bbq"] = "sauce"; //for legacy purposes ^_^
-      }
-      response += "mistvideo['" + streamname + "'] = " + json_resp.toString() + ";\n";
-      if (url.substr(0, 6) != "/info_" && !json_resp.isMember("error")){
-        response.append("\n(");
-        response.append((char*)embed_js, (size_t)embed_js_len - 2); //remove trailing ";\n" from xxd conversion
-        response.append("(\"" + streamname + "\"));\n");
-      }
-      H.SetBody(response);
-      conn->SendNow(H.BuildResponse("200", "OK"));
+    if (url.substr(0, 6) == "/info_" || url.substr(0, 7) == "/embed_"){
+      std::string streamname = H.GetVar("stream"); //set by getRoute
+      embeds.serve(H, C, streamname, url.substr(0, 6) != "/info_");
       return;
     } //embed code generator
 
-    Handle_None(H, conn); //anything else doesn't get handled
+    Handle_None(H, C); //anything else doesn't get handled
   }
 
-  /// Handles requests without associated handler, displaying a nice friendly error message.
-  void Handle_Through_Connector(HTTP::Parser & H, Socket::Connection * conn, std::string & connector){
+  /// Forwards a request to the sub-connector for the given connector, through the reactor serving the client.
+  /// Returns false if the client was handed over to the sub-connector.
+  /// Segment requests are shared with other viewers through the segment cache.
+  bool Handle_Through_Connector(Reactor & R, HTTP::Parser & H, Client * C, std::string & connector, bool segment){
+    std::string cacheKey;
+    if (segments.enabled() && segment){
+      cacheKey = connector + " " + H.getUrl(); //the URL holds the stream, rendition and fragment number
+    }
     //create a unique ID based on a hash of the user agent and host, followed by the stream name and connector
-    std::string uid = Secure::md5(H.GetHeader("User-Agent") + conn->getHost()) + "_" + H.GetVar("stream") + "_" + connector;
+    std::string uid = Secure::md5(H.GetHeader("User-Agent") + C->conn.getHost()) + "_" + H.GetVar("stream") + "_" + connector;
     H.SetHeader("X-UID", uid); //add the UID to the headers before copying
-    H.SetHeader("X-Origin", conn->getHost()); //add the UID to the headers before copying
+    H.SetHeader("X-Origin", C->conn.getHost()); //add the UID to the headers before copying
     std::string request = H.BuildRequest(); //copy the request for later forwarding to the connector
-    std::string orig_url = H.getUrl();
     H.Clean();
+    return R.forward(C, uid, connector, request, cacheKey);
+  }
 
-    //check if a connection exists, and if not create one
-    conn_mutex.lock();
-    if ( !connconn.count(uid) || !connconn[uid]->conn->connected()){
-      if (connconn.count(uid)){
-        connconn.erase(uid);
-      }
-      connconn[uid] = new ConnConn(new Socket::Connection("/tmp/mist/http_" + connector));
-      connconn[uid]->conn->setBlocking(false); //do not block on spool() with no data
-#if DEBUG >= 4
-      std::cout << "Created new connection " << uid << std::endl;
-#endif
-    }else{
-#if DEBUG >= 4
-      std::cout << "Re-using connection " << uid << std::endl;
-#endif
-    }
-    //start a new timeout thread, if neccesary
-    if (timeout_mutex.try_lock()){
-      if (timeouter){
-        timeouter->join();
-        delete timeouter;
-      }
-      timeouter = new tthread::thread(Connector_HTTP::Timeout_Thread, 0);
-      timeout_mutex.unlock();
-    }
-    conn_mutex.unlock();
-
-    //lock the mutex for this connection, and handle the request
-    tthread::lock_guard<tthread::mutex> guard(connconn[uid]->in_use);
-    //if the server connection is dead, handle as timeout.
-    if ( !connconn.count(uid) || !connconn[uid]->conn->connected()){
-      Handle_Timeout(H, conn);
-      return;
-    }
-    //forward the original request
-    connconn[uid]->conn->SendNow(request);
-    connconn[uid]->lastuse = 0;
-    unsigned int timeout = 0;
-    //wait for a response
-    while (connconn.count(uid) && connconn[uid]->conn->connected() && conn->connected()){
-      conn->spool();
-      if (connconn[uid]->conn->Received().size() || connconn[uid]->conn->spool()){
-        //make sure we end in a \n
-        if ( *(connconn[uid]->conn->Received().get().rbegin()) != '\n'){
-          std::string tmp = connconn[uid]->conn->Received().get();
-          connconn[uid]->conn->Received().get().clear();
-          if (connconn[uid]->conn->Received().size()){
-            connconn[uid]->conn->Received().get().insert(0, tmp);
-          }else{
-            connconn[uid]->conn->Received().append(tmp);
-          }
-        }
-        //check if the whole response was received
-        if (H.Read(connconn[uid]->conn->Received().get())){
-          break; //continue down below this while loop
-        }
-      }else{
-        //keep trying unless the timeout triggers
-        if (timeout++ > 4000){
-          std::cout << "[20s timeout triggered]" << std::endl;
-          Handle_Timeout(H, conn);
-          return;
-        }else{
-          Util::sleep(5);
-        }
-      }
+  /// Returns the route the given request should be served by, or 0 if the request is not supported.
+  /// Sets the "stream" variable of the request if the route names a stream.
+  const Route * getRoute(HTTP::Parser & H){
+    std::string url = H.getUrl();
+    RouteMatch M;
+    if ( !routes.match(url, M)){
+      return 0;
     }
-    if ( !connconn.count(uid) || !connconn[uid]->conn->connected() || !conn->connected()){
-      //failure, disconnect and sent error to user
-      Handle_Timeout(H, conn);
-      return;
-    }else{
-      //success, check type of response
-      if (H.GetHeader("Content-Length") != ""){
-        //known length - simply re-send the request with added headers and continue
-        H.SetHeader("X-UID", uid);
-        H.SetHeader("Server", "mistserver/" PACKAGE_VERSION "/" + Util::Config::libver);
-        conn->SendNow(H.BuildResponse("200", "OK"));
-        conn->flush();
-      }else{
-        //unknown length
-        H.SetHeader("X-UID", uid);
-        H.SetHeader("Server", "mistserver/" PACKAGE_VERSION "/" + Util::Config::libver);
-        conn->SendNow(H.BuildResponse("200", "OK"));
-        //switch out the connection for an empty one - it makes no sense to keep these globally
-        Socket::Connection * myConn = connconn[uid]->conn;
-        connconn[uid]->conn = new Socket::Connection();
-        connconn[uid]->in_use.unlock();
-        //continue sending data from this socket and keep it permanently in use
-        while (myConn->connected() && conn->connected()){
-          if (myConn->Received().size() || myConn->spool()){
-            //forward any and all incoming data directly without parsing
-            conn->SendNow(myConn->Received().get());
-            myConn->Received().get().clear();
-          }else{
-            Util::sleep(30);
-          }
-        }
-        myConn->close();
-        delete myConn;
-        conn->close();
-      }
+    if (M.streamLen){
+      std::string streamname = url.substr(M.streamStart, M.streamLen);
+      Util::Stream::sanitizeName(streamname);
+      H.SetVar("stream", streamname);
     }
+    return M.route;
   }
 
-  /// Returns the name of the HTTP connector the given request should be served by.
-  /// Can currently return:
-  /// - none (request not supported)
+  /// Adds the URLs served by each connector to the routing table.
+  /// Can currently route to:
   /// - internal (request fed from information internal to this connector)
   /// - dynamic (request fed from http_dynamic connector)
+  /// - smooth (request fed from http_smooth connector)
+  /// - live (request fed from http_live connector)
   /// - progressive (request fed from http_progressive connector)
-  std::string getHTTPType(HTTP::Parser & H){
-    std::string url = H.getUrl();
+  /// Anything else is not supported.
+  void addRoutes(){
+    routes.add("internal", "/crossdomain.xml");
+    routes.add("internal", "/clientaccesspolicy.xml");
+    routes.add("internal", "/embed_{stream}.js");
+    routes.add("internal", "/info_{stream}.js");
+
+    routes.add("dynamic", "/{stream}/*.f4m");
+    routes.add("dynamic", "/{stream}/*Seg*-Frag*", true);
+
+    routes.add("smooth", "/smooth/{stream}.ism/*Fragments(*)", true);
+    routes.add("smooth", "/smooth/{stream}.ism/*");
+
+    routes.add("live", "/hls/{stream}/*.m3u8");
+    routes.add("live", "/hls/{stream}/*.m3u");
+    routes.add("live", "/hls/{stream}/*.ts", true);
+
+    //progressive streams last until the connection closes, so only those clients are handed over
+    routes.add("progressive", "/{stream}.flv").handOver = true;
+    routes.add("progressive", "/{stream}.mp3").handOver = true;
+  }
+
+  /// Classifies a URL the way getRoute did before the routing table, through a chain of searches.
+  /// Only kept as the baseline of benchmarkRoutes.
+  std::string findChain(const std::string & url, std::string & streamname){
     if ((url.find("f4m") != std::string::npos) || ((url.find("Seg") != std::string::npos) && (url.find("Frag") != std::string::npos))){
-      std::string streamname = url.substr(1, url.find("/", 1) - 1);
-      Util::Stream::sanitizeName(streamname);
-      H.SetVar("stream", streamname);
+      streamname = url.substr(1, url.find("/", 1) - 1);
       return "dynamic";
     }
     if (url.find("/smooth/") != std::string::npos && url.find(".ism") != std::string::npos){
-      std::string streamname = url.substr(8, url.find("/", 8) - 12);
-      Util::Stream::sanitizeName(streamname);
-      H.SetVar("stream", streamname);
+      streamname = url.substr(8, url.find("/", 8) - 12);
       return "smooth";
     }
     if (url.find("/hls/") != std::string::npos && (url.find(".m3u") != std::string::npos || url.find(".ts") != std::string::npos)){
-      std::string streamname = url.substr(5, url.find("/", 5) - 5);
-      Util::Stream::sanitizeName(streamname);
-      H.SetVar("stream", streamname);
+      streamname = url.substr(5, url.find("/", 5) - 5);
       return "live";
     }
     if (url.length() > 4){
       std::string ext = url.substr(url.length() - 4, 4);
       if (ext == ".flv" || ext == ".mp3"){
-        std::string streamname = url.substr(1, url.length() - 5);
-        Util::Stream::sanitizeName(streamname);
-        H.SetVar("stream", streamname);
+        streamname = url.substr(1, url.length() - 5);
         return "progressive";
       }
     }
-    if (url == "/crossdomain.xml"){
-      return "internal";
-    }
-    if (url == "/clientaccesspolicy.xml"){
+    if (url == "/crossdomain.xml" || url == "/clientaccesspolicy.xml"){
       return "internal";
     }
     if (url.length() > 10 && url.substr(0, 7) == "/embed_" && url.substr(url.length() - 3, 3) == ".js"){
@@ -364,70 +184,101 @@ namespace Connector_HTTP {
     return "none";
   }
 
-  /// Thread for handling a single HTTP connection
-  void Handle_HTTP_Connection(void * pointer){
-    Socket::Connection * conn = (Socket::Connection *)pointer;
-    conn->setBlocking(false); //do not block on conn.spool() when no data is available
-    HTTP::Parser Client;
-    while (conn->connected()){
-      if (conn->spool() || conn->Received().size()){
-        //make sure it ends in a \n
-        if ( *(conn->Received().get().rbegin()) != '\n'){
-          std::string tmp = conn->Received().get();
-          conn->Received().get().clear();
-          if (conn->Received().size()){
-            conn->Received().get().insert(0, tmp);
-          }else{
-            conn->Received().append(tmp);
-          }
+  /// Prints the results of a single benchmark run.
+  void benchmarkResult(const char * name, unsigned long long requests, long long int ms){
+    if (ms < 1){
+      ms = 1;
+    }
+    fprintf(stderr, "%s: %llu requests in %lld ms = %.0f requests/s\n", name, requests, ms, requests * 1000.0 / ms);
+  }
+
+  /// Measures how many request URLs per second the search chain and the routing table classify.
+  /// Classifies a fixed mix of typical URLs the given amount of times with both.
+  int benchmarkRoutes(long long int rounds){
+    const char * samples[] = {"/live/manifest.f4m", "/live/1Seg1-Frag42", "/smooth/live.ism/Manifest",
+        "/smooth/live.ism/Q(1000000)/Fragments(video=420000000)", "/hls/live/index.m3u8", "/hls/live/42_1.ts", "/live.flv",
+        "/crossdomain.xml", "/embed_live.js", "/info_live.js", "/favicon.ico", 0};
+    std::vector<std::string> urls;
+    for (unsigned int i = 0; samples[i]; i++){
+      urls.push_back(samples[i]);
+    }
+    unsigned long long requests = 0;
+    unsigned long long found = 0;
+    long long int start;
+
+    start = Util::getMS();
+    for (long long int r = 0; r < rounds; r++){
+      for (std::vector<std::string>::iterator it = urls.begin(); it != urls.end(); it++){
+        std::string streamname;
+        if (findChain( *it, streamname) != "none"){
+          found++;
         }
-        if (Client.Read(conn->Received().get())){
-          std::string handler = getHTTPType(Client);
-          long long int startms = Util::getMS();
-#if DEBUG >= 4
-          std::cout << "Received request: " << Client.getUrl() << " (" << conn->getSocket() << ") => " << handler << " (" << Client.GetVar("stream")
-              << ")" << std::endl;
-#endif
-          bool closeConnection = false;
-          if (Client.GetHeader("Connection") == "close"){
-            closeConnection = true;
-          }
+        requests++;
+      }
+    }
+    benchmarkResult("search chain", requests, Util::getMS() - start);
+
+    requests = 0;
+    start = Util::getMS();
+    for (long long int r = 0; r < rounds; r++){
+      for (std::vector<std::string>::iterator it = urls.begin(); it != urls.end(); it++){
+        RouteMatch M;
+        if (routes.match( *it, M)){
+          found++;
+        }
+        requests++;
+      }
+    }
+    benchmarkResult("routing table", requests, Util::getMS() - start);
+    return found ? 0 : 1; //using the results keeps the loops from being optimized away
+  }
 
-          if (handler == "none" || handler == "internal"){
-            if (handler == "internal"){
-              Handle_Internal(Client, conn);
-            }else{
-              Handle_None(Client, conn);
-            }
-          }else{
-            Handle_Through_Connector(Client, conn, handler);
-          }
+  /// Handles a complete request read from a client, either by answering it or by forwarding it to a sub-connector.
+  /// Returns false if the client was handed over to a sub-connector.
+  bool handleRequest(Reactor & R, Client * C){
+    const Route * route = getRoute(C->H);
+    C->route = route;
+    std::string handler = route ? route->connector : "none";
 #if DEBUG >= 4
-          std::cout << "Completed request (" << conn->getSocket() << ") " << handler << " in " << (Util::getMS() - startms) << " ms" << std::endl;
+    std::cout << "Received request: " << C->H.getUrl() << " (" << C->fd << ") => " << handler << " (" << C->H.GetVar("stream") << ")" << std::endl;
 #endif
-          if (closeConnection){
-            break;
-          }
-          Client.Clean(); //clean for any possible next requests
-        }
+    if (handler == "none" || handler == "internal"){
+      if (handler == "internal"){
+        Handle_Internal(C->H, C);
       }else{
-        Util::sleep(10); //sleep 10ms
+        Handle_None(C->H, C);
       }
+    }else{
+      return Handle_Through_Connector(R, C->H, C, handler, route->segment);
     }
-    //close and remove the connection
-    conn->close();
-    delete conn;
-    //remove this thread from active_threads and add it to done_threads.
-    thread_mutex.lock();
-    for (std::set<tthread::thread *>::iterator it = active_threads.begin(); it != active_threads.end(); it++){
-      if (( *it)->get_id() == tthread::this_thread::get_id()){
-        tthread::thread * T = ( *it);
-        active_threads.erase(T);
-        done_threads.insert(T);
-        break;
+    return true;
+  }
+
+  /// Sends the statistics of the segment cache and the amount of open connections to the controller every five seconds.
+  void handleStats(void * port){
+    std::string double_newline = "\n\n";
+    Socket::Connection StatsSocket = Socket::Connection("/tmp/mist/statistics", true);
+    while (stats_running){
+      Util::sleep(5000); //sleep five seconds
+      if ( !StatsSocket.connected()){
+        StatsSocket = Socket::Connection("/tmp/mist/statistics", true);
+      }
+      if (StatsSocket.connected()){
+        JSON::Value report;
+        report["http"]["port"] = (long long int) *((int*)port);
+        report["http"]["cache"] = segments.getStats();
+        unsigned int open, unused;
+        Reactors::upstreamCount(open, unused);
+        report["http"]["clients"] = (long long int)Reactors::clientCount();
+        report["http"]["upstreams"]["open"] = (long long int)open;
+        report["http"]["upstreams"]["idle"] = (long long int)unused;
+        std::string packet = report.toString();
+        StatsSocket.Send(packet);
+        StatsSocket.Send(double_newline);
+        StatsSocket.flush();
       }
     }
-    thread_mutex.unlock();
+    StatsSocket.close();
   }
 
 } //Connector_HTTP namespace
@@ -435,28 +286,54 @@ namespace Connector_HTTP {
 int main(int argc, char ** argv){
   Util::Config conf(argv[0], PACKAGE_VERSION);
   conf.addConnectorOptions(8080);
+  conf.addOption("workers",
+      JSON::fromString(
+          "{\"default\":0, \"arg\":\"integer\", \"help\":\"Amount of threads serving connections, zero for one per CPU core.\", \"short\":\"w\", \"long\":\"workers\"}"));
+  conf.addOption("proxy",
+      JSON::fromString(
+          "{\"default\":0, \"help\":\"Relay all responses of the sub-connectors, instead of handing client connections over to them.\", \"short\":\"x\", \"long\":\"proxy\"}"));
+  conf.addOption("cache",
+      JSON::fromString(
+          "{\"default\":64, \"arg\":\"integer\", \"help\":\"Megabytes of media segments kept in memory for all viewers, zero to disable.\", \"short\":\"c\", \"long\":\"cache\"}"));
+  conf.addOption("timeout",
+      JSON::fromString(
+          "{\"default\":20, \"arg\":\"integer\", \"help\":\"Seconds a sub-connector may take to answer a request.\", \"short\":\"t\", \"long\":\"timeout\"}"));
+  conf.addOption("idle",
+      JSON::fromString(
+          "{\"default\":15, \"arg\":\"integer\", \"help\":\"Seconds an unused connection to a sub-connector is kept open for reuse.\", \"short\":\"I\", \"long\":\"idle\"}"));
+  conf.addOption("keepalive",
+      JSON::fromString(
+          "{\"default\":30, \"arg\":\"integer\", \"help\":\"Seconds a client connection is kept open while waiting for its next request.\", \"short\":\"k\", \"long\":\"keepalive\"}"));
+  conf.addOption("routetimeouts",
+      JSON::fromString(
+          "{\"default\":\"\", \"arg\":\"string\", \"help\":\"Timeouts for some routes, as a comma separated list of name=timeout[:idle[:keepalive]] in seconds, where name is a connector or a route pattern.\", \"short\":\"T\", \"long\":\"routetimeouts\"}"));
+  conf.addOption("benchmark",
+      JSON::fromString(
+          "{\"default\":0, \"arg\":\"integer\", \"help\":\"Measure the request routing speed over the given amount of rounds through typical URLs and exit.\", \"short\":\"B\", \"long\":\"benchmark\"}"));
   conf.parseArgs(argc, argv);
+  Connector_HTTP::routes.setTimeouts(conf.getInteger("timeout") * 1000, conf.getInteger("idle") * 1000, conf.getInteger("keepalive") * 1000);
+  Connector_HTTP::addRoutes();
+  if ( !Connector_HTTP::routes.setTimeouts(conf.getString("routetimeouts"))){
+    std::cerr << "Could not apply route timeouts " << conf.getString("routetimeouts") << std::endl;
+    return 1;
+  }
+  if (conf.getInteger("benchmark") > 0){
+    return Connector_HTTP::benchmarkRoutes(conf.getInteger("benchmark"));
+  }
   Socket::Server server_socket = Socket::Server(conf.getInteger("listen_port"), conf.getString("listen_interface"));
   if ( !server_socket.connected()){
     return 1;
   }
   conf.activate();
+  Connector_HTTP::segments.setBudget((unsigned long long)conf.getInteger("cache") * 1024 * 1024);
+  int port = conf.getInteger("listen_port");
+  tthread::thread StatsThread(Connector_HTTP::handleStats, &port);
+  Connector_HTTP::Reactors::start(conf.getInteger("workers"), conf.getBool("proxy"));
 
   while (server_socket.connected() && conf.is_active){
     Socket::Connection S = server_socket.accept();
     if (S.connected()){ //check if the new connection is valid
-      //lock the thread mutex and spawn a new thread for this connection
-      Connector_HTTP::thread_mutex.lock();
-      tthread::thread * T = new tthread::thread(Connector_HTTP::Handle_HTTP_Connection, (void *)(new Socket::Connection(S)));
-      Connector_HTTP::active_threads.insert(T);
-      //clean up any threads that may have finished
-      while ( !Connector_HTTP::done_threads.empty()){
-        T = *Connector_HTTP::done_threads.begin();
-        T->join();
-        Connector_HTTP::done_threads.erase(T);
-        delete T;
-      }
-      Connector_HTTP::thread_mutex.unlock();
+      Connector_HTTP::Reactors::addClient(S);
     }else{
       Util::sleep(10); //sleep 10ms
     }
@@ -464,22 +341,12 @@ int main(int argc, char ** argv){
   server_socket.close();
 
   //wait for existing connections to drop
-  bool repeat = true;
-  while (repeat){
-    Connector_HTTP::thread_mutex.lock();
-    repeat = !Connector_HTTP::active_threads.empty();
-    //clean up any threads that may have finished
-    while ( !Connector_HTTP::done_threads.empty()){
-      tthread::thread * T = *Connector_HTTP::done_threads.begin();
-      T->join();
-      Connector_HTTP::done_threads.erase(T);
-      delete T;
-    }
-    Connector_HTTP::thread_mutex.unlock();
-    if (repeat){
-      Util::sleep(100); //sleep 100ms
-    }
+  while (Connector_HTTP::Reactors::clientCount() > 0){
+    Util::sleep(100); //sleep 100ms
   }
+  Connector_HTTP::Reactors::stop();
+  Connector_HTTP::stats_running = false;
+  StatsThread.join();
 
   return 0;
 } //main
@@ -0,0 +1,133 @@
+/// \file conn_http_cache.cpp
+/// Contains code for the cache of finished media segments in the HTTP connector.
+
+#include "conn_http_cache.h"
+#include "conn_http_reactor.h"
+
+Connector_HTTP::SegmentCache Connector_HTTP::segments;
+
+/// Creates an empty cache that holds nothing.
+Connector_HTTP::SegmentCache::SegmentCache(){
+  budget = 0;
+  bytes = 0;
+  hits = 0;
+  collapsed = 0;
+  misses = 0;
+  evictions = 0;
+}
+
+/// Sets the maximum amount of bytes held, zero disables the cache.
+void Connector_HTTP::SegmentCache::setBudget(unsigned long long bytes){
+  cache_mutex.lock();
+  budget = bytes;
+  cache_mutex.unlock();
+}
+
+/// Returns true if the cache holds anything at all.
+bool Connector_HTTP::SegmentCache::enabled(){
+  return budget > 0;
+}
+
+/// Looks up a segment, copying it to response on a hit.
+/// On a miss, the first caller gets FETCH and all callers after it get WAIT until that fetch is stored or aborted.
+Connector_HTTP::SegmentCache::Result Connector_HTTP::SegmentCache::lookup(const std::string & key, std::string & response, Reactor * R,
+    Client * C){
+  tthread::lock_guard<tthread::mutex> guard(cache_mutex);
+  std::map<std::string, Entry>::iterator it = entries.find(key);
+  if (it != entries.end()){
+    usage.splice(usage.begin(), usage, it->second.pos);
+    response = it->second.response;
+    hits++;
+    return HIT;
+  }
+  std::map<std::string, std::vector<Waiter> >::iterator fit = fetching.find(key);
+  if (fit != fetching.end()){
+    Waiter W;
+    W.R = R;
+    W.C = C;
+    fit->second.push_back(W);
+    collapsed++;
+    return WAIT;
+  }
+  fetching[key];
+  misses++;
+  return FETCH;
+}
+
+/// Stores a fetched segment and notifies everyone waiting for it.
+/// Segments larger than a quarter of the budget are not stored, the waiting clients fetch those themselves.
+void Connector_HTTP::SegmentCache::store(const std::string & key, const std::string & response){
+  std::vector<Waiter> waiters;
+  cache_mutex.lock();
+  if (fetching.count(key)){
+    waiters.swap(fetching[key]);
+    fetching.erase(key);
+  }
+  if ( !entries.count(key) && response.size() <= budget / 4){
+    while (bytes + response.size() > budget && !usage.empty()){
+      std::map<std::string, Entry>::iterator it = entries.find(usage.back());
+      bytes -= it->second.response.size();
+      entries.erase(it);
+      usage.pop_back();
+      evictions++;
+    }
+    usage.push_front(key);
+    Entry & E = entries[key];
+    E.response = response;
+    E.pos = usage.begin();
+    bytes += response.size();
+  }
+  notify(waiters);
+  cache_mutex.unlock();
+}
+
+/// Gives up on fetching a segment, notifying everyone waiting for it so they can try themselves.
+void Connector_HTTP::SegmentCache::abort(const std::string & key){
+  std::vector<Waiter> waiters;
+  cache_mutex.lock();
+  if (fetching.count(key)){
+    waiters.swap(fetching[key]);
+    fetching.erase(key);
+  }
+  notify(waiters);
+  cache_mutex.unlock();
+}
+
+/// Stops notifying the given client about the given segment, for clients that disconnected while waiting.
+void Connector_HTTP::SegmentCache::forget(const std::string & key, Client * C){
+  tthread::lock_guard<tthread::mutex> guard(cache_mutex);
+  std::map<std::string, std::vector<Waiter> >::iterator fit = fetching.find(key);
+  if (fit == fetching.end()){
+    return;
+  }
+  for (std::vector<Waiter>::iterator it = fit->second.begin(); it != fit->second.end(); it++){
+    if (it->C == C){
+      fit->second.erase(it);
+      return;
+    }
+  }
+}
+
+/// Returns the statistics of this cache.
+JSON::Value Connector_HTTP::SegmentCache::getStats(){
+  JSON::Value ret;
+  tthread::lock_guard<tthread::mutex> guard(cache_mutex);
+  ret["budget"] = (long long int)budget;
+  ret["bytes"] = (long long int)bytes;
+  ret["segments"] = (long long int)entries.size();
+  ret["hits"] = (long long int)hits;
+  ret["collapsed"] = (long long int)collapsed;
+  ret["misses"] = (long long int)misses;
+  ret["evictions"] = (long long int)evictions;
+  unsigned long long total = hits + collapsed + misses;
+  ret["hitratio"] = (long long int)(total ? ((hits + collapsed) * 100 / total) : 0);
+  return ret;
+}
+
+/// Tells the reactors of all given clients that the segment they waited for is available or will not be.
+/// Called with the cache locked, so a client can not be forgotten and deleted in between.
+void Connector_HTTP::SegmentCache::notify(std::vector<Waiter> & waiters){
+  for (std::vector<Waiter>::iterator it = waiters.begin(); it != waiters.end(); it++){
+    it->R->cacheReady(it->C);
+  }
+}
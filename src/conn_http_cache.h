@@ -0,0 +1,70 @@
+/// \file conn_http_cache.h
+/// Contains definitions for the cache of finished media segments in the HTTP connector.
+
+#pragma once
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <mist/json.h>
+#include "tinythread.h"
+
+namespace Connector_HTTP {
+  class Reactor;
+  class Client;
+
+  /// Shared cache of complete responses for media segments, so a segment is only built once by a sub-connector
+  /// no matter how many viewers request it. Keyed by connector and URL, which together name the stream, the
+  /// rendition and the fragment. Holds at most a fixed amount of bytes, evicting the least recently used
+  /// segments first. While a segment is being fetched, other requests for it wait for that fetch instead of
+  /// starting their own. Safe to use from all reactor threads at once.
+  class SegmentCache{
+    public:
+      /// Result of a lookup.
+      enum Result{
+        HIT, ///< The response was found and copied.
+        FETCH, ///< Not cached; the caller must fetch it and then call store() or abort().
+        WAIT ///< Another request is fetching it; the caller is notified through Reactor::cacheReady().
+      };
+      /// Creates an empty cache that holds nothing.
+      SegmentCache();
+      /// Sets the maximum amount of bytes held, zero disables the cache.
+      void setBudget(unsigned long long bytes);
+      /// Returns true if the cache holds anything at all.
+      bool enabled();
+      /// Looks up a segment, copying it to response on a hit.
+      Result lookup(const std::string & key, std::string & response, Reactor * R, Client * C);
+      /// Stores a fetched segment and notifies everyone waiting for it.
+      void store(const std::string & key, const std::string & response);
+      /// Gives up on fetching a segment, notifying everyone waiting for it so they can try themselves.
+      void abort(const std::string & key);
+      /// Stops notifying the given client about the given segment.
+      void forget(const std::string & key, Client * C);
+      /// Returns the statistics of this cache.
+      JSON::Value getStats();
+    private:
+      /// A client waiting for a segment that is being fetched.
+      struct Waiter{
+        Reactor * R; ///< Reactor serving the client.
+        Client * C; ///< The client itself.
+      };
+      /// A cached segment.
+      struct Entry{
+        std::string response; ///< The complete response.
+        std::list<std::string>::iterator pos; ///< Position in the usage list.
+      };
+      void notify(std::vector<Waiter> & waiters);
+      tthread::mutex cache_mutex; ///< Mutex for everything below.
+      unsigned long long budget; ///< Maximum amount of bytes held.
+      unsigned long long bytes; ///< Amount of bytes held.
+      std::map<std::string, Entry> entries; ///< All cached segments.
+      std::list<std::string> usage; ///< Keys of all cached segments, most recently used first.
+      std::map<std::string, std::vector<Waiter> > fetching; ///< Segments being fetched, with the clients waiting for them.
+      unsigned long long hits; ///< Requests answered from the cache.
+      unsigned long long collapsed; ///< Requests that waited for a fetch by another request.
+      unsigned long long misses; ///< Requests that had to fetch the segment.
+      unsigned long long evictions; ///< Segments evicted to stay within the budget.
+  };
+
+  extern SegmentCache segments; ///< The segment cache shared by all reactors.
+}
@@ -22,6 +22,8 @@
 #include <sstream>
 #include <mist/stream.h>
 #include <mist/timing.h>
+#include "conn_http_handover.h"
+#include "conn_http_reader.h"
 
 /// Holds everything unique to HTTP Dynamic Connector.
 namespace Connector_HTTP {
@@ -64,7 +66,11 @@ namespace Connector_HTTP {
       afrt.setFragmentRun(afrtrun, 0);
     }else{
       for (int i = 0; i < metadata["keytime"].size(); i++){
-        afrtrun.firstFragment = i + 1;
+        if (metadata.isMember("keynum")){
+          afrtrun.firstFragment = metadata["keynum"][i].asInt(); //live streams only list the keyframes still available
+        }else{
+          afrtrun.firstFragment = i + 1;
+        }
         afrtrun.firstTimestamp = metadata["keytime"][i].asInt();
         if (i + 1 < metadata["keytime"].size()){
           afrtrun.duration = metadata["keytime"][i + 1].asInt() - metadata["keytime"][i].asInt();
@@ -154,7 +160,8 @@ namespace Connector_HTTP {
   } //BuildManifest
 
   /// Main function for Connector_HTTP_Dynamic
-  int Connector_HTTP_Dynamic(Socket::Connection conn){
+  /// If handedOver is set, conn is a client handed over by the HTTP connector, with its address already set.
+  int Connector_HTTP_Dynamic(Socket::Connection conn, bool handedOver){
     std::deque<std::string> FlashBuf;
     int FlashBufSize = 0;
     long long int FlashBufTime = 0;
@@ -162,6 +169,8 @@ namespace Connector_HTTP {
 
     DTSC::Stream Strm; //Incoming stream buffer.
     HTTP::Parser HTTP_R, HTTP_S; //HTTP Receiver en HTTP Sender.
+    Reader reader; //collects requests from conn
+    std::string requestID; //identifier of the request being answered, if the HTTP connector numbered it
 
     bool ready4data = false; //Set to true when streaming is to begin.
     bool pending_manifest = false;
@@ -180,22 +189,15 @@ namespace Connector_HTTP {
     conn.setBlocking(false); //do not block on conn.spool() when no data is available
 
     while (conn.connected()){
-      if (conn.spool() || conn.Received().size()){
-        //make sure it ends in a \n
-        if ( *(conn.Received().get().rbegin()) != '\n'){
-          std::string tmp = conn.Received().get();
-          conn.Received().get().clear();
-          if (conn.Received().size()){
-            conn.Received().get().insert(0, tmp);
-          }else{
-            conn.Received().append(tmp);
-          }
-        }
-        if (HTTP_R.Read(conn.Received().get())){
+      if (conn.spool() || conn.Received().size() || reader.ready()){
+        if (reader.read(conn, HTTP_R)){
 #if DEBUG >= 4
           std::cout << "Received request: " << HTTP_R.getUrl() << std::endl;
 #endif
-          conn.setHost(HTTP_R.GetHeader("X-Origin"));
+          requestID = HTTP_R.GetHeader(REQUEST_ID_HEADER);
+          if (!handedOver && HTTP_R.GetHeader("X-Origin") != ""){ //set by the HTTP connector on relayed requests, sent by the client itself after a handover
+            conn.setHost(HTTP_R.GetHeader("X-Origin"));
+          }
           if (HTTP_R.url.find("f4m") == std::string::npos){
             streamname = HTTP_R.url.substr(1, HTTP_R.url.find("/", 1) - 1);
             if ( !ss){
@@ -207,6 +209,7 @@ namespace Connector_HTTP {
                 ss.close();
                 HTTP_S.Clean();
                 HTTP_S.SetBody("No such stream is available on the system. Please try again.\n");
+                tagResponse(HTTP_S, requestID);
                 conn.SendNow(HTTP_S.BuildResponse("404", "Not found"));
                 ready4data = false;
                 continue;
@@ -238,6 +241,7 @@ namespace Connector_HTTP {
               }
               std::string manifest = BuildManifest(streamname, Strm.metadata);
               HTTP_S.SetBody(manifest);
+              tagResponse(HTTP_S, requestID);
               conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
 #if DEBUG >= 3
               printf("Sent manifest\n");
@@ -268,6 +272,7 @@ namespace Connector_HTTP {
             ss.close();
             HTTP_S.Clean();
             HTTP_S.SetBody("No such stream is available on the system. Please try again.\n");
+            tagResponse(HTTP_S, requestID);
             conn.SendNow(HTTP_S.BuildResponse("404", "Not found"));
             ready4data = false;
             continue;
@@ -304,6 +309,7 @@ namespace Connector_HTTP {
               }
               std::string manifest = BuildManifest(streamname, Strm.metadata);
               HTTP_S.SetBody(manifest);
+              tagResponse(HTTP_S, requestID);
               conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
 #if DEBUG >= 3
               printf("Sent manifest\n");
@@ -327,6 +333,7 @@ namespace Connector_HTTP {
                 HTTP_S.SetHeader("Content-Type", "video/mp4");
                 HTTP_S.SetBody("");
                 HTTP_S.SetHeader("Content-Length", FlashBufSize + 8); //32+33+btstrp.size());
+                tagResponse(HTTP_S, requestID);
                 conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
                 //conn.SendNow("\x00\x00\x00\x21" "afra\x00\x00\x00\x00\x00\x00\x00\x03\xE8\x00\x00\x00\x01", 21);
                 //unsigned long tmptime = htonl(FlashBufTime << 32);
@@ -387,6 +394,7 @@ namespace Connector_HTTP {
             }
             std::string manifest = BuildManifest(streamname, Strm.metadata);
             HTTP_S.SetBody(manifest);
+            tagResponse(HTTP_S, requestID);
             conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
 #if DEBUG >= 3
             printf("Sent manifest\n");
@@ -422,7 +430,9 @@ int main(int argc, char ** argv){
     if (S.connected()){ //check if the new connection is valid
       pid_t myid = fork();
       if (myid == 0){ //if new child, start MAINHANDLER
-        return Connector_HTTP::Connector_HTTP_Dynamic(S);
+        bool handedOver;
+        Socket::Connection C = Connector_HTTP::takeOver(S, handedOver);
+        return Connector_HTTP::Connector_HTTP_Dynamic(C, handedOver);
       }else{ //otherwise, do nothing or output debugging text
 #if DEBUG >= 3
         fprintf(stderr, "Spawned new process %i for socket %i\n", (int)myid, S.getSocket());
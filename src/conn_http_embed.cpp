@@ -0,0 +1,218 @@
+/// \file conn_http_embed.cpp
+/// Contains code for the cache of generated info and embed code in the HTTP connector.
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <zlib.h>
+#include <mist/config.h>
+#include <mist/timing.h>
+#include "conn_http_embed.h"
+#include "conn_http_reactor.h"
+#include "embed.js.h"
+
+Connector_HTTP::EmbedCache Connector_HTTP::embeds;
+
+/// Returns the given data gzip compressed, or an empty string if compression failed.
+static std::string gzipCompress(const std::string & in){
+  z_stream strm;
+  memset( &strm, 0, sizeof(strm));
+  if (deflateInit2( &strm, Z_BEST_COMPRESSION, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK){ //31 = 15 bit window plus gzip header
+    return "";
+  }
+  std::string out;
+  out.resize(deflateBound( &strm, in.size()));
+  strm.next_in = (Bytef*)in.data();
+  strm.avail_in = in.size();
+  strm.next_out = (Bytef*) &out[0];
+  strm.avail_out = out.size();
+  if (deflate( &strm, Z_FINISH) == Z_STREAM_END){
+    out.resize(strm.total_out);
+  }else{
+    out.clear();
+  }
+  deflateEnd( &strm);
+  return out;
+}
+
+/// Returns a quoted entity tag for the given data, a 64 bit FNV-1a hash.
+static std::string makeETag(const std::string & data){
+  unsigned long long hash = 14695981039346656037ULL;
+  for (unsigned int i = 0; i < data.size(); i++){
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+  char tag[20];
+  snprintf(tag, 20, "\"%016llx\"", hash);
+  return tag;
+}
+
+/// Creates an empty cache and starts watching the stream list.
+Connector_HTTP::EmbedCache::EmbedCache(){
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  watch_fd = -1;
+  lastWatch = 0;
+  loaded = false;
+}
+
+/// Stops watching the stream list.
+Connector_HTTP::EmbedCache::~EmbedCache(){
+  if (inotify_fd >= 0){
+    close(inotify_fd);
+  }
+}
+
+/// Reads all pending inotify events, dropping the cache if the stream list changed.
+/// Adds the watch if it is missing, at most once per second, since the directory may not exist yet.
+/// Returns true if the stream list is being watched, so responses may be cached.
+/// Must be called with embed_mutex locked.
+bool Connector_HTTP::EmbedCache::checkChanges(){
+  if (inotify_fd < 0){
+    return false;
+  }
+  bool changed = false;
+  if (watch_fd < 0){
+    if (Util::getMS() - lastWatch < 1000){
+      return false;
+    }
+    lastWatch = Util::getMS();
+    watch_fd = inotify_add_watch(inotify_fd, "/tmp/mist", IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (watch_fd < 0){
+      return false;
+    }
+    changed = true; //anything may have happened while not watching
+  }
+  char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  int r;
+  while ((r = read(inotify_fd, buffer, sizeof(buffer))) > 0){
+    for (char * p = buffer; p < buffer + r; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len){
+      struct inotify_event * event = (struct inotify_event*)p;
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)){
+        watch_fd = -1; //the directory is gone, watch it again once it is back
+        changed = true;
+      }
+      if (event->mask & IN_Q_OVERFLOW){
+        changed = true;
+      }
+      if (event->len && strcmp(event->name, "streamlist") == 0){
+        changed = true;
+      }
+    }
+  }
+  if (changed){
+    loaded = false;
+    entries.clear();
+  }
+  return watch_fd >= 0;
+}
+
+/// Generates the info or embed code for the given stream as seen from the given host, from the stream list.
+void Connector_HTTP::EmbedCache::build(Entry & E, std::string & streamname, std::string & host, bool embed){
+  JSON::Value & ServConf = streamlist;
+  std::string response = "// Generating info code for stream " + streamname + "\n\nif (!mistvideo){var mistvideo = {};}\n";
+  JSON::Value json_resp;
+  if (ServConf["streams"].isMember(streamname) && ServConf["config"]["protocols"].size() > 0){
+    json_resp["width"] = ServConf["streams"][streamname]["meta"]["video"]["width"].asInt();
+    json_resp["height"] = ServConf["streams"][streamname]["meta"]["video"]["height"].asInt();
+    //first, see if we have RTMP working and output all the RTMP.
+    for (JSON::ArrIter it = ServConf["config"]["protocols"].ArrBegin(); it != ServConf["config"]["protocols"].ArrEnd(); it++){
+      if (( *it)["connector"].asString() == "RTMP"){
+        JSON::Value tmp;
+        tmp["type"] = "rtmp";
+        tmp["url"] = "rtmp://" + host + ":" + ( *it)["port"].asString() + "/play/" + streamname;
+        json_resp["source"].append(tmp);
+      }
+    }
+    //then, see if we have HTTP working and output all the dynamic.
+    for (JSON::ArrIter it = ServConf["config"]["protocols"].ArrBegin(); it != ServConf["config"]["protocols"].ArrEnd(); it++){
+      if (( *it)["connector"].asString() == "HTTP"){
+        JSON::Value tmp;
+        tmp["type"] = "f4v";
+        tmp["url"] = "http://" + host + ":" + ( *it)["port"].asString() + "/" + streamname + "/manifest.f4m";
+        json_resp["source"].append(tmp);
+      }
+    }
+    //and all the progressive.
+    for (JSON::ArrIter it = ServConf["config"]["protocols"].ArrBegin(); it != ServConf["config"]["protocols"].ArrEnd(); it++){
+      if (( *it)["connector"].asString() == "HTTP"){
+        JSON::Value tmp;
+        tmp["type"] = "flv";
+        tmp["url"] = "http://" + host + ":" + ( *it)["port"].asString() + "/" + streamname + ".flv";
+        json_resp["source"].append(tmp);
+      }
+    }
+  }else{
+    json_resp["error"] = "The specified stream is not available on this server.";
+    json_resp["bbq"] = "sauce"; //for legacy purposes ^_^
+  }
+  response += "mistvideo['" + streamname + "'] = " + json_resp.toString() + ";\n";
+  if (embed && !json_resp.isMember("error")){
+    response.append("\n(");
+    response.append((char*)embed_js, (size_t)embed_js_len - 2); //remove trailing ";\n" from xxd conversion
+    response.append("(\"" + streamname + "\"));\n");
+  }
+  E.body = response;
+  E.gzipped = gzipCompress(response);
+  E.etag = makeETag(response);
+}
+
+/// Answers the current request of the given client with the info or embed code for the given stream.
+/// Answers 304 if the client already has the current version, and sends the compressed variant if the client accepts it.
+void Connector_HTTP::EmbedCache::serve(HTTP::Parser & H, Client * C, std::string & streamname, bool embed){
+  std::string host = H.GetHeader("Host");
+  if (host.find(':') != std::string::npos){
+    host.resize(host.find(':'));
+  }
+  bool gzip = H.GetHeader("Accept-Encoding").find("gzip") != std::string::npos;
+  std::string match = H.GetHeader("If-None-Match");
+  std::string key = (embed ? "embed " : "info ") + streamname + " " + host;
+
+  std::string body;
+  std::string etag;
+  embed_mutex.lock();
+  bool caching = checkChanges();
+  if ( !caching || !loaded){
+    streamlist = JSON::fromFile("/tmp/mist/streamlist");
+    loaded = caching && streamlist.isMember("config"); //a half written stream list is read again next time
+  }
+  Entry uncached;
+  Entry * E = &uncached;
+  std::map<std::string, Entry>::iterator it = entries.find(key);
+  if (it != entries.end()){
+    E = &it->second;
+  }else{
+    if (loaded){
+      if (entries.size() >= EMBED_CACHE_MAX){
+        entries.clear();
+      }
+      E = &entries[key];
+    }
+    build( *E, streamname, host, embed);
+  }
+  if (gzip && E->gzipped.size()){
+    body = E->gzipped;
+    etag = E->etag;
+    etag.insert(etag.size() - 1, "-gz");
+  }else{
+    gzip = false;
+    body = E->body;
+    etag = E->etag;
+  }
+  embed_mutex.unlock();
+
+  H.Clean();
+  H.SetHeader("Server", "mistserver/" PACKAGE_VERSION "/" + Util::Config::libver);
+  H.SetHeader("Content-Type", "application/javascript");
+  H.SetHeader("ETag", etag);
+  H.SetHeader("Vary", "Accept-Encoding");
+  if (match.find(etag) != std::string::npos){
+    C->send(H.BuildResponse("304", "Not Modified"));
+    return;
+  }
+  if (gzip){
+    H.SetHeader("Content-Encoding", "gzip");
+  }
+  H.SetBody(body);
+  C->send(H.BuildResponse("200", "OK"));
+}
@@ -0,0 +1,48 @@
+/// \file conn_http_embed.h
+/// Contains definitions for the cache of generated info and embed code in the HTTP connector.
+
+#pragma once
+#include <map>
+#include <string>
+#include <mist/json.h>
+#include <mist/http_parser.h>
+#include "tinythread.h"
+
+/// Maximum amount of generated responses kept; the cache is emptied when another one is needed.
+#define EMBED_CACHE_MAX 1024
+
+namespace Connector_HTTP {
+  class Client;
+
+  /// Cache of the generated /info_ and /embed_ javascript, per stream and host name.
+  /// The stream list is only read again after inotify reports it changed, which also drops all cached responses.
+  /// Every response carries an ETag and is kept gzip compressed as well. Without inotify, nothing is cached.
+  /// Safe to use from all reactor threads at once.
+  class EmbedCache{
+    public:
+      /// Creates an empty cache and starts watching the stream list.
+      EmbedCache();
+      /// Stops watching the stream list.
+      ~EmbedCache();
+      /// Answers the current request of the given client with the info or embed code for the given stream.
+      void serve(HTTP::Parser & H, Client * C, std::string & streamname, bool embed);
+    private:
+      /// A generated response.
+      struct Entry{
+        std::string body; ///< The javascript itself.
+        std::string gzipped; ///< The javascript gzip compressed, empty if compression failed.
+        std::string etag; ///< Entity tag of body; the compressed variant appends "-gz" to it.
+      };
+      bool checkChanges();
+      void build(Entry & E, std::string & streamname, std::string & host, bool embed);
+      tthread::mutex embed_mutex; ///< Mutex for everything below.
+      int inotify_fd; ///< Non-blocking inotify descriptor, -1 if unavailable.
+      int watch_fd; ///< Watch on the directory holding the stream list, -1 if not watching.
+      long long int lastWatch; ///< Time of the last attempt to add the watch, in milliseconds.
+      bool loaded; ///< Whether streamlist holds the current contents of the stream list.
+      JSON::Value streamlist; ///< The parsed stream list.
+      std::map<std::string, Entry> entries; ///< Generated responses by kind, stream and host.
+  };
+
+  extern EmbedCache embeds; ///< The info and embed code cache shared by all reactors.
+}
@@ -0,0 +1,117 @@
+/// \file conn_http_handover.cpp
+/// Contains code for handing client connections from the HTTP connector to sub-connectors.
+/// A handover starts with HANDOVER_MAGIC and the lengths of the client address and of the data that follow, as
+/// 32 bits big endian integers, sent in a single message that carries the client socket as SCM_RIGHTS ancillary data.
+/// The address is the one the HTTP connector accepted the client from. The data is the request, already rebuilt by
+/// the HTTP connector, plus anything the client sent after it.
+
+#include <cstring>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "conn_http_handover.h"
+
+/// Passes the client socket fd over the given unix socket, followed by its address and the data already read from it.
+/// Blocks until everything was sent. Returns false if the sub-connector could not be reached.
+/// The caller still holds its own copy of fd, which it should close without shutting the connection down.
+bool Connector_HTTP::handOver(Socket::Connection & target, int fd, const std::string & origin, const std::string & data){
+  char head[12];
+  memcpy(head, HANDOVER_MAGIC, 4);
+  unsigned int len = htonl(origin.size());
+  memcpy(head + 4, &len, 4);
+  len = htonl(data.size());
+  memcpy(head + 8, &len, 4);
+  struct iovec iov;
+  iov.iov_base = head;
+  iov.iov_len = 12;
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset( &msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr * cmsg = CMSG_FIRSTHDR( &msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  int r;
+  do{
+    r = sendmsg(target.getSocket(), &msg, MSG_NOSIGNAL);
+  }while (r < 0 && errno == EINTR);
+  if (r != 12){
+    return false;
+  }
+  target.SendNow(origin + data);
+  return target.connected();
+}
+
+/// Returns the client connection handed over through the given newly accepted connection, if any.
+/// Blocks until the complete handover was read. The handed over data is put in the received buffer of the
+/// returned connection, so it is handled like anything the client sends later on.
+/// The address of the client is taken from the handover, so handedOver is set to tell the caller to ignore any
+/// X-Origin header the client sends itself. Connections that do not start with a handover are returned as they
+/// are, with the bytes read put back and handedOver cleared.
+Socket::Connection Connector_HTTP::takeOver(Socket::Connection & from, bool & handedOver){
+  handedOver = false;
+  char head[12];
+  struct iovec iov;
+  iov.iov_base = head;
+  iov.iov_len = 12;
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+  memset( &msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  int r;
+  do{
+    r = recvmsg(from.getSocket(), &msg, MSG_WAITALL);
+  }while (r < 0 && errno == EINTR);
+  if (r <= 0){
+    return from;
+  }
+  struct cmsghdr * cmsg = CMSG_FIRSTHDR( &msg);
+  if (r < 12 || memcmp(head, HANDOVER_MAGIC, 4) != 0 || !cmsg || cmsg->cmsg_type != SCM_RIGHTS){
+    from.Received().append(head, r); //a plain request, relayed through the HTTP connector
+    return from;
+  }
+  int fd;
+  memcpy( &fd, CMSG_DATA(cmsg), sizeof(int));
+  unsigned int originLen, len;
+  memcpy( &originLen, head + 4, 4);
+  memcpy( &len, head + 8, 4);
+  originLen = ntohl(originLen);
+  len = originLen + ntohl(len);
+  std::string data(len, '\0');
+  unsigned int done = 0;
+  while (done < len){
+    r = recv(from.getSocket(), (char*)data.data() + done, len - done, 0);
+    if (r < 0 && errno == EINTR){
+      continue;
+    }
+    if (r <= 0){
+      close(fd);
+      return from;
+    }
+    done += r;
+  }
+  from.close();
+  Socket::Connection client(fd);
+  client.setHost(data.substr(0, originLen));
+  client.Received().append(data.substr(originLen));
+  handedOver = true;
+  return client;
+}
+
+/// Echoes the identifier of the request being answered on its response, if the request had one.
+/// The HTTP connector checks it to make sure the response belongs to the request it is waiting for.
+void Connector_HTTP::tagResponse(HTTP::Parser & H, const std::string & requestID){
+  if (requestID != ""){
+    H.SetHeader(REQUEST_ID_HEADER, requestID);
+  }
+}
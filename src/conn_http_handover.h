@@ -0,0 +1,21 @@
+/// \file conn_http_handover.h
+/// Contains definitions for handing client connections from the HTTP connector to sub-connectors.
+
+#pragma once
+#include <string>
+#include <mist/socket.h>
+#include <mist/http_parser.h>
+
+/// Marks the start of a handed over connection on a sub-connector socket.
+#define HANDOVER_MAGIC "MHnd"
+/// Header numbering the requests the HTTP connector forwards over its pooled connections, echoed on the responses.
+#define REQUEST_ID_HEADER "X-Request-ID"
+
+namespace Connector_HTTP {
+  /// Passes the client socket fd over the given unix socket, followed by its address and the data already read from it.
+  bool handOver(Socket::Connection & target, int fd, const std::string & origin, const std::string & data);
+  /// Returns the client connection handed over through the given newly accepted connection, if any.
+  Socket::Connection takeOver(Socket::Connection & from, bool & handedOver);
+  /// Echoes the identifier of the request being answered on its response, if the request had one.
+  void tagResponse(HTTP::Parser & H, const std::string & requestID);
+}
@@ -22,6 +22,8 @@
 #include <mist/stream.h>
 #include <mist/timing.h>
 #include <mist/ts_packet.h>
+#include "conn_http_handover.h"
+#include "conn_http_reader.h"
 
 /// Holds everything unique to HTTP Connectors.
 namespace Connector_HTTP {
@@ -81,12 +83,15 @@ namespace Connector_HTTP {
   } //BuildIndex
 
   /// Main function for Connector_HTTP_Live
-  int Connector_HTTP_Live(Socket::Connection conn){
+  /// If handedOver is set, conn is a client handed over by the HTTP connector, with its address already set.
+  int Connector_HTTP_Live(Socket::Connection conn, bool handedOver){
     std::stringstream TSBuf;
     long long int TSBufTime = 0;
 
     DTSC::Stream Strm; //Incoming stream buffer.
     HTTP::Parser HTTP_R, HTTP_S; //HTTP Receiver en HTTP Sender.
+    Reader reader; //collects requests from conn
+    std::string requestID; //identifier of the request being answered, if the HTTP connector numbered it
 
     bool ready4data = false; //Set to true when streaming is to begin.
     bool pending_manifest = false;
@@ -122,22 +127,15 @@ namespace Connector_HTTP {
     conn.setBlocking(false); //do not block on conn.spool() when no data is available
 
     while (conn.connected()){
-      if (conn.spool() || conn.Received().size()){
-        //make sure it ends in a \n
-        if ( *(conn.Received().get().rbegin()) != '\n'){
-          std::string tmp = conn.Received().get();
-          conn.Received().get().clear();
-          if (conn.Received().size()){
-            conn.Received().get().insert(0, tmp);
-          }else{
-            conn.Received().append(tmp);
-          }
-        }
-        if (HTTP_R.Read(conn.Received().get())){
+      if (conn.spool() || conn.Received().size() || reader.ready()){
+        if (reader.read(conn, HTTP_R)){
 #if DEBUG >= 4
           std::cout << "Received request: " << HTTP_R.getUrl() << std::endl;
 #endif
-          conn.setHost(HTTP_R.GetHeader("X-Origin"));
+          requestID = HTTP_R.GetHeader(REQUEST_ID_HEADER);
+          if (!handedOver && HTTP_R.GetHeader("X-Origin") != ""){ //set by the HTTP connector on relayed requests, sent by the client itself after a handover
+            conn.setHost(HTTP_R.GetHeader("X-Origin"));
+          }
           if (HTTP_R.url.find(".m3u") == std::string::npos){
             streamname = HTTP_R.url.substr(5, HTTP_R.url.find("/", 5) - 5);
             if ( !ss){
@@ -148,6 +146,7 @@ namespace Connector_HTTP {
 #endif
                 HTTP_S.Clean();
                 HTTP_S.SetBody("No such stream is available on the system. Please try again.\n");
+                tagResponse(HTTP_S, requestID);
                 conn.SendNow(HTTP_S.BuildResponse("404", "Not found"));
                 ready4data = false;
                 continue;
@@ -183,6 +182,7 @@ namespace Connector_HTTP {
               }
               std::string manifest = BuildIndex(streamname, Strm.metadata);
               HTTP_S.SetBody(manifest);
+              tagResponse(HTTP_S, requestID);
               conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
 #if DEBUG >= 3
               printf("Sent index\n");
@@ -213,6 +213,7 @@ namespace Connector_HTTP {
             ss.close();
             HTTP_S.Clean();
             HTTP_S.SetBody("No such stream is available on the system. Please try again.\n");
+            tagResponse(HTTP_S, requestID);
             conn.SendNow(HTTP_S.BuildResponse("404", "Not found"));
             ready4data = false;
             continue;
@@ -251,6 +252,7 @@ namespace Connector_HTTP {
               HTTP_S.SetHeader("Content-Type", manifestType);
               HTTP_S.SetHeader("Connection", "keep-alive");
               HTTP_S.SetBody(manifest);
+              tagResponse(HTTP_S, requestID);
               conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
 #if DEBUG >= 3
               printf("Sent manifest\n");
@@ -275,6 +277,7 @@ namespace Connector_HTTP {
                 HTTP_S.SetHeader("Connection", "keep-alive");
                 HTTP_S.SetBody("");
                 HTTP_S.SetHeader("Content-Length", TSBuf.str().size());
+                tagResponse(HTTP_S, requestID);
                 conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
                 conn.SendNow(TSBuf.str().c_str(), TSBuf.str().size());
                 TSBuf.str("");
@@ -395,6 +398,7 @@ namespace Connector_HTTP {
             HTTP_S.SetHeader("Connection", "keep-alive");
             std::string manifest = BuildIndex(streamname, Strm.metadata);
             HTTP_S.SetBody(manifest);
+            tagResponse(HTTP_S, requestID);
             conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
 #if DEBUG >= 3
             printf("Sent index\n");
@@ -442,7 +446,9 @@ int main(int argc, char ** argv){
     if (S.connected()){ //check if the new connection is valid
       pid_t myid = fork();
       if (myid == 0){ //if new child, start MAINHANDLER
-        return Connector_HTTP::Connector_HTTP_Live(S);
+        bool handedOver;
+        Socket::Connection C = Connector_HTTP::takeOver(S, handedOver);
+        return Connector_HTTP::Connector_HTTP_Live(C, handedOver);
       }else{ //otherwise, do nothing or output debugging text
 #if DEBUG >= 3
         fprintf(stderr, "Spawned new process %i for socket %i\n", (int)myid, S.getSocket());
@@ -19,18 +19,28 @@
 #include <mist/config.h>
 #include <mist/stream.h>
 #include <mist/timing.h>
+#include "buffer_shm.h"
+#include "buffer_stats.h"
+#include "conn_http_handover.h"
+#include "conn_http_reader.h"
 
 /// Holds everything unique to HTTP Progressive Connector.
 namespace Connector_HTTP {
 
   /// Main function for Connector_HTTP_Progressive
-  int Connector_HTTP_Progressive(Socket::Connection conn){
+  /// If handedOver is set, conn is a client handed over by the HTTP connector, with its address already set.
+  int Connector_HTTP_Progressive(Socket::Connection conn, bool handedOver){
     bool progressive_has_sent_header = false;
     bool ready4data = false; ///< Set to true when streaming is to begin.
     DTSC::Stream Strm; ///< Incoming stream buffer.
     HTTP::Parser HTTP_R, HTTP_S; ///<HTTP Receiver en HTTP Sender.
+    Reader reader; ///< Collects requests from conn.
+    std::string requestID; ///< Identifier of the request being answered, if the HTTP connector numbered it.
     bool inited = false;
     Socket::Connection ss( -1);
+    Buffer::ShmReader shm; ///< Shared memory of the buffer, if available.
+    Buffer::StatsWriter stats; ///< Statistics slot in shared memory of the buffer, if available.
+    long long int started = Util::epoch();
     std::string streamname;
     FLV::Tag tag; ///< Temporary tag buffer.
 
@@ -43,22 +53,15 @@ namespace Connector_HTTP {
     while (conn.connected()){
       //only parse input if available or not yet init'ed
       if ( !inited){
-        if (conn.Received().size() || conn.spool()){
-          //make sure it ends in a \n
-          if ( *(conn.Received().get().rbegin()) != '\n'){
-            std::string tmp = conn.Received().get();
-            conn.Received().get().clear();
-            if (conn.Received().size()){
-              conn.Received().get().insert(0, tmp);
-            }else{
-              conn.Received().append(tmp);
-            }
-          }
-          if (HTTP_R.Read(conn.Received().get())){
+        if (conn.Received().size() || conn.spool() || reader.ready()){
+          if (reader.read(conn, HTTP_R)){
 #if DEBUG >= 4
             std::cout << "Received request: " << HTTP_R.getUrl() << std::endl;
 #endif
-            conn.setHost(HTTP_R.GetHeader("X-Origin"));
+            requestID = HTTP_R.GetHeader(REQUEST_ID_HEADER);
+            if (!handedOver && HTTP_R.GetHeader("X-Origin") != ""){ //set by the HTTP connector on relayed requests, sent by the client itself after a handover
+              conn.setHost(HTTP_R.GetHeader("X-Origin"));
+            }
             //we assume the URL is the stream name with a 3 letter extension
             streamname = HTTP_R.getUrl().substr(1);
             size_t extDot = streamname.rfind('.');
@@ -106,6 +109,7 @@ namespace Connector_HTTP {
             ss.close();
             HTTP_S.Clean();
             HTTP_S.SetBody("No such stream is available on the system. Please try again.\n");
+            tagResponse(HTTP_S, requestID);
             conn.SendNow(HTTP_S.BuildResponse("404", "Not found"));
             ready4data = false;
             continue;
@@ -113,7 +117,7 @@ namespace Connector_HTTP {
           if (seek_byte){
             //wait until we have a header
             while ( !Strm.metadata){
-              if (ss.spool()){
+              if (shm.spool(ss)){
                 Strm.parsePacket(ss.Received()); //read the metadata
               }else{
                 Util::sleep(5);
@@ -132,7 +136,12 @@ namespace Connector_HTTP {
             std::stringstream cmd;
             cmd << "s " << seek_sec << "\n";
             ss.SendNow(cmd.str().c_str());
+          }else{
+            if (shm.open(streamname)){
+              ss.SendNow("M\n"); //receive packets through shared memory instead
+            }
           }
+          stats.open(streamname, ss); //report statistics through shared memory, if possible
 #if DEBUG >= 3
           fprintf(stderr, "Everything connected, starting to send video data...\n");
 #endif
@@ -142,9 +151,9 @@ namespace Connector_HTTP {
         unsigned int now = Util::epoch();
         if (now != lastStats){
           lastStats = now;
-          ss.SendNow(conn.getStats("HTTP_Progressive").c_str());
+          stats.send(ss, conn.getHost(), "HTTP_Progressive", now - started, conn.dataUp(), conn.dataDown());
         }
-        if (ss.spool()){
+        if (shm.spool(ss)){
           while (Strm.parsePacket(ss.Received())){
             if ( !progressive_has_sent_header){
               HTTP_S.Clean(); //make sure no parts of old requests are left in any buffers
@@ -155,6 +164,7 @@ namespace Connector_HTTP {
                }
               //HTTP_S.SetHeader("Transfer-Encoding", "chunked");
               HTTP_S.protocol = "HTTP/1.0";
+              tagResponse(HTTP_S, requestID);
               conn.SendNow(HTTP_S.BuildResponse("200", "OK")); //no SetBody = unknown length - this is intentional, we will stream the entire file
               if ( !isMP3){
                  conn.SendNow(FLV::Header, 13); //write FLV header
@@ -195,7 +205,7 @@ namespace Connector_HTTP {
       }
     }
     conn.close();
-    ss.SendNow(conn.getStats("HTTP_Dynamic").c_str());
+    stats.send(ss, conn.getHost(), "HTTP_Progressive", Util::epoch() - started, conn.dataUp(), conn.dataDown());
     ss.close();
     return 0;
   } //Connector_HTTP main function
@@ -217,7 +227,9 @@ int main(int argc, char ** argv){
     if (S.connected()){ //check if the new connection is valid
       pid_t myid = fork();
       if (myid == 0){ //if new child, start MAINHANDLER
-        return Connector_HTTP::Connector_HTTP_Progressive(S);
+        bool handedOver;
+        Socket::Connection C = Connector_HTTP::takeOver(S, handedOver);
+        return Connector_HTTP::Connector_HTTP_Progressive(C, handedOver);
       }else{ //otherwise, do nothing or output debugging text
 #if DEBUG >= 3
         fprintf(stderr, "Spawned new process %i for socket %i\n", (int)myid, S.getSocket());
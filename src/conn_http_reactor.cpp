@@ -0,0 +1,889 @@
+/// \file conn_http_reactor.cpp
+/// Contains code for the event driven HTTP front end.
+
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <mist/config.h>
+#include <mist/timing.h>
+#include "conn_http_reactor.h"
+#include "conn_http_handover.h"
+#include "conn_http_cache.h"
+
+/// Wraps the given connection, making it non-blocking.
+Connector_HTTP::Client::Client(Socket::Connection c){
+  conn = c;
+  conn.setBlocking(false);
+  fd = conn.getSocket();
+  upstream = 0;
+  route = 0;
+  timer.owner = this;
+  timer.kind = CLIENT_TIMER;
+  closing = false;
+  cacheWait = false;
+  queued = false;
+  polling = false;
+  outPos = 0;
+}
+
+/// Queues data for sending and sends as much of it as the socket accepts right away.
+void Connector_HTTP::Client::send(const std::string & data){
+  out.append(data);
+  flush();
+}
+
+/// Sends as much of the queued data as the socket accepts. Returns true if nothing is left.
+/// Sent data is only erased from the queue once it makes up most of it, so large queues are not moved for every write.
+bool Connector_HTTP::Client::flush(){
+  while (outPos < out.size() && conn.connected()){
+    int r = conn.iwrite(out.data() + outPos, out.size() - outPos);
+    if (r <= 0){
+      break;
+    }
+    outPos += r;
+  }
+  if (outPos == out.size()){
+    out.clear();
+    outPos = 0;
+    return true;
+  }
+  if (outPos > 65536 && outPos > out.size() / 2){
+    out.erase(0, outPos);
+    outPos = 0;
+  }
+  return false;
+}
+
+/// Returns the amount of queued bytes not sent yet.
+unsigned int Connector_HTTP::Client::pending(){
+  return out.size() - outPos;
+}
+
+/// Connects to the given sub-connector, without blocking on reads.
+Connector_HTTP::Upstream::Upstream(std::string uid, std::string connector){
+  conn = Socket::Connection("/tmp/mist/http_" + connector);
+  conn.setBlocking(false);
+  fd = conn.getSocket();
+  this->uid = uid;
+  client = 0;
+  route = 0;
+  busy = false;
+  relaying = false;
+  paused = false;
+  pipe_fds[0] = -1;
+  pipe_fds[1] = -1;
+  inPipe = 0;
+  timer.owner = this;
+  timer.kind = UPSTREAM_TIMER;
+}
+
+/// Creates an empty pool.
+Connector_HTTP::UpstreamPool::UpstreamPool(){
+  open = 0;
+}
+
+/// Creates the epoll and wakeup descriptors and starts the reactor thread.
+Connector_HTTP::Reactor::Reactor(bool proxy){
+  running = true;
+  this->proxy = proxy;
+  count = 0;
+  openUpstreams = 0;
+  idleUpstreams = 0;
+  lastRequestID = 0;
+  epoll_fd = epoll_create(REACTOR_EVENTS);
+  wake_fd = eventfd(0, EFD_NONBLOCK);
+  watch(wake_fd, EPOLLIN, true);
+  Thread = new tthread::thread(run, (void *)this);
+}
+
+/// Stops the reactor thread and closes all descriptors.
+Connector_HTTP::Reactor::~Reactor(){
+  stop();
+  close(wake_fd);
+  close(epoll_fd);
+}
+
+/// Hands a client connection over to this reactor.
+void Connector_HTTP::Reactor::addClient(Socket::Connection & conn){
+  add_mutex.lock();
+  newClients.push_back(conn);
+  count++;
+  add_mutex.unlock();
+  wake();
+}
+
+/// Signals that the segment the given client waited for was stored or will not be, from any thread.
+/// The reactor thread then looks it up again, and fetches it itself if it is still not cached.
+void Connector_HTTP::Reactor::cacheReady(Client * C){
+  add_mutex.lock();
+  readyClients.push_back(C);
+  add_mutex.unlock();
+  wake();
+}
+
+/// Wakes the reactor thread.
+void Connector_HTTP::Reactor::wake(){
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) < 0){
+    //EAGAIN means the counter is saturated, which wakes the reactor just as well
+  }
+}
+
+/// Stops the reactor thread, closing all connections it still holds.
+void Connector_HTTP::Reactor::stop(){
+  if ( !Thread){
+    return;
+  }
+  running = false;
+  wake();
+  Thread->join();
+  delete Thread;
+  Thread = 0;
+}
+
+/// Returns the amount of clients currently held by this reactor.
+unsigned int Connector_HTTP::Reactor::clientCount(){
+  return count;
+}
+
+/// Returns the amount of open sub-connector connections, and how many of those are unused.
+void Connector_HTTP::Reactor::upstreamCount(unsigned int & open, unsigned int & unused){
+  open = openUpstreams;
+  unused = idleUpstreams;
+}
+
+/// Thread entry point, simply calls loop() on the given reactor.
+void Connector_HTTP::Reactor::run(void * r){
+  ((Reactor *)r)->loop();
+}
+
+/// Starts or changes waiting for the given events on a descriptor.
+void Connector_HTTP::Reactor::watch(int fd, unsigned int events, bool add){
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.fd = fd;
+  epoll_ctl(epoll_fd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+}
+
+/// Main reactor loop. Waits for socket readiness or wakeups and handles clients and sub-connectors.
+void Connector_HTTP::Reactor::loop(){
+  struct epoll_event events[REACTOR_EVENTS];
+  while (running){
+    int n = epoll_wait(epoll_fd, events, REACTOR_EVENTS, timers.size() ? TIMER_TICK : -1);
+    if (n < 0 && errno != EINTR){
+      break;
+    }
+    for (int i = 0; i < n; i++){
+      int fd = events[i].data.fd;
+      if (fd == wake_fd){
+        uint64_t val;
+        if (read(wake_fd, &val, sizeof(val)) < 0){
+          //nothing to read, ignore
+        }
+        add_mutex.lock();
+        std::vector<Socket::Connection> adding;
+        adding.swap(newClients);
+        std::vector<Client*> ready;
+        ready.swap(readyClients);
+        add_mutex.unlock();
+        for (std::vector<Socket::Connection>::iterator it = adding.begin(); it != adding.end(); it++){
+          Client * C = new Client( *it);
+          clients[C->fd] = C;
+          watch(C->fd, EPOLLIN, true);
+          timers.arm(C->timer, routes.getKeepAlive());
+        }
+        for (std::vector<Client*>::iterator it = ready.begin(); it != ready.end(); it++){
+          Client * C = *it;
+          C->cacheWait = false;
+          forward(C, C->waitUid, C->waitConnector, C->waitRequest, C->cacheKey);
+          if ( !C->upstream && !C->cacheWait && !C->queued){
+            if ( !resume(C)){
+              continue;
+            }
+          }
+          update(C);
+        }
+        continue;
+      }
+      std::map<int, Client*>::iterator cit = clients.find(fd);
+      if (cit != clients.end()){
+        handleClient(cit->second, events[i].events);
+        continue;
+      }
+      std::map<int, Upstream*>::iterator uit = upstreams.find(fd);
+      if (uit != upstreams.end()){
+        handleUpstream(uit->second, events[i].events);
+      }
+    }
+    expireTimers();
+    openUpstreams = upstreams.size();
+  }
+  //shutting down: close everything we still hold
+  while ( !clients.empty()){
+    dropClient(clients.begin()->second);
+  }
+  while ( !upstreams.empty()){
+    dropUpstream(upstreams.begin()->second);
+  }
+  add_mutex.lock();
+  for (std::vector<Socket::Connection>::iterator it = newClients.begin(); it != newClients.end(); it++){
+    it->close();
+  }
+  newClients.clear();
+  count = 0;
+  add_mutex.unlock();
+}
+
+/// Sends queued data to a client when it became writable, and reads and handles requests when it became readable.
+void Connector_HTTP::Reactor::handleClient(Client * C, unsigned int events){
+  if (events & EPOLLOUT){
+    C->flush();
+    if (C->upstream && C->upstream->pipe_fds[0] != -1){
+      int fd = C->fd;
+      splice(C->upstream);
+      std::map<int, Client*>::iterator it = clients.find(fd);
+      if (it == clients.end() || it->second != C){
+        return; //the client was closed, do not touch it again
+      }
+    }
+  }
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+    C->conn.spool();
+    if ( !parseRequests(C)){
+      return;
+    }
+  }
+  update(C);
+}
+
+/// Handles all complete requests a client sent, until one of them has to wait for a sub-connector.
+/// Requests that arrive while an earlier one is still being answered are kept until that one is done.
+/// Returns false if the client was handed over, after which it must no longer be touched.
+bool Connector_HTTP::Reactor::parseRequests(Client * C){
+  while (C->conn.connected() && !C->upstream && !C->cacheWait && !C->queued && !C->closing){
+    if ( !C->reader.read(C->conn, C->H)){
+      return true;
+    }
+    if (C->H.GetHeader("Connection") == "close"){
+      C->closing = true;
+    }
+    timers.cancel(C->timer); //re-armed from the start once this request is done
+    if ( !handleRequest( *this, C)){
+      return false;
+    }
+    if ( !C->upstream && !C->cacheWait && !C->queued){
+      C->H.Clean(); //clean for any possible next requests
+    }
+  }
+  return true;
+}
+
+/// Continues with the next requests of a client once its current request was answered.
+/// Returns false if the client was handed over, after which it must no longer be touched.
+bool Connector_HTTP::Reactor::resume(Client * C){
+  timers.cancel(C->timer); //the deadline of the answered request
+  C->H.Clean();
+  return parseRequests(C);
+}
+
+/// Reads from a sub-connector, and sends its response to the waiting client once complete.
+/// Responses of unknown length are relayed as they arrive, until the sub-connector closes the connection.
+void Connector_HTTP::Reactor::handleUpstream(Upstream * U, unsigned int events){
+  if (U->pipe_fds[0] != -1){
+    splice(U);
+    return;
+  }
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+    U->conn.spool();
+  }
+  Client * C = U->client;
+  if ( !U->busy){
+    //idle connections should not send anything, only closing is expected
+    if ( !U->conn.connected()){
+      dropUpstream(U);
+    }
+    return;
+  }
+  if (U->relaying){
+    while (U->conn.Received().size()){
+      //forward any and all incoming data directly without parsing
+      C->send(U->conn.Received().get());
+      U->conn.Received().get().clear();
+    }
+    if ( !U->conn.connected()){
+      C->upstream = 0;
+      C->closing = true;
+      dropUpstream(U);
+    }else if (C->pending() > CLIENT_MAX_PENDING){
+      pause(U, true);
+    }
+    update(C);
+    return;
+  }
+  //check if the whole response was received
+  if (U->reader.read(U->conn, U->H)){
+    finishResponse(U);
+    return;
+  }
+  if ( !U->conn.connected()){
+    //failure, disconnect and send error to user
+    U->client = 0;
+    dropUpstream(U);
+    if (C){
+      C->upstream = 0;
+      Handle_Timeout(C->H, C);
+      if (resume(C)){
+        update(C);
+      }
+    }
+  }
+}
+
+/// Sends a complete response, or the headers of a response of unknown length, on to the waiting client.
+/// Complete successful responses for segments are also stored in the segment cache; errors such as a missing
+/// stream are only passed on, with their own status.
+/// Connections that answered with a known length are kept for the next request of the same viewer.
+/// Responses carrying the number of another request than the one sent are not trusted, and close the connection.
+/// Responses to requests whose client gave up are only stored if they are segments.
+void Connector_HTTP::Reactor::finishResponse(Upstream * U){
+  Client * C = U->client;
+  std::string id = U->H.GetHeader(REQUEST_ID_HEADER);
+  if (id != "" && id != U->requestID){
+#if DEBUG >= 2
+    std::cerr << "Response " << id << " does not match request " << U->requestID << " of " << U->uid << std::endl;
+#endif
+    U->client = 0;
+    dropUpstream(U);
+    if (C){
+      C->upstream = 0;
+      Handle_Timeout(C->H, C);
+      if (resume(C)){
+        update(C);
+      }
+    }
+    return;
+  }
+  U->H.SetHeader("Server", "mistserver/" PACKAGE_VERSION "/" + Util::Config::libver);
+  bool known = (U->H.GetHeader("Content-Length") != "");
+  //the parser keeps the status code of a response in url and its message in protocol
+  std::string code = U->H.url;
+  std::string message = U->H.protocol;
+  if (code == ""){
+    code = "200";
+    message = "OK";
+  }
+  if (U->cacheKey != "" && known && code == "200"){
+    //segments are shared by all viewers, so they are stored without the identifier of this one
+    std::string & response = U->H.BuildResponse(code, message);
+    segments.store(U->cacheKey, response);
+    if (C){
+      C->send(response);
+    }
+  }else{
+    if (U->cacheKey != ""){
+      segments.abort(U->cacheKey);
+    }
+    if (C){
+      U->H.SetHeader("X-UID", U->uid);
+      C->send(U->H.BuildResponse(code, message));
+    }
+  }
+  U->cacheKey.clear();
+  if ( !C){
+    //nobody is waiting for this response any more
+    if (known){
+      release(U);
+    }else{
+      dropUpstream(U);
+    }
+    return;
+  }
+  if (known){
+    //known length - the connection can be reused, continue with the next request of the client
+    C->upstream = 0;
+    release(U);
+    if ( !resume(C)){
+      return;
+    }
+  }else{
+    //unknown length - relay everything that follows, the connection is dedicated to this client from now on
+    U->relaying = true;
+    timers.cancel(C->timer); //relayed streams may take as long as they like
+    if (U->reader.buffered().size()){
+      C->send(U->reader.buffered());
+      U->reader.clear();
+    }
+    while (U->conn.Received().size()){
+      C->send(U->conn.Received().get());
+      U->conn.Received().get().clear();
+    }
+    //splice the rest, falling back to copying if no pipe is available
+    if (pipe2(U->pipe_fds, O_NONBLOCK) == 0){
+      splice(U);
+      return;
+    }
+    U->pipe_fds[0] = -1;
+    U->pipe_fds[1] = -1;
+  }
+  update(C);
+}
+
+/// Moves relayed data from a sub-connector to its client through the pipe, without copying it to user space.
+/// Only reads from the sub-connector while the pipe is empty, and only splices to the client once its queued
+/// data was sent. While the client is not writable, reading from the sub-connector is paused.
+/// Closes the client once the sub-connector closed and everything was sent.
+void Connector_HTTP::Reactor::splice(Upstream * U){
+  Client * C = U->client;
+  bool done = false;
+  while ( !C->pending() && C->conn.connected()){
+    if (U->inPipe){
+      int r = ::splice(U->pipe_fds[0], 0, C->fd, 0, U->inPipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (r > 0){
+        U->inPipe -= r;
+        continue;
+      }
+      if (r < 0 && errno == EINTR){
+        continue;
+      }
+      if (r < 0 && errno != EAGAIN){
+        C->conn.close();
+      }
+      break; //wait for the client to become writable
+    }
+    int r = ::splice(U->fd, 0, U->pipe_fds[1], 0, RELAY_PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (r > 0){
+      U->inPipe += r;
+      continue;
+    }
+    if (r < 0 && errno == EINTR){
+      continue;
+    }
+    if (r == 0 || errno != EAGAIN){
+      done = true; //the sub-connector closed the connection
+    }
+    break;
+  }
+  bool wait = (C->pending() || U->inPipe);
+  if (done && !wait){
+    C->upstream = 0;
+    C->closing = true;
+    dropUpstream(U);
+  }else if (wait != U->paused){
+    pause(U, wait);
+  }
+  update(C);
+}
+
+/// Makes the epoll registration of a client match what it is waiting for, and closes it if it is done.
+/// Resumes reading a paused sub-connector once the client caught up with the relayed data.
+void Connector_HTTP::Reactor::update(Client * C){
+  if ( !C->conn.connected() || (C->closing && !C->upstream && !C->cacheWait && !C->queued && !C->pending())){
+    dropClient(C);
+    return;
+  }
+  Upstream * U = C->upstream;
+  bool wantOut = (C->pending() > 0 || (U && U->inPipe > 0));
+  if (wantOut != C->polling){
+    C->polling = wantOut;
+    watch(C->fd, wantOut ? (EPOLLIN | EPOLLOUT) : EPOLLIN, false);
+  }
+  if ( !U && !C->cacheWait && !C->queued){
+    if (C->pending()){
+      timers.cancel(C->timer);
+    }else if ( !C->timer.armed()){
+      timers.arm(C->timer, C->route ? C->route->keepAlive : routes.getKeepAlive());
+    }
+  }
+  if (U && U->paused && U->pipe_fds[0] == -1 && C->pending() < CLIENT_MAX_PENDING / 2){
+    pause(U, false);
+  }
+}
+
+/// Pauses or resumes reading from a sub-connector.
+/// A paused connection is removed from epoll altogether, since a hangup would still be reported over and over
+/// while it is registered, even without any events asked for. Its hangup is noticed once it is resumed.
+void Connector_HTTP::Reactor::pause(Upstream * U, bool paused){
+  U->paused = paused;
+  if (paused){
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, U->fd, 0);
+  }else{
+    watch(U->fd, EPOLLIN, true);
+  }
+}
+
+/// Forwards the request of the given client to a connection to the given sub-connector.
+/// Unless in proxy mode, hands the client over to the sub-connector if its route allows, which then serves it directly.
+/// Clients of connectors that also serve segments stay, so their later segment requests go through the cache.
+/// Otherwise reuses an idle connection of the same viewer if there is one, or opens a new connection if the
+/// viewer has less than UPSTREAM_POOL_SIZE of them for a segment, or none at all for anything else. Every connection
+/// is a process of the sub-connector that counts as a viewer in the buffer, so only segments, which may be fetched
+/// several at once, get more than one. If not, the request waits for one of them to become available, unless
+/// UPSTREAM_QUEUE_SIZE requests of this viewer are waiting already.
+bool Connector_HTTP::Reactor::forward(Client * C, std::string & uid, std::string & connector, std::string & request, const std::string & cacheKey){
+  if (cacheKey != ""){
+    std::string response;
+    SegmentCache::Result res = segments.lookup(cacheKey, response, this, C);
+    if (res == SegmentCache::HIT){
+      C->send(response);
+      return true;
+    }
+    if (res == SegmentCache::WAIT){
+      C->cacheWait = true;
+      C->cacheKey = cacheKey;
+      C->waitUid = uid;
+      C->waitConnector = connector;
+      C->waitRequest = request;
+      if ( !C->timer.armed()){
+        timers.arm(C->timer, C->route ? C->route->timeout : ROUTE_TIMEOUT);
+      }
+      return true;
+    }
+    //fetch it ourselves, through a connection of our own so the response can be stored
+  }else if ( !proxy && C->route && C->route->handOver && !C->pending() && handOver(C, connector, request)){
+    return false;
+  }
+  UpstreamPool & P = pools[uid];
+  Upstream * U = 0;
+  if (P.idle.size()){
+    U = P.idle.back();
+    P.idle.pop_back();
+    idleUpstreams--;
+    timers.cancel(U->timer);
+#if DEBUG >= 4
+    std::cout << "Re-using connection " << uid << std::endl;
+#endif
+  }else if (P.open < ((C->route && C->route->segment) ? UPSTREAM_POOL_SIZE : 1)){
+    U = connect(uid, connector);
+    if ( !U){
+      if (cacheKey != ""){
+        segments.abort(cacheKey);
+      }
+      Handle_Timeout(C->H, C);
+      return true;
+    }
+  }else if (P.queue.size() < UPSTREAM_QUEUE_SIZE){
+    //all connections of this viewer are busy, wait for one of them
+    P.queue.push_back(C);
+    C->queued = true;
+    C->cacheKey = cacheKey;
+    C->waitUid = uid;
+    C->waitConnector = connector;
+    C->waitRequest = request;
+    if ( !C->timer.armed()){
+      timers.arm(C->timer, C->route ? C->route->timeout : ROUTE_TIMEOUT);
+    }
+    return true;
+  }else{
+    if (cacheKey != ""){
+      segments.abort(cacheKey);
+    }
+    Handle_Busy(C->H, C);
+    return true;
+  }
+  dispatch(U, C, request, cacheKey);
+  return true;
+}
+
+/// Opens a new connection to the given sub-connector for the pool of the given viewer.
+/// Returns 0 if the sub-connector could not be reached.
+Connector_HTTP::Upstream * Connector_HTTP::Reactor::connect(std::string & uid, std::string & connector){
+  Upstream * U = new Upstream(uid, connector);
+  if ( !U->conn.connected()){
+    delete U;
+    std::map<std::string, UpstreamPool>::iterator it = pools.find(uid);
+    if (it != pools.end() && it->second.open == 0 && it->second.queue.empty()){
+      pools.erase(it);
+    }
+    return 0;
+  }
+  pools[uid].open++;
+  upstreams[U->fd] = U;
+  watch(U->fd, EPOLLIN, true);
+#if DEBUG >= 4
+  std::cout << "Created new connection " << uid << std::endl;
+#endif
+  return U;
+}
+
+/// Sends the request of the given client over an unused connection, numbered so its response can be checked.
+/// The number goes in a header right after the request line, and the sub-connector echoes it on its response.
+/// The deadline of the request is armed if it was not already while the request waited.
+void Connector_HTTP::Reactor::dispatch(Upstream * U, Client * C, std::string & request, const std::string & cacheKey){
+  std::stringstream id;
+  id << ++lastRequestID;
+  U->requestID = id.str();
+  U->client = C;
+  U->route = C->route;
+  U->busy = true;
+  U->cacheKey = cacheKey;
+  C->upstream = U;
+  if ( !C->timer.armed()){
+    timers.arm(C->timer, C->route ? C->route->timeout : ROUTE_TIMEOUT);
+  }
+  std::string::size_type eol = request.find('\n');
+  if (eol == std::string::npos){
+    U->conn.SendNow(request);
+    return;
+  }
+  U->conn.SendNow(request.substr(0, eol + 1) + REQUEST_ID_HEADER ": " + U->requestID + "\n" + request.substr(eol + 1));
+}
+
+/// Makes a connection that completed its response available again.
+/// It is handed the oldest request waiting in the pool of its viewer, or kept idle for the next one.
+void Connector_HTTP::Reactor::release(Upstream * U){
+  U->H.Clean();
+  U->client = 0;
+  U->busy = false;
+  U->requestID.clear();
+  U->cacheKey.clear();
+  timers.cancel(U->timer);
+  UpstreamPool & P = pools[U->uid];
+  if (P.queue.size()){
+    Client * C = P.queue.front();
+    P.queue.pop_front();
+    C->queued = false;
+    dispatch(U, C, C->waitRequest, C->cacheKey);
+    return;
+  }
+  P.idle.push_back(U);
+  idleUpstreams++;
+  timers.arm(U->timer, U->route ? U->route->idle : ROUTE_IDLE);
+}
+
+/// Leaves a connection to finish the response to a request whose client gave up on it, so the connection
+/// can be reused afterwards. If the response does not arrive within the timeout of the request, it is closed.
+void Connector_HTTP::Reactor::abandon(Upstream * U){
+  U->client = 0;
+  timers.arm(U->timer, U->route ? U->route->timeout : ROUTE_TIMEOUT);
+}
+
+/// Passes the socket of a client, the request and anything sent after it to a new connection to the sub-connector.
+/// From then on the sub-connector reads from and writes to the client itself, so no data passes through here.
+/// Returns false if the sub-connector could not be reached, leaving the client untouched.
+bool Connector_HTTP::Reactor::handOver(Client * C, std::string & connector, std::string & request){
+  Socket::Connection target("/tmp/mist/http_" + connector);
+  if ( !target.connected()){
+    return false;
+  }
+  C->reader.feed(C->conn.Received());
+  std::string data = request + C->reader.buffered(); //pipelined requests go along
+  if ( !Connector_HTTP::handOver(target, C->fd, C->conn.getHost(), data)){
+    target.close();
+    return false;
+  }
+  target.close();
+#if DEBUG >= 4
+  std::cout << "Handed over client " << C->fd << " to " << connector << std::endl;
+#endif
+  detachClient(C);
+  close(C->fd); //the sub-connector holds its own copy, so the connection must not be shut down
+  delete C;
+  return true;
+}
+
+/// Removes a client from this reactor, without closing its socket.
+void Connector_HTTP::Reactor::detachClient(Client * C){
+  timers.cancel(C->timer);
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, C->fd, 0);
+  clients.erase(C->fd);
+  add_mutex.lock();
+  count--;
+  add_mutex.unlock();
+}
+
+/// Removes a client from this reactor and closes it.
+/// A sub-connector connection still answering its request is kept until the response is complete, unless the
+/// response was being relayed.
+void Connector_HTTP::Reactor::dropClient(Client * C){
+  cancelWait(C);
+  if (C->upstream){
+    Upstream * U = C->upstream;
+    C->upstream = 0;
+    if (U->relaying){
+      U->client = 0;
+      dropUpstream(U);
+    }else{
+      abandon(U);
+    }
+  }
+  detachClient(C);
+  C->conn.close();
+  delete C;
+}
+
+/// Stops the current request of a client from waiting for a segment or for a connection.
+void Connector_HTTP::Reactor::cancelWait(Client * C){
+  if (C->cacheWait){
+    C->cacheWait = false;
+    segments.forget(C->cacheKey, C);
+    add_mutex.lock();
+    for (std::vector<Client*>::iterator it = readyClients.begin(); it != readyClients.end(); it++){
+      if ( *it == C){
+        readyClients.erase(it);
+        break;
+      }
+    }
+    add_mutex.unlock();
+  }
+  if (C->queued){
+    C->queued = false;
+    std::deque<Client*> & queue = pools[C->waitUid].queue;
+    for (std::deque<Client*>::iterator it = queue.begin(); it != queue.end(); it++){
+      if ( *it == C){
+        queue.erase(it);
+        break;
+      }
+    }
+    if (C->cacheKey != ""){
+      segments.abort(C->cacheKey); //the clients waiting for it will fetch it themselves
+    }
+  }
+}
+
+/// Removes a sub-connector connection from this reactor and closes it.
+/// If requests of the same viewer were waiting for a connection, the oldest one gets a new connection instead.
+void Connector_HTTP::Reactor::dropUpstream(Upstream * U){
+  if (U->cacheKey != ""){
+    segments.abort(U->cacheKey); //the clients waiting for it will fetch it themselves
+  }
+  timers.cancel(U->timer);
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, U->fd, 0);
+  upstreams.erase(U->fd);
+  if (U->pipe_fds[0] != -1){
+    close(U->pipe_fds[0]);
+    close(U->pipe_fds[1]);
+  }
+  U->conn.close();
+  std::string uid = U->uid;
+  std::map<std::string, UpstreamPool>::iterator it = pools.find(uid);
+  if (it != pools.end()){
+    UpstreamPool & P = it->second;
+    P.open--;
+    for (std::vector<Upstream*>::iterator i = P.idle.begin(); i != P.idle.end(); i++){
+      if ( *i == U){
+        P.idle.erase(i);
+        idleUpstreams--;
+        break;
+      }
+    }
+    if (P.queue.size()){
+      Client * C = P.queue.front();
+      P.queue.pop_front();
+      C->queued = false;
+      Upstream * N = connect(uid, C->waitConnector);
+      if (N){
+        dispatch(N, C, C->waitRequest, C->cacheKey);
+      }else{
+        if (C->cacheKey != ""){
+          segments.abort(C->cacheKey);
+        }
+        Handle_Timeout(C->H, C);
+        if (resume(C)){
+          update(C);
+        }
+      }
+    }
+    it = pools.find(uid); //may have changed while handling the next request
+    if (it != pools.end() && it->second.open == 0 && it->second.queue.empty()){
+      pools.erase(it);
+    }
+  }
+  delete U;
+}
+
+/// Gives up on the current request of a client whose deadline passed, answering it with a timeout error.
+void Connector_HTTP::Reactor::timeout(Client * C){
+  std::cout << "[" << (C->route ? C->route->timeout : ROUTE_TIMEOUT) / 1000 << "s timeout triggered]" << std::endl;
+  cancelWait(C);
+  if (C->upstream){
+    abandon(C->upstream);
+    C->upstream = 0;
+  }
+  Handle_Timeout(C->H, C);
+  if (resume(C)){
+    update(C);
+  }
+}
+
+/// Handles all timers that expired: closes clients that waited too long for their next request, answers requests
+/// that passed their deadline with a timeout error, and closes sub-connector connections that were unused for too
+/// long or never completed the response to an abandoned request.
+void Connector_HTTP::Reactor::expireTimers(){
+  timers.advance();
+  Timer * T;
+  while ((T = timers.expired())){
+    if (T->kind == CLIENT_TIMER){
+      Client * C = (Client*)T->owner;
+      if (C->upstream || C->cacheWait || C->queued){
+        timeout(C);
+      }else{
+        dropClient(C);
+      }
+      continue;
+    }
+    dropUpstream((Upstream*)T->owner);
+  }
+}
+
+namespace Connector_HTTP {
+  namespace Reactors {
+    std::vector<Reactor*> reactors; ///< All running reactors.
+
+    /// Starts the given amount of reactors, or one per CPU core if zero.
+    void start(unsigned int count, bool proxy){
+      if (count == 0){
+        count = tthread::thread::hardware_concurrency();
+      }
+      if (count == 0){
+        count = 1;
+      }
+      for (unsigned int i = 0; i < count; i++){
+        reactors.push_back(new Reactor(proxy));
+      }
+    }
+
+    /// Hands a new client to the least loaded reactor.
+    void addClient(Socket::Connection & conn){
+      Reactor * best = 0;
+      for (std::vector<Reactor*>::iterator it = reactors.begin(); it != reactors.end(); it++){
+        if ( !best || ( *it)->clientCount() < best->clientCount()){
+          best = *it;
+        }
+      }
+      best->addClient(conn);
+    }
+
+    /// Returns the amount of clients held by all reactors together.
+    unsigned int clientCount(){
+      unsigned int total = 0;
+      for (std::vector<Reactor*>::iterator it = reactors.begin(); it != reactors.end(); it++){
+        total += ( *it)->clientCount();
+      }
+      return total;
+    }
+
+    /// Returns the amount of open sub-connector connections of all reactors together, and how many are unused.
+    void upstreamCount(unsigned int & open, unsigned int & unused){
+      open = 0;
+      unused = 0;
+      for (std::vector<Reactor*>::iterator it = reactors.begin(); it != reactors.end(); it++){
+        unsigned int o, u;
+        ( *it)->upstreamCount(o, u);
+        open += o;
+        unused += u;
+      }
+    }
+
+    /// Stops and deletes all reactors.
+    void stop(){
+      while ( !reactors.empty()){
+        delete reactors.back();
+        reactors.pop_back();
+      }
+    }
+  }
+}
@@ -0,0 +1,202 @@
+/// \file conn_http_reactor.h
+/// Contains definitions for the event driven HTTP front end.
+
+#pragma once
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <mist/socket.h>
+#include <mist/http_parser.h>
+#include "tinythread.h"
+#include "conn_http_reader.h"
+#include "conn_http_router.h"
+#include "conn_http_timers.h"
+
+/// Maximum amount of events handled per epoll_wait call by a reactor.
+#define REACTOR_EVENTS 64
+/// Amount of unsent bytes for a client above which relayed data is no longer read from the sub-connector.
+#define CLIENT_MAX_PENDING (1024 * 1024)
+/// Maximum amount of bytes moved through the pipe of a spliced relay at once.
+#define RELAY_PIPE_SIZE (64 * 1024)
+/// Maximum amount of connections a single viewer may have open to its sub-connector, when fetching segments.
+/// Each one is a separate process of the sub-connector, reporting as a separate viewer to the buffer.
+#define UPSTREAM_POOL_SIZE 4
+/// Maximum amount of requests of a single viewer waiting for one of its connections to become available.
+#define UPSTREAM_QUEUE_SIZE 16
+
+namespace Connector_HTTP {
+  class Upstream;
+
+  /// Kinds of timers armed by a reactor.
+  enum ReactorTimer{
+    CLIENT_TIMER, ///< Keep-alive timeout of a client waiting for its next request, or deadline of its current one.
+    UPSTREAM_TIMER ///< Idle timeout of an unused sub-connector connection, or of one answering an abandoned request.
+  };
+
+  /// A connected HTTP client, served by a single reactor thread.
+  class Client{
+    public:
+      /// Wraps the given connection.
+      Client(Socket::Connection c);
+      /// Queues data for sending and sends as much of it as the socket accepts right away.
+      void send(const std::string & data);
+      /// Sends as much of the queued data as the socket accepts. Returns true if nothing is left.
+      bool flush();
+      /// Returns the amount of queued bytes not sent yet.
+      unsigned int pending();
+      Socket::Connection conn; ///< The client socket.
+      int fd; ///< Socket number, kept for removing the client after the socket closed.
+      HTTP::Parser H; ///< Parser for the current request, also used to build the response.
+      Reader reader; ///< Collects requests from conn.
+      Upstream * upstream; ///< Sub-connector handling the current request, if any.
+      const Route * route; ///< Route of the current or last request, 0 before the first one.
+      Timer timer; ///< Armed while waiting for the next request, or until the deadline of the current one.
+      bool closing; ///< Set when the connection should be closed once all queued data is sent.
+      bool cacheWait; ///< Set while waiting for a segment another request is fetching.
+      bool queued; ///< Set while waiting for a connection of the viewer to become available.
+      std::string cacheKey; ///< Segment being waited for or fetched.
+      std::string waitUid; ///< Viewer identifier of the waiting request.
+      std::string waitConnector; ///< Sub-connector of the waiting request.
+      std::string waitRequest; ///< The waiting request, as forwarded to the sub-connector.
+      bool polling; ///< Whether the reactor currently waits for the socket to become writable.
+    private:
+      std::string out; ///< Queued data.
+      unsigned int outPos; ///< Position of the first unsent byte in out.
+  };
+
+  /// A connection to a sub-connector, handling one request at a time.
+  /// Every request sent over it is numbered, so a response can be checked against the request it answers.
+  class Upstream{
+    public:
+      /// Connects to the given sub-connector.
+      Upstream(std::string uid, std::string connector);
+      Socket::Connection conn; ///< The sub-connector socket.
+      int fd; ///< Socket number, kept for removing the connection after the socket closed.
+      std::string uid; ///< Identifier of the viewer this connection belongs to.
+      HTTP::Parser H; ///< Parser for the response.
+      Reader reader; ///< Collects responses from conn.
+      Client * client; ///< Client waiting for the current response, 0 if none or if it gave up.
+      const Route * route; ///< Route of the current or last request, 0 before the first one.
+      bool busy; ///< Set from sending a request until its response is complete, even if its client gave up.
+      std::string requestID; ///< Number of the current request, echoed by the sub-connector on its response.
+      std::string cacheKey; ///< Segment the current response is fetched for, empty if it is not cached.
+      bool relaying; ///< Set once a response of unknown length is being relayed; the connection is never reused after that.
+      bool paused; ///< Set while reading is paused because the client has too much data queued, and the socket is not in epoll.
+      int pipe_fds[2]; ///< Pipe that relayed data is spliced through, both -1 if not splicing.
+      unsigned int inPipe; ///< Amount of relayed bytes in the pipe that were not spliced to the client yet.
+      Timer timer; ///< Armed while unused, or while answering a request its client gave up on.
+  };
+
+  /// All connections of a single viewer to its sub-connector, and the requests waiting for one of them.
+  class UpstreamPool{
+    public:
+      /// Creates an empty pool.
+      UpstreamPool();
+      unsigned int open; ///< Amount of open connections, busy or not.
+      std::vector<Upstream*> idle; ///< Connections available for the next request.
+      std::deque<Client*> queue; ///< Clients waiting for a connection to become available, oldest first.
+  };
+
+  /// Serves many clients from a single thread.
+  /// The thread sleeps in epoll until a client or sub-connector socket becomes readable or writable, or until a
+  /// new client is handed over. Clients requesting a progressive stream are normally handed over to its
+  /// sub-connector completely. All other requests, and all requests in proxy mode, are forwarded without blocking
+  /// instead; their responses are sent on to the client as soon as they are complete, or relayed as they arrive if
+  /// their length is unknown.
+  /// Relayed data is spliced from the sub-connector to the client through a pipe, so it never leaves the kernel.
+  /// Every viewer has a pool of up to UPSTREAM_POOL_SIZE connections to its sub-connector, so several of its
+  /// segment requests can be answered at once; other requests never open more than one. Further requests wait in a
+  /// bounded queue until a connection is available.
+  /// Every request has a deadline, after which it is answered with a timeout error whether it is still queued or
+  /// already sent. A connection whose request was given up on is kept until that response arrives, and reused.
+  /// Client keep-alive, request deadlines and idle timeouts are kept in a timer wheel, using those of the route involved.
+  class Reactor{
+    public:
+      /// Creates the epoll and wakeup descriptors and starts the reactor thread.
+      Reactor(bool proxy);
+      /// Stops the reactor thread and closes all descriptors.
+      ~Reactor();
+      /// Hands a client connection over to this reactor.
+      void addClient(Socket::Connection & conn);
+      /// Forwards the request of the given client to a connection to the given sub-connector.
+      /// Requests with a cache key are answered from the segment cache if possible, and never handed over.
+      /// Requests that are not handed over are queued if all connections of the viewer are busy.
+      /// Returns false if the client was handed over, after which it must no longer be touched.
+      bool forward(Client * C, std::string & uid, std::string & connector, std::string & request, const std::string & cacheKey);
+      /// Signals that the segment the given client waited for was stored or will not be, from any thread.
+      void cacheReady(Client * C);
+      /// Stops the reactor thread, closing all connections it still holds.
+      void stop();
+      /// Returns the amount of clients currently held by this reactor.
+      unsigned int clientCount();
+      /// Returns the amount of open sub-connector connections, and how many of those are unused.
+      void upstreamCount(unsigned int & open, unsigned int & unused);
+    private:
+      static void run(void * r);
+      void loop();
+      void watch(int fd, unsigned int events, bool add);
+      void handleClient(Client * C, unsigned int events);
+      void handleUpstream(Upstream * U, unsigned int events);
+      bool parseRequests(Client * C);
+      bool resume(Client * C);
+      void timeout(Client * C);
+      void cancelWait(Client * C);
+      Upstream * connect(std::string & uid, std::string & connector);
+      void dispatch(Upstream * U, Client * C, std::string & request, const std::string & cacheKey);
+      void release(Upstream * U);
+      void abandon(Upstream * U);
+      void finishResponse(Upstream * U);
+      void splice(Upstream * U);
+      void update(Client * C);
+      void pause(Upstream * U, bool paused);
+      bool handOver(Client * C, std::string & connector, std::string & request);
+      void detachClient(Client * C);
+      void dropClient(Client * C);
+      void dropUpstream(Upstream * U);
+      void expireTimers();
+      void wake();
+      int epoll_fd; ///< Descriptor for epoll.
+      int wake_fd; ///< Eventfd used to wake up the reactor thread.
+      volatile bool running; ///< Set to false to make the reactor thread exit.
+      bool proxy; ///< Whether to relay sub-connector responses instead of handing clients over.
+      volatile unsigned int count; ///< Amount of clients currently held.
+      volatile unsigned int openUpstreams; ///< Amount of open sub-connector connections.
+      volatile unsigned int idleUpstreams; ///< Amount of open sub-connector connections that are unused.
+      TimerWheel timers; ///< Timeouts of all clients and sub-connector connections, only touched by the reactor thread.
+      tthread::thread * Thread; ///< The reactor thread itself.
+      tthread::mutex add_mutex; ///< Mutex for newClients and readyClients.
+      std::vector<Socket::Connection> newClients; ///< Connections waiting to be picked up by the reactor thread.
+      std::vector<Client*> readyClients; ///< Clients whose segment wait ended, waiting to be handled by the reactor thread.
+      std::map<int, Client*> clients; ///< All clients by socket number, only touched by the reactor thread.
+      std::map<int, Upstream*> upstreams; ///< All sub-connector connections by socket number, only touched by the reactor thread.
+      std::map<std::string, UpstreamPool> pools; ///< Sub-connector connections and waiting requests, by viewer identifier.
+      unsigned int lastRequestID; ///< Number of the last request sent to a sub-connector.
+  };
+
+  /// Handles a complete request read from a client, either by answering it or by calling Reactor::forward.
+  /// Returns false if the client was handed over, after which it must no longer be touched.
+  /// Implemented by the HTTP connector itself.
+  bool handleRequest(Reactor & R, Client * C);
+  /// Answers the current request of the given client with a timeout error.
+  /// Implemented by the HTTP connector itself.
+  void Handle_Timeout(HTTP::Parser & H, Client * C);
+  /// Answers the current request of the given client with an error saying the server is too busy.
+  /// Implemented by the HTTP connector itself.
+  void Handle_Busy(HTTP::Parser & H, Client * C);
+
+  /// Fixed pool of Reactor threads that all clients are spread over.
+  namespace Reactors {
+    /// Starts the given amount of reactors, or one per CPU core if zero.
+    /// In proxy mode, all sub-connector responses are relayed instead of handing clients over.
+    void start(unsigned int count, bool proxy);
+    /// Hands a new client to the least loaded reactor.
+    void addClient(Socket::Connection & conn);
+    /// Returns the amount of clients held by all reactors together.
+    unsigned int clientCount();
+    /// Returns the amount of open sub-connector connections of all reactors together, and how many are unused.
+    void upstreamCount(unsigned int & open, unsigned int & unused);
+    /// Stops and deletes all reactors.
+    void stop();
+  }
+}
@@ -0,0 +1,108 @@
+/// \file conn_http_reader.cpp
+/// Contains code for reading HTTP messages from a connection incrementally.
+
+#include <cstdlib>
+#include <strings.h>
+#include "conn_http_reader.h"
+
+/// Creates an empty reader.
+Connector_HTTP::Reader::Reader(){
+  clear();
+}
+
+/// Moves all data received on the given buffer into the reader.
+/// The first piece is swapped in rather than copied when nothing else is buffered.
+void Connector_HTTP::Reader::feed(Socket::Buffer & in){
+  while (in.size()){
+    fresh = true;
+    if (buffer.empty()){
+      buffer.swap(in.get());
+    }else{
+      buffer.append(in.get());
+    }
+    in.get().clear();
+  }
+}
+
+/// Returns true if a complete message is buffered.
+/// Continues the search for the end of the headers where the previous call stopped. Once found, the headers are
+/// searched once for Content-Length, and the message is complete when that many bytes follow them.
+bool Connector_HTTP::Reader::ready(){
+  if (inParser){
+    return fresh;
+  }
+  if (headerEnd == std::string::npos){
+    std::string::size_type p = scanned;
+    while (true){
+      p = buffer.find('\n', p);
+      if (p == std::string::npos){
+        scanned = buffer.size();
+        return false;
+      }
+      if (p + 1 < buffer.size() && buffer[p + 1] == '\n'){
+        headerEnd = p + 2;
+        break;
+      }
+      if (p + 2 < buffer.size() && buffer[p + 1] == '\r' && buffer[p + 2] == '\n'){
+        headerEnd = p + 3;
+        break;
+      }
+      if (p + 1 >= buffer.size() || (p + 2 >= buffer.size() && buffer[p + 1] == '\r')){
+        scanned = p; //the empty line may still arrive right after this newline
+        return false;
+      }
+      p++;
+    }
+    bodyLen = 0;
+    std::string::size_type line = 0;
+    while (line < headerEnd){
+      std::string::size_type end = buffer.find('\n', line);
+      if (end - line > 15 && strncasecmp(buffer.data() + line, "Content-Length:", 15) == 0){
+        bodyLen = atoi(buffer.c_str() + line + 15);
+        break;
+      }
+      line = end + 1;
+    }
+  }
+  return buffer.size() >= headerEnd + bodyLen;
+}
+
+/// Parses the next complete message into H. Returns false if no message is complete yet.
+/// If the parser disagrees about where the message ends, it is given all further data until it is done.
+bool Connector_HTTP::Reader::read(HTTP::Parser & H){
+  if ( !ready()){
+    return false;
+  }
+  fresh = false;
+  if ( !H.Read(buffer)){
+    inParser = true;
+    return false;
+  }
+  scanned = 0;
+  headerEnd = std::string::npos;
+  bodyLen = 0;
+  inParser = false;
+  return true;
+}
+
+/// Moves all data received on the given connection into the reader, then parses the next complete message into H.
+bool Connector_HTTP::Reader::read(Socket::Connection & conn, HTTP::Parser & H){
+  feed(conn.Received());
+  return read(H);
+}
+
+/// Returns the buffered data that was not parsed yet, which may be changed.
+/// Changing it should be followed by clear() or by only appending to it.
+std::string & Connector_HTTP::Reader::buffered(){
+  return buffer;
+}
+
+/// Drops all buffered data and the parse state.
+void Connector_HTTP::Reader::clear(){
+  buffer.clear();
+  scanned = 0;
+  headerEnd = std::string::npos;
+  bodyLen = 0;
+  inParser = false;
+  fresh = false;
+}
@@ -0,0 +1,39 @@
+/// \file conn_http_reader.h
+/// Contains definitions for reading HTTP messages from a connection incrementally.
+
+#pragma once
+#include <string>
+#include <mist/socket.h>
+#include <mist/http_parser.h>
+
+namespace Connector_HTTP {
+  /// Collects the data received on a connection and finds complete HTTP messages in it.
+  /// Everything received is kept in a single buffer, and the search for the end of the headers continues where
+  /// it stopped after the previous read, so no byte is scanned twice. A message is only given to HTTP::Parser
+  /// once it is complete, which then parses it in a single pass and removes it from the front of the buffer.
+  /// Pipelined messages stay in the buffer and are returned one after the other.
+  class Reader{
+    public:
+      /// Creates an empty reader.
+      Reader();
+      /// Moves all data received on the given buffer into the reader.
+      void feed(Socket::Buffer & in);
+      /// Returns true if a complete message is buffered.
+      bool ready();
+      /// Parses the next complete message into H. Returns false if no message is complete yet.
+      bool read(HTTP::Parser & H);
+      /// Moves all data received on the given connection into the reader, then parses the next complete message into H.
+      bool read(Socket::Connection & conn, HTTP::Parser & H);
+      /// Returns the buffered data that was not parsed yet, which may be changed.
+      std::string & buffered();
+      /// Drops all buffered data and the parse state.
+      void clear();
+    private:
+      std::string buffer; ///< Data not parsed yet.
+      std::string::size_type scanned; ///< Amount of bytes known not to hold the end of the headers.
+      std::string::size_type headerEnd; ///< Length of the headers including the empty line, npos if not found yet.
+      unsigned int bodyLen; ///< Length of the body according to the headers.
+      bool inParser; ///< Set when the parser holds part of a message and decides on its end itself.
+      bool fresh; ///< Set when data was added since the parser last looked at the buffer.
+  };
+}
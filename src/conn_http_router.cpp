@@ -0,0 +1,240 @@
+/// \file conn_http_router.cpp
+/// Contains code for the URL routing table of the HTTP connector.
+
+#include <cstdlib>
+#include "conn_http_router.h"
+
+Connector_HTTP::Router Connector_HTTP::routes;
+
+/// Matches url from position u on against the tokens of a route from token t on.
+/// Wildcards try their shortest match first, and only end where the next literal token matches.
+static bool matchTokens(const std::vector<Connector_HTTP::Route::Token> & T, unsigned int t, const std::string & url, unsigned int u,
+    Connector_HTTP::RouteMatch & M){
+  if (t == T.size()){
+    return u == url.size();
+  }
+  const Connector_HTTP::Route::Token & K = T[t];
+  if (K.type == Connector_HTTP::Route::Token::LITERAL){
+    if (url.compare(u, K.text.size(), K.text) != 0){
+      return false;
+    }
+    return matchTokens(T, t + 1, url, u + K.text.size(), M);
+  }
+  bool isStream = (K.type == Connector_HTTP::Route::Token::STREAM);
+  const std::string * next = 0;
+  if (t + 1 < T.size() && T[t + 1].type == Connector_HTTP::Route::Token::LITERAL){
+    next = &T[t + 1].text;
+  }
+  std::string::size_type e = u + (isStream ? 1 : 0); //stream names are never empty
+  while (e <= url.size()){
+    if (next){
+      e = url.find( *next, e);
+      if (e == std::string::npos){
+        return false;
+      }
+    }
+    if (isStream && url.find('/', u) < e){
+      return false;
+    }
+    if (matchTokens(T, t + 1, url, e, M)){
+      if (isStream){
+        M.streamStart = u;
+        M.streamLen = e - u;
+      }
+      return true;
+    }
+    e++;
+  }
+  return false;
+}
+
+/// Creates an empty table.
+Connector_HTTP::Router::Router(){
+  timeout = ROUTE_TIMEOUT;
+  idle = ROUTE_IDLE;
+  keepAlive = ROUTE_KEEPALIVE;
+}
+
+/// Deletes all routes.
+Connector_HTTP::Router::~Router(){
+  clear( &root);
+}
+
+/// Deletes all routes and nodes below the given node.
+void Connector_HTTP::Router::clear(Node * N){
+  for (std::vector<Route*>::iterator it = N->routes.begin(); it != N->routes.end(); it++){
+    delete *it;
+  }
+  N->routes.clear();
+  for (std::vector<std::pair<char, Node*> >::iterator it = N->children.begin(); it != N->children.end(); it++){
+    clear(it->second);
+    delete it->second;
+  }
+  N->children.clear();
+}
+
+/// Adds a pattern of URLs served by the given connector, returning the route for changing its timeouts.
+/// Segment routes mark URLs whose responses are the same for every viewer, see SegmentCache.
+Connector_HTTP::Route & Connector_HTTP::Router::add(const std::string & connector, const std::string & pattern, bool segment){
+  Route * R = new Route;
+  R->connector = connector;
+  R->pattern = pattern;
+  R->segment = segment;
+  R->handOver = false;
+  R->timeout = timeout;
+  R->idle = idle;
+  R->keepAlive = keepAlive;
+  //walk the literal prefix into the trie
+  Node * N = &root;
+  unsigned int i = 0;
+  while (i < pattern.size() && pattern[i] != '*' && pattern.compare(i, 8, "{stream}") != 0){
+    Node * child = 0;
+    for (std::vector<std::pair<char, Node*> >::iterator it = N->children.begin(); it != N->children.end(); it++){
+      if (it->first == pattern[i]){
+        child = it->second;
+        break;
+      }
+    }
+    if ( !child){
+      child = new Node;
+      N->children.push_back(std::make_pair(pattern[i], child));
+    }
+    N = child;
+    i++;
+  }
+  //compile the rest of the pattern
+  while (i < pattern.size()){
+    Route::Token K;
+    if (pattern[i] == '*'){
+      K.type = Route::Token::ANY;
+      i++;
+    }else if (pattern.compare(i, 8, "{stream}") == 0){
+      K.type = Route::Token::STREAM;
+      i += 8;
+    }else{
+      K.type = Route::Token::LITERAL;
+      while (i < pattern.size() && pattern[i] != '*' && pattern.compare(i, 8, "{stream}") != 0){
+        K.text += pattern[i];
+        i++;
+      }
+    }
+    R->tail.push_back(K);
+  }
+  if (R->tail.size() && R->tail.back().type == Route::Token::LITERAL){
+    R->suffix = R->tail.back().text;
+  }
+  N->routes.push_back(R);
+  return *R;
+}
+
+/// Sets the timeouts of all routes added after this, in milliseconds.
+void Connector_HTTP::Router::setTimeouts(long long int timeout, long long int idle, long long int keepAlive){
+  this->timeout = timeout;
+  this->idle = idle;
+  this->keepAlive = keepAlive;
+}
+
+/// Returns the keep-alive timeout of clients that did not make a request yet, the default one of new routes.
+long long int Connector_HTTP::Router::getKeepAlive(){
+  return keepAlive;
+}
+
+/// Adds all routes at or below the given node to the list.
+void Connector_HTTP::Router::listRoutes(Node * N, std::vector<Route*> & list){
+  list.insert(list.end(), N->routes.begin(), N->routes.end());
+  for (std::vector<std::pair<char, Node*> >::iterator it = N->children.begin(); it != N->children.end(); it++){
+    listRoutes(it->second, list);
+  }
+}
+
+/// Overrides the timeouts of some routes, from a comma separated list of name=timeout[:idle[:keepalive]] in seconds.
+/// The name is either a connector, applying to all its routes, or the pattern of a single route.
+/// Returns false if the list could not be parsed or names no route.
+bool Connector_HTTP::Router::setTimeouts(const std::string & config){
+  std::vector<Route*> list;
+  listRoutes( &root, list);
+  std::string::size_type pos = 0;
+  while (pos < config.size()){
+    std::string::size_type end = config.find(',', pos);
+    if (end == std::string::npos){
+      end = config.size();
+    }
+    std::string entry = config.substr(pos, end - pos);
+    pos = end + 1;
+    std::string::size_type eq = entry.find('=');
+    if (eq == std::string::npos){
+      return false;
+    }
+    std::string name = entry.substr(0, eq);
+    long long int values[3] = { -1, -1, -1};
+    std::string::size_type v = eq;
+    for (int i = 0; i < 3 && v != std::string::npos; i++){
+      values[i] = atoll(entry.c_str() + v + 1) * 1000;
+      v = entry.find(':', v + 1);
+    }
+    bool found = false;
+    for (std::vector<Route*>::iterator it = list.begin(); it != list.end(); it++){
+      if (( *it)->connector == name || ( *it)->pattern == name){
+        found = true;
+        if (values[0] >= 0){
+          ( *it)->timeout = values[0];
+        }
+        if (values[1] >= 0){
+          ( *it)->idle = values[1];
+        }
+        if (values[2] >= 0){
+          ( *it)->keepAlive = values[2];
+        }
+      }
+    }
+    if ( !found){
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Finds the route serving the given URL. Returns false if no route matches.
+bool Connector_HTTP::Router::match(const std::string & url, RouteMatch & M) const{
+  const Node * passed[ROUTER_MAX_DEPTH];
+  unsigned int depth[ROUTER_MAX_DEPTH];
+  unsigned int count = 0;
+  const Node * N = &root;
+  unsigned int i = 0;
+  while (N){
+    if (N->routes.size() && count < ROUTER_MAX_DEPTH){
+      passed[count] = N;
+      depth[count] = i;
+      count++;
+    }
+    if (i == url.size()){
+      break;
+    }
+    const Node * child = 0;
+    for (std::vector<std::pair<char, Node*> >::const_iterator it = N->children.begin(); it != N->children.end(); it++){
+      if (it->first == url[i]){
+        child = it->second;
+        break;
+      }
+    }
+    N = child;
+    i++;
+  }
+  while (count){
+    count--;
+    for (std::vector<Route*>::const_iterator it = passed[count]->routes.begin(); it != passed[count]->routes.end(); it++){
+      const Route & R = **it;
+      if (R.suffix.size() > url.size() - depth[count] || url.compare(url.size() - R.suffix.size(), R.suffix.size(), R.suffix) != 0){
+        continue;
+      }
+      M.route = &R;
+      M.streamStart = 0;
+      M.streamLen = 0;
+      if (matchTokens(R.tail, 0, url, depth[count], M)){
+        return true;
+      }
+    }
+  }
+  M.route = 0;
+  return false;
+}
@@ -0,0 +1,87 @@
+/// \file conn_http_router.h
+/// Contains definitions for the URL routing table of the HTTP connector.
+
+#pragma once
+#include <string>
+#include <vector>
+
+/// Maximum amount of trie nodes holding routes that a single URL can pass.
+#define ROUTER_MAX_DEPTH 16
+/// Default milliseconds a sub-connector may take to answer a request before the client gets a timeout response.
+#define ROUTE_TIMEOUT 20000
+/// Default milliseconds an idle connection to a sub-connector is kept open for reuse.
+#define ROUTE_IDLE 15000
+/// Default milliseconds a client connection is kept open while waiting for its next request.
+#define ROUTE_KEEPALIVE 30000
+
+namespace Connector_HTTP {
+  /// A pattern of URLs served by a single connector.
+  /// Patterns are literal text, with "*" matching any run of characters and "{stream}" matching the stream name,
+  /// which is a non-empty run of characters without slashes. For example: "/hls/{stream}/*.ts".
+  struct Route{
+    /// A part of a compiled pattern.
+    struct Token{
+      /// Kinds of tokens.
+      enum Type{
+        LITERAL, ///< Matches text exactly.
+        ANY, ///< Matches any run of characters.
+        STREAM ///< Matches the stream name.
+      };
+      Type type; ///< Kind of this token.
+      std::string text; ///< Text of a literal token.
+    };
+    std::string connector; ///< Name of the connector serving matching URLs.
+    std::string pattern; ///< The pattern as registered.
+    std::vector<Token> tail; ///< The compiled pattern after its literal prefix.
+    std::string suffix; ///< Literal text that matching URLs end with, checked before anything else.
+    bool segment; ///< Whether matching URLs are media segments, shared through the segment cache.
+    bool handOver; ///< Whether clients may be handed over to the connector, which then serves their connection alone.
+    long long int timeout; ///< Milliseconds the sub-connector may take to answer.
+    long long int idle; ///< Milliseconds the connection to the sub-connector is kept for reuse afterwards.
+    long long int keepAlive; ///< Milliseconds the client connection is kept open for its next request afterwards.
+  };
+
+  /// Result of matching a URL against the routing table.
+  struct RouteMatch{
+    const Route * route; ///< The matching route, 0 if none matched.
+    unsigned int streamStart; ///< Offset of the stream name in the URL.
+    unsigned int streamLen; ///< Length of the stream name, 0 if the route does not name a stream.
+  };
+
+  /// Routing table classifying request URLs by connector in a single pass.
+  /// The literal prefixes of all patterns are stored in a trie that the URL is walked through once. The routes of
+  /// the deepest node passed are tried first, in the order they were added, followed by those of shallower nodes.
+  /// Each route first checks its literal suffix and only then the rest of its pattern.
+  /// The stream name is returned as a position in the URL, so nothing is copied while matching.
+  class Router{
+    public:
+      /// Creates an empty table.
+      Router();
+      /// Deletes all routes.
+      ~Router();
+      /// Adds a pattern of URLs served by the given connector, returning the route for changing its timeouts.
+      Route & add(const std::string & connector, const std::string & pattern, bool segment = false);
+      /// Sets the timeouts of all routes added after this, in milliseconds.
+      void setTimeouts(long long int timeout, long long int idle, long long int keepAlive);
+      /// Overrides the timeouts of some routes, from a comma separated list of name=timeout[:idle[:keepalive]].
+      bool setTimeouts(const std::string & config);
+      /// Returns the keep-alive timeout of clients that did not make a request yet.
+      long long int getKeepAlive();
+      /// Finds the route serving the given URL. Returns false if no route matches.
+      bool match(const std::string & url, RouteMatch & M) const;
+    private:
+      /// A node of the prefix trie.
+      struct Node{
+        std::vector<std::pair<char, Node*> > children; ///< Nodes for the next character.
+        std::vector<Route*> routes; ///< Routes whose literal prefix ends here, in order of addition.
+      };
+      void clear(Node * N);
+      void listRoutes(Node * N, std::vector<Route*> & list);
+      Node root; ///< Node for the empty prefix.
+      long long int timeout; ///< Timeout of routes added from now on.
+      long long int idle; ///< Idle timeout of routes added from now on.
+      long long int keepAlive; ///< Keep-alive timeout of routes added from now on.
+  };
+
+  extern Router routes; ///< Routing table of the HTTP connector.
+}
@@ -22,6 +22,8 @@
 #include <sstream>
 #include <mist/stream.h>
 #include <mist/timing.h>
+#include "conn_http_handover.h"
+#include "conn_http_reader.h"
 
 /// Holds everything unique to HTTP Dynamic Connector.
 namespace Connector_HTTP {
@@ -87,7 +89,8 @@ namespace Connector_HTTP {
   } //BuildManifest
 
   /// Main function for Connector_HTTP_Dynamic
-  int Connector_HTTP_Dynamic(Socket::Connection conn){
+  /// If handedOver is set, conn is a client handed over by the HTTP connector, with its address already set.
+  int Connector_HTTP_Dynamic(Socket::Connection conn, bool handedOver){
     std::deque<std::string> FlashBuf;
     std::vector<int> Timestamps;
     int FlashBufSize = 0;
@@ -95,6 +98,8 @@ namespace Connector_HTTP {
 
     DTSC::Stream Strm; //Incoming stream buffer.
     HTTP::Parser HTTP_R, HTTP_S; //HTTP Receiver en HTTP Sender.
+    Reader reader; //collects requests from conn
+    std::string requestID; //identifier of the request being answered, if the HTTP connector numbered it
 
     bool ready4data = false; //Set to true when streaming is to begin.
     bool pending_manifest = false;
@@ -117,22 +122,15 @@ namespace Connector_HTTP {
     conn.setBlocking(false); //do not block on conn.spool() when no data is available
 
     while (conn.connected()){
-      if (conn.spool() || conn.Received().size()){
-        //make sure it ends in a \n
-        if ( *(conn.Received().get().rbegin()) != '\n'){
-          std::string tmp = conn.Received().get();
-          conn.Received().get().clear();
-          if (conn.Received().size()){
-            conn.Received().get().insert(0, tmp);
-          }else{
-            conn.Received().append(tmp);
-          }
-        }
-        if (HTTP_R.Read(conn.Received().get())){
+      if (conn.spool() || conn.Received().size() || reader.ready()){
+        if (reader.read(conn, HTTP_R)){
 #if DEBUG >= 4
           std::cout << "Received request: " << HTTP_R.getUrl() << std::endl;
 #endif
-          conn.setHost(HTTP_R.GetHeader("X-Origin"));
+          requestID = HTTP_R.GetHeader(REQUEST_ID_HEADER);
+          if (!handedOver && HTTP_R.GetHeader("X-Origin") != ""){ //set by the HTTP connector on relayed requests, sent by the client itself after a handover
+            conn.setHost(HTTP_R.GetHeader("X-Origin"));
+          }
           if (HTTP_R.url.find("Manifest") == std::string::npos){
             streamname = HTTP_R.url.substr(8, HTTP_R.url.find("/", 8) - 12);
             if ( !ss){
@@ -144,6 +142,7 @@ namespace Connector_HTTP {
                 ss.close();
                 HTTP_S.Clean();
                 HTTP_S.SetBody("No such stream " + streamname + " is available on the system. Please try again.\n");
+                tagResponse(HTTP_S, requestID);
                 conn.SendNow(HTTP_S.BuildResponse("404", "Not found"));
                 ready4data = false;
                 continue;
@@ -182,6 +181,7 @@ namespace Connector_HTTP {
               }
               std::string manifest = BuildManifest(streamname, Strm.metadata);
               HTTP_S.SetBody(manifest);
+              tagResponse(HTTP_S, requestID);
               conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
 #if DEBUG >= 3
               printf("Sent manifest\n");
@@ -212,6 +212,7 @@ namespace Connector_HTTP {
             ss.close();
             HTTP_S.Clean();
             HTTP_S.SetBody("No such stream " + streamname + " is available on the system. Please try again.\n");
+            tagResponse(HTTP_S, requestID);
             conn.SendNow(HTTP_S.BuildResponse("404", "Not found"));
             ready4data = false;
             continue;
@@ -248,6 +249,7 @@ namespace Connector_HTTP {
               }
               std::string manifest = BuildManifest(streamname, Strm.metadata);
               HTTP_S.SetBody(manifest);
+              tagResponse(HTTP_S, requestID);
               conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
 #if DEBUG >= 3
               printf("Sent manifest\n");
@@ -331,6 +333,7 @@ namespace Connector_HTTP {
                 //std::cerr << "\t[encoded] = " << ((MP4::TRUN&)(((MP4::TRAF&)(moof_box.getContent(1))).getContent(1))).getDataOffset() << std::endl;
 
                 HTTP_S.SetHeader("Content-Length", FlashBufSize + 8 + moof_box.boxedSize()); //32+33+btstrp.size());
+                tagResponse(HTTP_S, requestID);
                 conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
 
                 conn.SendNow(moof_box.asBox(), moof_box.boxedSize());
@@ -365,6 +368,7 @@ namespace Connector_HTTP {
             }
             std::string manifest = BuildManifest(streamname, Strm.metadata);
             HTTP_S.SetBody(manifest);
+            tagResponse(HTTP_S, requestID);
             conn.SendNow(HTTP_S.BuildResponse("200", "OK"));
 #if DEBUG >= 3
             printf("Sent manifest\n");
@@ -400,7 +404,9 @@ int main(int argc, char ** argv){
     if (S.connected()){ //check if the new connection is valid
       pid_t myid = fork();
       if (myid == 0){ //if new child, start MAINHANDLER
-        return Connector_HTTP::Connector_HTTP_Dynamic(S);
+        bool handedOver;
+        Socket::Connection C = Connector_HTTP::takeOver(S, handedOver);
+        return Connector_HTTP::Connector_HTTP_Dynamic(C, handedOver);
       }else{ //otherwise, do nothing or output debugging text
 #if DEBUG >= 3
         fprintf(stderr, "Spawned new process %i for socket %i\n", (int)myid, S.getSocket());
@@ -0,0 +1,138 @@
+/// \file conn_http_timers.cpp
+/// Contains code for the timeouts of connections in the HTTP connector.
+
+#include <mist/timing.h>
+#include "conn_http_timers.h"
+
+/// Creates a timer that is not armed.
+Connector_HTTP::Timer::Timer(){
+  owner = 0;
+  kind = 0;
+  expires = 0;
+  prev = 0;
+  next = 0;
+}
+
+/// Returns true if the timer is armed and did not expire yet.
+bool Connector_HTTP::Timer::armed(){
+  return next != 0;
+}
+
+/// Creates an empty wheel starting at the current time.
+Connector_HTTP::TimerWheel::TimerWheel(){
+  for (int l = 0; l < TIMER_LEVELS; l++){
+    for (int s = 0; s < TIMER_SLOTS; s++){
+      slots[l][s].prev = &slots[l][s];
+      slots[l][s].next = &slots[l][s];
+    }
+  }
+  due.prev = &due;
+  due.next = &due;
+  current = Util::getMS() / TIMER_TICK;
+  count = 0;
+}
+
+/// Arms the given timer to expire after the given amount of milliseconds, re-arming it if it was armed.
+void Connector_HTTP::TimerWheel::arm(Timer & T, long long int ms){
+  if (T.armed()){
+    unlink( &T);
+  }
+  T.expires = (Util::getMS() + ms + TIMER_TICK - 1) / TIMER_TICK;
+  insert( &T, current + 1); //the current tick was already expired
+  count++;
+}
+
+/// Disarms the given timer, if it was armed.
+void Connector_HTTP::TimerWheel::cancel(Timer & T){
+  if (T.armed()){
+    unlink( &T);
+    count--;
+  }
+}
+
+/// Returns the amount of armed timers.
+unsigned int Connector_HTTP::TimerWheel::size(){
+  return count;
+}
+
+/// Puts a timer in the slot for its expiry tick, or for the given earliest tick if it is overdue, on the lowest
+/// level that reaches that far. Timers beyond the reach of the highest level are put in its furthest slot, and
+/// move down from there.
+void Connector_HTTP::TimerWheel::insert(Timer * T, long long int earliest){
+  long long int at = T->expires;
+  if (at < earliest){
+    at = earliest;
+  }
+  long long int delta = at - current;
+  int level = 0;
+  while (level < TIMER_LEVELS - 1 && delta >= (1LL << (TIMER_BITS * (level + 1)))){
+    level++;
+  }
+  if (level == TIMER_LEVELS - 1 && delta >= (1LL << (TIMER_BITS * TIMER_LEVELS))){
+    at = current + (1LL << (TIMER_BITS * TIMER_LEVELS)) - 1;
+  }
+  Timer * head = &slots[level][(at >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1)];
+  T->prev = head->prev;
+  T->next = head;
+  head->prev->next = T;
+  head->prev = T;
+}
+
+/// Takes a timer out of its slot.
+void Connector_HTTP::TimerWheel::unlink(Timer * T){
+  T->prev->next = T->next;
+  T->next->prev = T->prev;
+  T->prev = 0;
+  T->next = 0;
+}
+
+/// Advances the wheel to the current time, keeping all timers that expired until taken by expired().
+void Connector_HTTP::TimerWheel::advance(){
+  long long int now = Util::getMS() / TIMER_TICK;
+  if (count == 0){
+    if (now > current){
+      current = now; //nothing to expire, skip ahead
+    }
+    return;
+  }
+  while (current < now){
+    current++;
+    //spread out higher level slots that are now within reach, from the bottom up
+    for (int level = 1; level < TIMER_LEVELS; level++){
+      if (current & ((1LL << (TIMER_BITS * level)) - 1)){
+        break;
+      }
+      Timer * head = &slots[level][(current >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1)];
+      while (head->next != head){
+        Timer * T = head->next;
+        unlink(T);
+        insert(T, current);
+      }
+    }
+    Timer * head = &slots[0][current & (TIMER_SLOTS - 1)];
+    while (head->next != head){
+      Timer * T = head->next;
+      unlink(T);
+      if (T->expires > current){
+        insert(T, current + 1); //was clamped to the reach of the wheel, keep waiting
+        continue;
+      }
+      T->prev = due.prev;
+      T->next = &due;
+      due.prev->next = T;
+      due.prev = T;
+    }
+  }
+}
+
+/// Takes the next timer that expired out of the wheel, or returns 0 if there are none.
+/// The returned timer is no longer armed, so it may be armed again right away.
+Connector_HTTP::Timer * Connector_HTTP::TimerWheel::expired(){
+  if (due.next == &due){
+    return 0;
+  }
+  Timer * T = due.next;
+  unlink(T);
+  count--;
+  return T;
+}
@@ -0,0 +1,60 @@
+/// \file conn_http_timers.h
+/// Contains definitions for the timeouts of connections in the HTTP connector.
+
+#pragma once
+
+/// Milliseconds per tick of a TimerWheel, the precision of all timeouts.
+#define TIMER_TICK 100
+/// Amount of bits of the tick number each level of a TimerWheel covers.
+#define TIMER_BITS 6
+/// Amount of slots per level of a TimerWheel.
+#define TIMER_SLOTS (1 << TIMER_BITS)
+/// Amount of levels of a TimerWheel. Four levels of 64 slots of 100ms reach about 19 days ahead.
+#define TIMER_LEVELS 4
+
+namespace Connector_HTTP {
+  /// A timeout that can be armed in a TimerWheel, usually a member of the object it belongs to.
+  class Timer{
+    public:
+      /// Creates a timer that is not armed.
+      Timer();
+      /// Returns true if the timer is armed and did not expire yet.
+      bool armed();
+      void * owner; ///< Object this timer belongs to.
+      int kind; ///< What this timer is for, so the owner can be told apart when it expires.
+      long long int expires; ///< Tick at which this timer expires.
+    private:
+      friend class TimerWheel;
+      Timer * prev; ///< Previous timer in the same slot, or the slot itself.
+      Timer * next; ///< Next timer in the same slot, or the slot itself.
+  };
+
+  /// Hierarchical timer wheel, arming, cancelling and expiring timers in constant time.
+  /// Every level is a ring of slots holding doubly linked lists of timers. The first level holds the timers of the
+  /// next TIMER_SLOTS ticks, one slot per tick; every next level covers TIMER_SLOTS times as many ticks per slot.
+  /// Whenever the first level wraps around, the next slot of the level above is spread out over the level below.
+  /// Expired timers stay armed in a separate list until taken one by one, so handling one of them may still cancel
+  /// any of the others.
+  class TimerWheel{
+    public:
+      /// Creates an empty wheel starting at the current time.
+      TimerWheel();
+      /// Arms the given timer to expire after the given amount of milliseconds, re-arming it if it was armed.
+      void arm(Timer & T, long long int ms);
+      /// Disarms the given timer, if it was armed.
+      void cancel(Timer & T);
+      /// Advances the wheel to the current time, keeping all timers that expired until taken by expired().
+      void advance();
+      /// Takes the next timer that expired out of the wheel, or returns 0 if there are none.
+      Timer * expired();
+      /// Returns the amount of armed timers.
+      unsigned int size();
+    private:
+      void insert(Timer * T, long long int earliest);
+      void unlink(Timer * T);
+      Timer slots[TIMER_LEVELS][TIMER_SLOTS]; ///< Heads of the timer lists of all slots.
+      Timer due; ///< Head of the list of expired timers.
+      long long int current; ///< The last tick that was expired.
+      unsigned int count; ///< Amount of armed timers.
+  };
+}
@@ -7,6 +7,8 @@
 #include <mist/socket.h>
 #include <mist/stream.h>
 #include <mist/timing.h>
+#include "buffer_shm.h"
+#include "buffer_stats.h"
 
 /// Contains the main code for the RAW connector.
 /// Expects a single commandline argument telling it which stream to connect to,
@@ -23,10 +25,16 @@ int main(int argc, char ** argv){
     std::cout << "Could not open stream " << conf.getString("stream_name") << std::endl;
     return 1;
   }
+  Buffer::ShmReader shm;
+  if (shm.open(conf.getString("stream_name"))){
+    S.SendNow("M\n"); //receive packets through shared memory instead
+  }
+  Buffer::StatsWriter stats;
+  stats.open(conf.getString("stream_name"), S); //report statistics through shared memory, if possible
   long long int lastStats = 0;
   long long int started = Util::epoch();
   while (std::cout.good()){
-    if (S.spool()){
+    if (shm.spool(S)){
       while (S.Received().size()){
         std::cout.write(S.Received().get().c_str(), S.Received().get().size());
         S.Received().get().clear();
@@ -37,14 +45,10 @@ int main(int argc, char ** argv){
     unsigned int now = Util::epoch();
     if (now != lastStats){
       lastStats = now;
-      std::stringstream st;
-      st << "S localhost RAW " << (Util::epoch() - started) << " " << S.dataDown() << " " << S.dataUp() << "\n";
-      S.SendNow(st.str().c_str());
+      stats.send(S, "localhost", "RAW", Util::epoch() - started, S.dataDown(), S.dataUp());
     }
   }
-  std::stringstream st;
-  st << "S localhost RAW " << (Util::epoch() - started) << " " << S.dataDown() << " " << S.dataUp() << "\n";
-  S.SendNow(st.str().c_str());
+  stats.send(S, "localhost", "RAW", Util::epoch() - started, S.dataDown(), S.dataUp());
   S.close();
   return 0;
 }
@@ -18,6 +18,8 @@
 #include <mist/rtmpchunks.h>
 #include <mist/stream.h>
 #include <mist/timing.h>
+#include "buffer_shm.h"
+#include "buffer_stats.h"
 
 /// Holds all functions and data unique to the RTMP Connector
 namespace Connector_RTMP {
@@ -38,6 +40,8 @@ namespace Connector_RTMP {
 
   Socket::Connection Socket; ///< Socket connected to user
   Socket::Connection SS; ///< Socket connected to server
+  Buffer::ShmReader shm; ///< Shared memory of the buffer, if available.
+  Buffer::StatsWriter stats; ///< Statistics slot in shared memory of the buffer, if available.
   std::string streamname; ///< Stream that will be opened
   void parseChunk(Socket::Buffer & buffer); ///< Parses a single RTMP chunk.
   void sendCommand(AMF::Object & amfreply, int messagetype, int stream_id); ///< Sends a RTMP command either in AMF or AMF3 mode.
@@ -49,6 +53,7 @@ namespace Connector_RTMP {
 int Connector_RTMP::Connector_RTMP(Socket::Connection conn){
   Socket = conn;
   Socket.setBlocking(false);
+  long long int started = Util::epoch();
   FLV::Tag tag, init_tag;
   DTSC::Stream Strm;
 
@@ -99,6 +104,10 @@ int Connector_RTMP::Connector_RTMP(Socket::Connection conn){
           break;
         }
         SS.setBlocking(false);
+        if (shm.open(streamname)){
+          SS.SendNow("M\n"); //receive packets through shared memory instead
+        }
+        stats.open(streamname, SS); //report statistics through shared memory, if possible
 #if DEBUG >= 3
         fprintf(stderr, "Everything connected, starting to send video data...\n");
 #endif
@@ -109,10 +118,10 @@ int Connector_RTMP::Connector_RTMP(Socket::Connection conn){
         long long int now = Util::epoch();
         if (now != lastStats){
           lastStats = now;
-          SS.SendNow(Socket.getStats("RTMP").c_str());
+          stats.send(SS, Socket.getHost(), "RTMP", now - started, Socket.dataUp(), Socket.dataDown());
         }
       }
-      if (SS.spool()){
+      if (shm.spool(SS)){
         while (Strm.parsePacket(SS.Received())){
           if (play_trans != -1){
             //send a status reply
@@ -177,7 +186,7 @@ int Connector_RTMP::Connector_RTMP(Socket::Connection conn){
     }
   }
   Socket.close();
-  SS.SendNow(Socket.getStats("RTMP").c_str());
+  stats.send(SS, Socket.getHost(), "RTMP", Util::epoch() - started, Socket.dataUp(), Socket.dataDown());
   SS.close();
   return 0;
 } //Connector_RTMP
@@ -551,6 +560,7 @@ void Connector_RTMP::parseAMFCommand(AMF::Object & amfdata, int messagetype, int
     amfreply.getContentP(3)->addContent(AMF::Object("details", "DDV"));
     amfreply.getContentP(3)->addContent(AMF::Object("clientid", (double)1337));
     sendCommand(amfreply, play_msgtype, play_streamid);
+    shm.close(); //shared memory only follows the live point
     SS.Send("s ");
     SS.Send(JSON::Value((long long int)amfdata.getContentP(3)->NumValue()).asString().c_str());
     SS.Send("\n");
@@ -558,6 +568,7 @@ void Connector_RTMP::parseAMFCommand(AMF::Object & amfdata, int messagetype, int
   } //seek
   if ((amfdata.getContentP(0)->StrValue() == "pauseRaw") || (amfdata.getContentP(0)->StrValue() == "pause")){
     if (amfdata.getContentP(3)->NumValue()){
+      shm.close(); //continue from the paused position when playing again
       SS.Send("q\n"); //quit playing
       //send a status reply
       AMF::Object amfreply("container", AMF::AMF0_DDV_CONTAINER);
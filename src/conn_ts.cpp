@@ -20,6 +20,7 @@
 #include <mist/ts_packet.h> //TS support
 #include <mist/dtsc.h> //DTSC support
 #include <mist/mp4.h> //For initdata conversion
+#include "buffer_shm.h"
 /// The main function of the connector
 /// \param conn A connection with the client
 /// \param streamname The name of the stream
@@ -42,6 +43,7 @@ int TS_Handler(Socket::Connection conn, std::string streamname){
   DTSC::Stream Strm;
   bool inited = false;
   Socket::Connection ss;
+  Buffer::ShmReader shm; ///< Shared memory of the buffer, if available.
 
   while (conn.connected()){
     if ( !inited){
@@ -53,13 +55,16 @@ int TS_Handler(Socket::Connection conn, std::string streamname){
         conn.close();
         break;
       }
+      if (shm.open(streamname)){
+        ss.SendNow("M\n"); //receive packets through shared memory instead
+      }
       ss.SendNow("p\n");
 #if DEBUG >= 3
       fprintf(stderr, "Everything connected, starting to send video data...\n");
 #endif
       inited = true;
     }
-    if (ss.spool()){
+    if (shm.spool(ss)){
       while (Strm.parsePacket(ss.Received())){
         if ( !haveAvcc){
           avccbox.setPayload(Strm.metadata["video"]["init"].asString());
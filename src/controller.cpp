@@ -14,6 +14,7 @@
 #include "controller_connectors.h"
 #include "controller_streams.h"
 #include "controller_capabilities.h"
+#include "conn_http_reader.h"
 #include "server.html.h"
 
 #define UPLINK_INTERVAL 30
@@ -28,6 +29,7 @@ namespace Controller {
     public:
       Socket::Connection C;
       HTTP::Parser H;
+      Connector_HTTP::Reader reader;
       bool Authorized;
       bool clientMode;
       int logins;
@@ -152,7 +154,10 @@ int main(int argc, char ** argv){
       JSON::fromString(
           "{\"long\":\"account\", \"short\":\"a\", \"arg\":\"string\" \"default\":\"\", \"help\":\"A username:password string to create a new account with.\"}"));
   conf.addOption("uplink", JSON::fromString("{\"default\":0, \"help\":\"Enable MistSteward uplink.\", \"short\":\"U\", \"long\":\"uplink\"}"));
+  conf.addOption("multibuffer",
+      JSON::fromString("{\"default\":0, \"help\":\"Hold all push streams in a single buffer process.\", \"short\":\"m\", \"long\":\"multibuffer\"}"));
   conf.parseArgs(argc, argv);
+  Controller::multiBuffer = conf.getBool("multibuffer");
 
   std::string account = conf.getString("account");
   if (account.size() > 0){
@@ -219,6 +224,7 @@ int main(int argc, char ** argv){
         Response["streams"] = Controller::Storage["streams"];
         Response["log"] = Controller::Storage["log"];
         Response["statistics"] = Controller::Storage["statistics"];
+        Response["http"] = Controller::Storage["http"];
         Response["now"] = (unsigned int)lastuplink;
         uplink->H.Clean();
         uplink->H.SetBody("command=" + HTTP::Parser::urlencode(Response.toString()));
@@ -259,7 +265,29 @@ int main(int argc, char ** argv){
                 Controller::Storage["streams"][thisbuffer]["meta"] = Request["meta"];
               }
               if (Request.isMember("totals")){
-                Controller::Storage["statistics"][thisbuffer]["curr"] = Request["curr"];
+                if (Request.isMember("delta")){
+                  //only changed fields of changed users, and the users that left
+                  JSON::Value & curr = Controller::Storage["statistics"][thisbuffer]["curr"];
+                  //after statistics or streams were cleared, unchanged users and metadata are missing until the next full report
+                  bool incomplete = !Controller::Storage["streams"].isMember(thisbuffer) || !Controller::Storage["streams"][thisbuffer].isMember("meta");
+                  for (JSON::ObjIter u_it = Request["curr"].ObjBegin(); u_it != Request["curr"].ObjEnd(); ++u_it){
+                    if ( !curr.isMember(u_it->first) && !u_it->second.isMember("host")){
+                      incomplete = true; //a change to a user we do not know, new users are always sent completely
+                      continue;
+                    }
+                    for (JSON::ObjIter f_it = u_it->second.ObjBegin(); f_it != u_it->second.ObjEnd(); ++f_it){
+                      curr[u_it->first][f_it->first] = f_it->second;
+                    }
+                  }
+                  for (JSON::ArrIter g_it = Request["gone"].ArrBegin(); g_it != Request["gone"].ArrEnd(); ++g_it){
+                    curr.removeMember(g_it->asString());
+                  }
+                  if (incomplete){
+                    it->Send("full\n"); //ask the buffer for a full report
+                  }
+                }else{
+                  Controller::Storage["statistics"][thisbuffer]["curr"] = Request["curr"];
+                }
                 std::string nowstr = Request["totals"]["now"].asString();
                 Controller::Storage["statistics"][thisbuffer]["totals"][nowstr] = Request["totals"];
                 Controller::Storage["statistics"][thisbuffer]["totals"][nowstr].removeMember("now");
@@ -294,6 +322,10 @@ int main(int argc, char ** argv){
                 }
               }
             }
+            if (Request.isMember("http")){
+              //HTTP connectors report their segment cache, one entry per listening port
+              Controller::Storage["http"][Request["http"]["port"].asString()] = Request["http"];
+            }
           }
         }
       }
@@ -305,18 +337,8 @@ int main(int argc, char ** argv){
           users.erase(it);
           break;
         }
-        if (it->C.spool() || it->C.Received().size()){
-          if ( *(it->C.Received().get().rbegin()) != '\n'){
-            std::string tmp = it->C.Received().get();
-            it->C.Received().get().clear();
-            if (it->C.Received().size()){
-              it->C.Received().get().insert(0, tmp);
-            }else{
-              it->C.Received().append(tmp);
-            }
-            continue;
-          }
-          if (it->H.Read(it->C.Received().get())){
+        if (it->C.spool() || it->C.Received().size() || it->reader.ready()){
+          if (it->reader.read(it->C, it->H)){
             Response.null(); //make sure no data leaks from previous requests
             if (it->clientMode){
               // In clientMode, requests are reversed. These are connections we initiated to GearBox.
@@ -334,6 +356,7 @@ int main(int argc, char ** argv){
                     Response["streams"] = Controller::Storage["streams"];
                     Response["log"] = Controller::Storage["log"];
                     Response["statistics"] = Controller::Storage["statistics"];
+                    Response["http"] = Controller::Storage["http"];
                     Response["authorize"]["username"] = COMPILED_USERNAME;
                     Controller::checkCapable(Response["capabilities"]);
                     Controller::Log("UPLK", "Responding to login challenge: " + Request["authorize"]["challenge"].asString());
@@ -402,6 +425,7 @@ int main(int argc, char ** argv){
                   //sent any available logs and statistics
                   Response["log"] = Controller::Storage["log"];
                   Response["statistics"] = Controller::Storage["statistics"];
+                  Response["http"] = Controller::Storage["http"];
                   //clear log and statistics if requested
                   if (Request.isMember("clearstatlogs")){
                     Controller::Storage["log"].null();
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <fstream>
+#include <cstdio>
 #include <mist/timing.h>
 #include "controller_storage.h"
 
@@ -26,11 +27,16 @@ namespace Controller {
   }
 
   /// Write contents to Filename
+  /// The contents are written to a temporary file first, which then replaces Filename, so readers never see it half written.
   void WriteFile(std::string Filename, std::string contents){
+    std::string tmpName = Filename + ".tmp";
     std::ofstream File;
-    File.open(Filename.c_str());
+    File.open(tmpName.c_str());
     File << contents << std::endl;
     File.close();
+    if ( !File.fail()){
+      rename(tmpName.c_str(), Filename.c_str());
+    }
   }
 
 }
@@ -8,6 +8,7 @@
 namespace Controller {
 
   std::map<std::string, int> lastBuffer; ///< Last moment of contact with all buffers.
+  bool multiBuffer = false; ///< Whether all push streams are held by a single buffer process.
 
   bool streamsEqual(JSON::Value & one, JSON::Value & two){
     if (one["channel"]["URL"] != two["channel"]["URL"]){
@@ -24,6 +25,14 @@ namespace Controller {
     std::string preset = data["preset"]["cmd"];
     std::string cmd1, cmd2, cmd3;
     if (URL.substr(0, 4) == "push"){
+      if (multiBuffer){
+        //the shared buffer picks up all push streams from the stream list by itself
+        if ( !Util::Procs::isActive("MistBufferMulti")){
+          Util::Procs::Start("MistBufferMulti", Util::getMyPath() + "MistBuffer -s -M");
+          Log("BUFF", "(re)starting shared stream buffer for all push streams");
+        }
+        return;
+      }
       std::string pusher = URL.substr(7);
       cmd2 = "MistBuffer -s " + name + " " + pusher;
       Util::Procs::Start(name, Util::getMyPath() + cmd2);
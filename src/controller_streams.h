@@ -2,6 +2,7 @@
 
 namespace Controller {
   extern std::map<std::string, int> lastBuffer; ///< Last moment of contact with all buffers.
+  extern bool multiBuffer; ///< Whether all push streams are held by a single buffer process.
 
   bool streamsEqual(JSON::Value & one, JSON::Value & two);
   void startStream(std::string name, JSON::Value & data);